@@ -36,16 +36,28 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #endif
 
 typedef struct sockaddr sockaddr;
 typedef struct timeval timeval;
 
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <locale.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <vector>
 #include "redic.h"
 
 bool is_in4(const char *s)
@@ -80,71 +92,465 @@ bool is_in6(const char *s)
     return true;
 }
 
+//write val in decimal, whatever the locale; buf holds 21 chars at least
+static int redic_itoa(int64_t val, char *buf)
+{
+    char tmp[24];
+    int len = 0;
+    uint64_t num = val < 0 ? 0 - (uint64_t)val : (uint64_t)val;
+
+    do
+    {
+        tmp[len++] = '0' + (char)(num % 10);
+        num /= 10;
+    } while (num > 0);
+
+    int pos = 0;
+
+    if (val < 0)
+        buf[pos++] = '-';
+
+    while (len > 0)
+        buf[pos++] = tmp[--len];
+
+    buf[pos] = '\0';
+    return pos;
+}
+
+//read a double written with a '.', whatever the locale
+static double redic_strtod(const char *str)
+{
+    char point = *localeconv()->decimal_point;
+
+    if (point == '.' || !strchr(str, '.'))
+        return strtod(str, NULL);
+
+    string copy(str);
+    copy[copy.find('.')] = point;
+    return strtod(copy.c_str(), NULL);
+}
+
+//write the shortest decimal that reads back as val, "inf" and "-inf" included;
+//buf holds 32 chars at least
+static int redic_dtoa(double val, char *buf)
+{
+    int len = 0;
+
+    for (int digits=15; digits<=17; digits++)
+    {
+        len = sprintf(buf, "%.*g", digits, val);
+
+        char point = *localeconv()->decimal_point;
+        char *pos = point == '.' ? NULL : strchr(buf, point);
+
+        if (pos)
+            *pos = '.';
+
+        if (redic_strtod(buf) == val)
+            break;
+    }
+
+    return len;
+}
+
 class Request
 {
 private:
-    string req;
+    //small requests are encoded in place, only large ones go to the heap
+    char fixed[512];
+    int used;
+    string spill;
+
+    void put(const char *data, int len)
+    {
+        if (spill.empty() && used+len <= (int)sizeof(fixed))
+        {
+            memcpy(fixed+used, data, len);
+            used += len;
+            return;
+        }
+
+        if (spill.empty())
+            spill.assign(fixed, used);
+
+        spill.append(data, len);
+    }
 
 public:
     Request(int num)
     {
         char buf[16];
-        sprintf(buf, "*%d\r\n", num);
-        req = buf;
+        used = 0;
+        put(buf, sprintf(buf, "*%d\r\n", num));
     }
 
-    void append(const string &arg)
+    void append(const char *arg, int len)
     {
         char buf[16];
-        sprintf(buf, "$%d\r\n", arg.length());
-        req.append(buf);
-        req.append(arg);
-        req.append("\r\n");
+        put(buf, sprintf(buf, "$%d\r\n", len));
+        put(arg, len);
+        put("\r\n", 2);
+    }
+
+    void append(const string &arg)
+    {
+        append(arg.data(), arg.length());
     }
 
     void append(const char *arg)
     {
-        char buf[16];
-        sprintf(buf, "$%d\r\n", strlen(arg));
-        req.append(buf);
-        req.append(arg);
-        req.append("\r\n");
+        append(arg, strlen(arg));
     }
 
     void append(int arg)
     {
-        char buf[16];
-        sprintf(buf, "%d", arg);
-        append(buf);
+        append((int64_t)arg);
+    }
+
+    void append(int64_t arg)
+    {
+        char buf[24];
+        append(buf, redic_itoa(arg, buf));
     }
 
     void append(double arg)
     {
-        char buf[16];
-        sprintf(buf, "%f", arg);
-        append(buf);
+        char buf[32];
+        append(buf, redic_dtoa(arg, buf));
     }
 
     const char *str()
     {
-        return req.c_str();
+        return spill.empty() ? fixed : spill.data();
     }
 
     int len()
     {
-        return req.length();
+        return spill.empty() ? used : spill.length();
     }
 };
 
 #define LOG(...)
 #define TRC(...)
 
+///Bump allocator for the Visitor elements of one connection that straddle
+///the receive buffer. It is reset rather than freed between commands; once
+///it has grown to the largest such element seen, it serves from one block.
+class RedicArena
+{
+private:
+    char *block;
+    int cap;
+    int used;
+    int spilled;
+    int peak;
+    std::vector<char *> spills;
+
+public:
+    RedicArena()
+    {
+        block = NULL;
+        cap = 0;
+        used = 0;
+        spilled = 0;
+        peak = 0;
+    }
+
+    ~RedicArena()
+    {
+        release();
+        free(block);
+    }
+
+    char *alloc(int len)
+    {
+        if (used + len > cap)
+        {
+            //keep the old block alive, the current reply may point into it
+            if (block)
+                spills.push_back(block);
+
+            spilled += used;
+            cap = cap*2 > len ? cap*2 : len;
+            block = (char *)malloc(cap);
+            used = 0;
+        }
+
+        char *ptr = block + used;
+        used += len;
+
+        if (spilled + used > peak)
+            peak = spilled + used;
+
+        return ptr;
+    }
+
+    void reset()
+    {
+        //fold the spilled blocks into one block big enough for next time
+        if (!spills.empty())
+        {
+            release();
+
+            if (cap < peak)
+            {
+                free(block);
+                cap = peak;
+                block = (char *)malloc(cap);
+            }
+        }
+
+        used = 0;
+        spilled = 0;
+    }
+
+    void reserve(int bytes)
+    {
+        reset();
+
+        if (cap < bytes)
+        {
+            free(block);
+            cap = bytes;
+            block = (char *)malloc(cap);
+        }
+    }
+
+    int high_water()
+    {
+        return peak;
+    }
+
+private:
+    void release()
+    {
+        for (size_t i=0; i<spills.size(); i++)
+            free(spills[i]);
+
+        spills.clear();
+    }
+};
+
+class RedicMutex
+{
+private:
+#ifdef WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t mtx;
+#endif
+
+    RedicMutex(const RedicMutex &);
+    RedicMutex &operator=(const RedicMutex &);
+
+    friend class RedicCond;
+
+public:
+#ifdef WIN32
+    RedicMutex() { InitializeCriticalSection(&cs); }
+    ~RedicMutex() { DeleteCriticalSection(&cs); }
+    void lock() { EnterCriticalSection(&cs); }
+    void unlock() { LeaveCriticalSection(&cs); }
+#else
+    RedicMutex() { pthread_mutex_init(&mtx, NULL); }
+    ~RedicMutex() { pthread_mutex_destroy(&mtx); }
+    void lock() { pthread_mutex_lock(&mtx); }
+    void unlock() { pthread_mutex_unlock(&mtx); }
+#endif
+};
+
+class RedicCond
+{
+private:
+#ifdef WIN32
+    CONDITION_VARIABLE cv;
+#else
+    pthread_cond_t cv;
+#endif
+
+    RedicCond(const RedicCond &);
+    RedicCond &operator=(const RedicCond &);
+
+public:
+#ifdef WIN32
+    RedicCond() { InitializeConditionVariable(&cv); }
+    ~RedicCond() {}
+    void wait(RedicMutex &m) { SleepConditionVariableCS(&cv, &m.cs, INFINITE); }
+    bool wait(RedicMutex &m, int ms) { return SleepConditionVariableCS(&cv, &m.cs, ms) != 0; }
+    void broadcast() { WakeAllConditionVariable(&cv); }
+#else
+    RedicCond() { pthread_cond_init(&cv, NULL); }
+    ~RedicCond() { pthread_cond_destroy(&cv); }
+    void wait(RedicMutex &m) { pthread_cond_wait(&cv, &m.mtx); }
+
+    //false once ms pass with no signal
+    bool wait(RedicMutex &m, int ms)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms/1000;
+        ts.tv_nsec += (ms%1000)*1000000L;
+
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        return pthread_cond_timedwait(&cv, &m.mtx, &ts) == 0;
+    }
+
+    void broadcast() { pthread_cond_broadcast(&cv); }
+#endif
+};
+
+class RedicGuard
+{
+private:
+    RedicMutex &mutex;
+
+public:
+    RedicGuard(RedicMutex &m) : mutex(m) { mutex.lock(); }
+    ~RedicGuard() { mutex.unlock(); }
+};
+
+class RedicThread
+{
+private:
+#ifdef WIN32
+    HANDLE handle;
+
+    void *(*func)(void *);
+    void *param;
+
+    static DWORD WINAPI entry(LPVOID self)
+    {
+        RedicThread *thread = (RedicThread *)self;
+        thread->func(thread->param);
+        return 0;
+    }
+#else
+    pthread_t handle;
+#endif
+
+    bool started;
+
+public:
+    RedicThread()
+    {
+        started = false;
+    }
+
+    bool start(void *(*fn)(void *), void *arg)
+    {
+#ifdef WIN32
+        func = fn;
+        param = arg;
+        handle = CreateThread(NULL, 0, entry, this, 0, NULL);
+        started = handle != NULL;
+#else
+        started = pthread_create(&handle, NULL, fn, arg) == 0;
+#endif
+        return started;
+    }
+
+    void join()
+    {
+        if (!started)
+            return;
+
+#ifdef WIN32
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+#else
+        pthread_join(handle, NULL);
+#endif
+        started = false;
+    }
+};
+
+//milliseconds of a clock that never goes back
+static int64_t redic_clock()
+{
+#ifdef WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+#endif
+}
+
+static void redic_sleep(int ms)
+{
+#ifdef WIN32
+    Sleep(ms);
+#else
+    usleep(ms*1000);
+#endif
+}
+
 const char REDIC_ERROR	= '-';
 const char REDIC_INLINE	= '+';
 const char REDIC_INT	= ':';
 const char REDIC_BULK	= '$';
 const char REDIC_MULTI	= '*';
 
+//RESP3
+const char REDIC_NULL	= '_';
+const char REDIC_DOUBLE	= ',';
+const char REDIC_BOOL	= '#';
+const char REDIC_BIGNUM	= '(';
+const char REDIC_BLOBERR	= '!';
+const char REDIC_VERBATIM	= '=';
+const char REDIC_MAP	= '%';
+const char REDIC_SET	= '~';
+const char REDIC_ATTR	= '|';
+const char REDIC_PUSH	= '>';
+
+
+//encode cmd [key [sub]] items... as commands of at most REDIC_CHUNK_ARGS items
+//or about REDIC_CHUNK_BYTES bytes, items taken step at a time, e.g. field and value
+static int encode_chunks(string &cmds, const char *cmd, const char *key, const Redic::List &items, int step, const char *sub = NULL)
+{
+    int num = 0;
+    Redic::List::const_iterator it = items.begin();
+
+    while (it != items.end())
+    {
+        //measure the chunk first, its header holds the argument count
+        Redic::List::const_iterator end = it;
+        int args = 0;
+        int bytes = 0;
+
+        while (end != items.end() && (args == 0 || (args < REDIC_CHUNK_ARGS && bytes < REDIC_CHUNK_BYTES)))
+        {
+            for (int i=0; i<step && end != items.end(); i++, end++)
+            {
+                bytes += end->length();
+                args++;
+            }
+        }
+
+        Request req(args + 1 + (key != NULL) + (sub != NULL));
+        req.append(cmd);
+
+        if (key)
+            req.append(key);
+
+        if (sub)
+            req.append(sub);
+
+        for (; it != end; it++)
+            req.append(*it);
+
+        cmds.append(req.str(), req.len());
+        num++;
+    }
+
+    return num;
+}
+
 class RedicEntity
 {
 private:
@@ -152,6 +558,7 @@ private:
 	int fd;
 
 	timeval tv;
+	int extra;
 	char buffer[1024];
 	int head;
 	int tail;
@@ -161,6 +568,20 @@ private:
 
 	int err;
     string svrerr;
+    string line;
+
+    Redic::Parser parser;
+
+    int proto;
+    Redic::PushHandler *handler;
+    Redic::PushHandler *tracker;
+    Redic::Reply push;
+
+    string host;
+    short port;
+    string passwd;
+
+    RedicArena arena;
 
 public:
 
@@ -173,6 +594,13 @@ public:
 
 		ready = false;
 		fd = -1;
+		extra = 0;
+		head = 0;
+		tail = 0;
+		proto = 2;
+		handler = NULL;
+		tracker = NULL;
+		port = 0;
 	}
 
 	~RedicEntity()
@@ -185,10 +613,78 @@ public:
 		return err;
 	}
 
+	//let the next command wait ms longer for its reply, e.g. a blocking one
+	void extend(int ms)
+	{
+		extra = ms > 0 ? ms : 0;
+	}
+
+	void arm()
+	{
+		int ms = TIMEOUT_VAL + extra;
+		tv.tv_sec = ms/1000;
+		tv.tv_usec = (ms%1000)*1000;
+		extra = 0;
+	}
+
+	int handle()
+	{
+		return fd;
+	}
+
+	RedicArena &reply_arena()
+	{
+		return arena;
+	}
+
+	int protocol()
+	{
+		return proto;
+	}
+
+	void set_protocol(int version)
+	{
+		proto = version;
+	}
+
+	void set_handler(Redic::PushHandler *h)
+	{
+		handler = h;
+	}
+
+	void set_tracker(Redic::PushHandler *t)
+	{
+		tracker = t;
+	}
+
+	const string &peer_host()
+	{
+		return host;
+	}
+
+	short peer_port()
+	{
+		return port;
+	}
+
+	const string &password()
+	{
+		return passwd;
+	}
+
+	void set_password(const char *password)
+	{
+		passwd = password;
+	}
+
 	int conn(const char *host, short port)
 	{
 		disconn();
 
+		this->host = host;
+		this->port = port;
+		passwd.clear();
+
 		sockaddr sa;
 
         if (is_in4(host))
@@ -284,6 +780,9 @@ public:
 
         LOG("connected to server ...");
 		ready = true;
+		head = 0;
+		tail = 0;
+		proto = 2;
 		return ok;
 	}
 
@@ -381,17 +880,10 @@ public:
     {
         assert(tail >= head);
 
-        if (head == tail)
+        if (skip_push() != ok)
         {
-            int ret = skt_read(fd, buffer, sizeof(buffer));
-			if (ret <= 0)
-			{
-				LOG("fail to read prefix");
-				return xx;
-			}
-
-            head = 0;
-			tail = ret;
+            LOG("fail to read prefix");
+            return xx;
         }
 
         pre = buffer[head];
@@ -399,18 +891,144 @@ public:
         return ok;
     }
 
-    int read_crlf()
+    //push messages arrive out of band, hand them over ahead of the reply
+    int skip_push()
     {
-        if (head == tail)
+        while (true)
         {
-            int ret = skt_read(fd, buffer, sizeof(buffer));
-			if (ret <= 0)
-			{
-				LOG("fail to read char cr");
-				return xx;
-			}
+            if (head == tail)
+            {
+                int ret = skt_read(fd, buffer, sizeof(buffer));
+    			if (ret <= 0)
+    			{
+    				LOG("fail to read push");
+    				return xx;
+    			}
 
-            head = 0;
+                head = 0;
+    			tail = ret;
+            }
+
+            if (buffer[head] != REDIC_PUSH)
+                return ok;
+
+            if (parse_reply(push) != ok)
+                return xx;
+
+            dispatch();
+        }
+    }
+
+    void dispatch()
+    {
+        if (tracker)
+            tracker->push(push);
+
+        if (handler)
+            handler->push(push);
+    }
+
+    //hand over the messages already received that start with pre,
+    //without waiting for more
+    int poll_push(char pre)
+    {
+        if (!ready)
+        {
+            err = Redic::CONNECT_ERR;
+            return xx;
+        }
+
+		arm();
+
+        while (true)
+        {
+            if (head == tail)
+            {
+                fd_set fds;
+                FD_ZERO(&fds);
+                FD_SET(fd, &fds);
+
+                timeval now = {0, 0};
+
+                if (select(fd+1, &fds, NULL, NULL, &now) <= 0)
+                    return ok;
+
+                int ret = skt_read(fd, buffer, sizeof(buffer));
+                if (ret <= 0)
+                {
+                    LOG("fail to poll push");
+                    return xx;
+                }
+
+                head = 0;
+                tail = ret;
+            }
+
+            if (buffer[head] != pre)
+                return ok;
+
+            if (parse_reply(push) != ok)
+                return xx;
+
+            dispatch();
+        }
+    }
+
+    //drop what is left of a previous reply, but keep push messages
+    void rewind()
+    {
+        if (head == tail || buffer[head] != REDIC_PUSH)
+        {
+            head = 0;
+            tail = 0;
+        }
+    }
+
+    //read the size of a bulk or multi-bulk, nil as -1
+    int read_size(char pre, int &num)
+    {
+        if (pre == REDIC_NULL)
+        {
+            num = -1;
+            return read_crlf();
+        }
+
+        if (read_number(num) != ok)
+            return xx;
+
+        //a map holds a field and a value per entry
+        if (pre == REDIC_MAP)
+            num *= 2;
+
+        //a verbatim string starts with its format, e.g. "txt:"
+        if (pre == REDIC_VERBATIM)
+        {
+            char fmt[4];
+
+            if (num < 4 || read_fixed(4, fmt) != ok)
+            {
+                err = Redic::SYNTAX_ERR;
+                return xx;
+            }
+
+            num -= 4;
+        }
+
+        return ok;
+    }
+
+    int read_crlf()
+    {
+        if (head == tail)
+        {
+            int ret = skt_read(fd, buffer, sizeof(buffer));
+			if (ret <= 0)
+			{
+				LOG("fail to read char cr");
+				return xx;
+			}
+
+            head = 0;
 			tail = ret;
         }
 
@@ -447,6 +1065,62 @@ public:
         return ok;
     }
 
+	int read_number(int &val)
+	{
+        int64_t num;
+
+        if (read_number(num) != ok)
+            return xx;
+
+        val = (int)num;
+        return ok;
+	}
+
+	int read_number(int64_t &val)
+	{
+        bool neg = false;
+        val = 0;
+
+		while (true)
+		{
+            if (head == tail)
+            {
+                int ret = skt_read(fd, buffer, sizeof(buffer));
+    			if (ret <= 0)
+    			{
+    				LOG("fail to read number");
+    				return xx;
+    			}
+
+                head = 0;
+    			tail = ret;
+            }
+
+            char c = buffer[head];
+
+            if (c == '\r')
+                break;
+
+            if (c >= '0' && c <= '9')
+                val = val*10 + (c-'0');
+            else if (c == '-' && !neg)
+                neg = true;
+            else
+            {
+                LOG("illegal number char [%c]", c);
+                err = Redic::SYNTAX_ERR;
+                return xx;
+            }
+
+            head += 1;
+		}
+
+        if (neg)
+            val = -val;
+
+        return read_crlf();
+	}
+
 	int read_line(string &str)
 	{
         str.clear();
@@ -487,19 +1161,6 @@ public:
 
 		while (true)
 		{
-            if (head == tail)
-            {
-                int ret = skt_read(fd, buffer, sizeof(buffer));
-    			if (ret <= 0)
-    			{
-    				LOG("fail to read fixed");
-    				return xx;
-    			}
-
-                head = 0;
-    			tail = ret;
-            }
-
 			if (num <= tail-head)
 			{
 				str.append(buffer+head, num);
@@ -509,13 +1170,59 @@ public:
 
             str.append(buffer+head, tail-head);
             num -= tail-head;
-            head = tail;
+
+            int ret = skt_read(fd, buffer, sizeof(buffer));
+			if (ret <= 0)
+			{
+				LOG("fail to read fixed");
+				return xx;
+			}
+
+            head = 0;
+			tail = ret;
+		}
+	}
+
+	int read_fixed(int num, char *dst)
+	{
+		while (true)
+		{
+			if (num <= tail-head)
+			{
+				memcpy(dst, buffer+head, num);
+                head += num;
+                return ok;
+			}
+
+            memcpy(dst, buffer+head, tail-head);
+            dst += tail-head;
+            num -= tail-head;
+
+            int ret = skt_read(fd, buffer, sizeof(buffer));
+			if (ret <= 0)
+			{
+				LOG("fail to read fixed");
+				return xx;
+			}
+
+            head = 0;
+			tail = ret;
 		}
 	}
 
-	int read_error()
+	int read_error(char pre)
 	{
-		if (read_line(svrerr) != ok || read_crlf() != ok)
+        int num;
+
+        if (pre == REDIC_BLOBERR)
+        {
+            if (read_number(num) != ok || read_fixed(num, svrerr) != ok || read_crlf() != ok)
+            {
+                LOG("fail to read error");
+                return xx;
+            }
+        }
+		else if (read_line(svrerr) != ok || read_crlf() != ok)
 		{
 			LOG("fail to read error");
 			return xx;
@@ -547,9 +1254,9 @@ public:
 			return xx;
 		}
 
-        if (pre == REDIC_ERROR)
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
         {
-            read_error();
+            read_error(pre);
             return xx;
         }
 
@@ -571,8 +1278,26 @@ public:
 
 	int recv_int(int &val)
 	{
+        int64_t num;
+
+        if (recv_int(num) != ok)
+            return xx;
+
+        //rather than wrap, a value beyond int wants the int64_t overload
+        if (num < INT_MIN || num > INT_MAX)
+        {
+            LOG("int result out of range");
+            err = Redic::SYNTAX_ERR;
+            return xx;
+        }
+
+        val = (int)num;
+        return ok;
+	}
+
+	int recv_int(int64_t &val)
+	{
         char pre;
-        string tmp;
 
 		if (read_prefix(pre) != ok)
 		{
@@ -580,12 +1305,31 @@ public:
 			return xx;
 		}
 
-        if (pre == REDIC_ERROR)
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre == REDIC_NULL)
         {
-            read_error();
+            read_crlf();
+            err = Redic::RECORD_NUL;
             return xx;
         }
 
+        if (pre == REDIC_BOOL)
+        {
+            if (read_line(line) != ok || read_crlf() != ok)
+            {
+                LOG("fail to read bool result");
+                return xx;
+            }
+
+            val = line == "t";
+            return ok;
+        }
+
         if (pre != REDIC_INT)
         {
 			LOG("illegal int prefix [%c]", pre);
@@ -593,20 +1337,18 @@ public:
 			return xx;
         }
 
-		if (read_line(tmp) != ok || read_crlf() != ok)
+		if (read_number(val) != ok)
 		{
 			LOG("fail to read int result");
 			return xx;
 		}
 
-		val = atoi(tmp.c_str());
 		return ok;
 	}
 
 	int recv_bulk(string &val)
 	{
         char pre;
-        string tmp;
 
 		if (read_prefix(pre) != ok)
 		{
@@ -614,27 +1356,41 @@ public:
 			return xx;
 		}
 
-        if (pre == REDIC_ERROR)
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
         {
-            read_error();
+            read_error(pre);
             return xx;
         }
 
-        if (pre != REDIC_BULK)
+        //RESP3 doubles and big numbers come as a line
+        if (pre == REDIC_DOUBLE || pre == REDIC_BIGNUM)
+        {
+            if (read_line(val) != ok || read_crlf() != ok)
+            {
+                LOG("fail to read bulk line");
+                return xx;
+            }
+
+            return ok;
+        }
+
+        if (pre != REDIC_BULK && pre != REDIC_VERBATIM && pre != REDIC_NULL)
         {
 			LOG("illegal bulk prefix [%c]", pre);
             err = Redic::SYNTAX_ERR;
 			return xx;
         }
 
-		if (read_line(tmp) != ok || read_crlf() != ok)
+        int num;
+
+		if (read_size(pre, num) != ok)
 		{
 			LOG("fail to read bulk size");
 			return xx;
 		}
 
-        int num = atoi(tmp.c_str());
-        if (num <= 0)
+        //$-1 is nil, while $0 is an empty string
+        if (num < 0)
         {
 			err = Redic::RECORD_NUL;
 			return xx;
@@ -650,95 +1406,209 @@ public:
 		return ok;
 	}
 
-	int recv_list(std::list<string> &result)
+	int recv_bitmap(Redic::Bitmap &val)
 	{
         char pre;
-        string tmp;
 
 		if (read_prefix(pre) != ok)
 		{
-			LOG("fail to read list prefix");
+			LOG("fail to read bitmap prefix");
 			return xx;
 		}
 
-        if (pre == REDIC_ERROR)
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
         {
-            read_error();
+            read_error(pre);
             return xx;
         }
 
-        if (pre != REDIC_MULTI)
+        if (pre != REDIC_BULK && pre != REDIC_NULL)
         {
-			LOG("illegal list prefix [%c]", pre);
+			LOG("illegal bitmap prefix [%c]", pre);
             err = Redic::SYNTAX_ERR;
 			return xx;
         }
 
-		if (read_line(tmp) != ok || read_crlf() != ok)
-		{
-			LOG("fail to read list size");
-			return xx;
-		}
+        int num;
 
-		int num = atoi(tmp.c_str());
-		if (num <= 0)
+		if (read_size(pre, num) != ok)
 		{
-			err = Redic::RECORD_NUL;
+			LOG("fail to read bitmap size");
 			return xx;
 		}
 
-        result.clear();
+        val.clear();
 
-        for (int i=0; i<num; i++)
+        if (num < 0)
         {
-            if (recv_bulk(tmp) != ok)
-                return xx;
-
-            result.push_back(tmp);
+			err = Redic::RECORD_NUL;
+			return xx;
         }
 
+		if ((num > 0 && read_fixed(num, val.resize(num)) != ok) || read_crlf() != ok)
+		{
+			LOG("fail to read bitmap result");
+			err = Redic::SYNTAX_ERR;
+			return xx;
+		}
+
 		return ok;
 	}
 
-	int recv_set(std::set<string> &result)
+	int recv_double(double &val)
 	{
         char pre;
-        string tmp;
 
 		if (read_prefix(pre) != ok)
 		{
-			LOG("fail to read set prefix");
+			LOG("fail to read double prefix");
 			return xx;
 		}
 
-        if (pre == REDIC_ERROR)
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
         {
-            read_error();
+            read_error(pre);
             return xx;
         }
 
-        if (pre != REDIC_MULTI)
+        //a native double of RESP3, or a bulk string of RESP2
+        if (pre == REDIC_DOUBLE)
         {
-			LOG("illegal set prefix [%c]", pre);
+            if (read_line(line) != ok || read_crlf() != ok)
+            {
+                LOG("fail to read double result");
+                return xx;
+            }
+        }
+        else if (pre == REDIC_BULK || pre == REDIC_NULL)
+        {
+            int num;
+
+            if (read_size(pre, num) != ok)
+            {
+                LOG("fail to read double size");
+                return xx;
+            }
+
+            if (num < 0)
+            {
+                err = Redic::RECORD_NUL;
+                return xx;
+            }
+
+            if (read_fixed(num, line) != ok || read_crlf() != ok)
+            {
+                LOG("fail to read double result");
+                err = Redic::SYNTAX_ERR;
+                return xx;
+            }
+        }
+        else
+        {
+			LOG("illegal double prefix [%c]", pre);
             err = Redic::SYNTAX_ERR;
 			return xx;
         }
 
-		if (read_line(tmp) != ok || read_crlf() != ok)
-		{
-			LOG("fail to read set size");
-			return xx;
-		}
+        val = redic_strtod(line.c_str());
+        return ok;
+	}
 
-		int num = atoi(tmp.c_str());
-		if (num <= 0)
+	int recv_list(std::list<string> &result)
+	{
+        char pre;
+
+		if (read_prefix(pre) != ok)
 		{
-			err = Redic::RECORD_NUL;
+			LOG("fail to read list prefix");
 			return xx;
 		}
 
-        result.clear();
-
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_MULTI && pre != REDIC_SET && pre != REDIC_MAP && pre != REDIC_NULL)
+        {
+			LOG("illegal list prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read list size");
+			return xx;
+		}
+
+		if (num <= 0)
+		{
+			err = Redic::RECORD_NUL;
+			return xx;
+		}
+
+        //reuse the nodes and string buffers already in the list
+        std::list<string>::iterator it = result.begin();
+
+        for (int i=0; i<num; i++)
+        {
+            if (it == result.end())
+                it = result.insert(it, string());
+
+            if (recv_bulk(*it) != ok)
+                return xx;
+
+            it++;
+        }
+
+        result.erase(it, result.end());
+		return ok;
+	}
+
+	int recv_set(std::set<string> &result)
+	{
+        char pre;
+        string tmp;
+
+		if (read_prefix(pre) != ok)
+		{
+			LOG("fail to read set prefix");
+			return xx;
+		}
+
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_MULTI && pre != REDIC_SET && pre != REDIC_MAP && pre != REDIC_NULL)
+        {
+			LOG("illegal set prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read set size");
+			return xx;
+		}
+
+		if (num <= 0)
+		{
+			err = Redic::RECORD_NUL;
+			return xx;
+		}
+
+        result.clear();
+
         for (int i=0; i<num; i++)
         {
             if (recv_bulk(tmp) != ok)
@@ -747,1529 +1617,8670 @@ public:
             result.insert(tmp);
         }
 
-		return ok;
-	}
+		return ok;
+	}
+
+	int recv_bulk(Redic::Array &result)
+	{
+        char pre;
+
+		if (read_prefix(pre) != ok)
+		{
+			LOG("fail to read bulk prefix");
+			return xx;
+		}
+
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_BULK && pre != REDIC_VERBATIM && pre != REDIC_NULL)
+        {
+			LOG("illegal bulk prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read bulk size");
+			return xx;
+		}
+
+        if (num < 0)
+        {
+            result.push_nil();
+            return ok;
+        }
+
+		if (read_fixed(num, result.append(num)) != ok || read_crlf() != ok)
+		{
+			LOG("fail to read bulk result");
+			err = Redic::SYNTAX_ERR;
+			return xx;
+		}
+
+		return ok;
+	}
+
+	int recv_array(Redic::Array &result)
+	{
+        char pre;
+
+		if (read_prefix(pre) != ok)
+		{
+			LOG("fail to read array prefix");
+			return xx;
+		}
+
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_MULTI && pre != REDIC_SET && pre != REDIC_MAP && pre != REDIC_NULL)
+        {
+			LOG("illegal array prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read array size");
+			return xx;
+		}
+
+        result.clear();
+
+		if (num <= 0)
+		{
+			err = Redic::RECORD_NUL;
+			return xx;
+		}
+
+        result.reserve(num, 0);
+
+        for (int i=0; i<num; i++)
+        {
+            if (recv_bulk(result) != ok)
+                return xx;
+        }
+
+		return ok;
+	}
+
+	//members and scores of WITHSCORES: flat under RESP2,
+	//a [member, score] pair per member under RESP3
+	int recv_scores(Redic::Array &members, std::vector<double> &scores)
+	{
+        char pre;
+
+		if (read_prefix(pre) != ok)
+		{
+			LOG("fail to read scores prefix");
+			return xx;
+		}
+
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_MULTI && pre != REDIC_NULL)
+        {
+			LOG("illegal scores prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read scores size");
+			return xx;
+		}
+
+        members.clear();
+        scores.clear();
+
+		if (num <= 0)
+		{
+			err = Redic::RECORD_NUL;
+			return xx;
+		}
+
+        members.reserve(num, 0);
+        scores.reserve(num);
+
+        while (num > 0)
+        {
+            double score;
+
+            if (read_prefix(pre) != ok)
+                return xx;
+
+            if (pre == REDIC_MULTI)
+            {
+                int two;
+
+                if (read_size(pre, two) != ok)
+                    return xx;
+
+                if (two != 2)
+                {
+                    LOG("illegal score pair size [%d]", two);
+                    err = Redic::SYNTAX_ERR;
+                    return xx;
+                }
+
+                num -= 1;
+            }
+            else
+            {
+                //a flat member, whose prefix recv_bulk reads again
+                head -= 1;
+                num -= 2;
+            }
+
+            if (recv_bulk(members) != ok || recv_double(score) != ok)
+                return xx;
+
+            scores.push_back(score);
+        }
+
+		return ok;
+	}
+
+	int recv_bulk(Redic::Visitor &visitor, int index, int &rc)
+	{
+        char pre;
+
+		if (read_prefix(pre) != ok)
+		{
+			LOG("fail to read bulk prefix");
+			return xx;
+		}
+
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_BULK && pre != REDIC_VERBATIM && pre != REDIC_NULL)
+        {
+			LOG("illegal bulk prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read bulk size");
+			return xx;
+		}
+
+        if (num < 0)
+        {
+            if (rc == Redic::OK)
+                rc = visitor.visit(index, NULL, -1);
+
+            return ok;
+        }
+
+        //hand out the receive buffer directly if the element is all in it
+        if (num <= tail-head)
+        {
+            if (rc == Redic::OK)
+                rc = visitor.visit(index, buffer+head, num);
+
+            head += num;
+        }
+        else
+        {
+            char *elem = arena.alloc(num);
+
+            if (read_fixed(num, elem) != ok)
+            {
+                LOG("fail to read bulk result");
+                err = Redic::SYNTAX_ERR;
+                return xx;
+            }
+
+            if (rc == Redic::OK)
+                rc = visitor.visit(index, elem, num);
+        }
+
+		if (read_crlf() != ok)
+		{
+			LOG("fail to read bulk result");
+			err = Redic::SYNTAX_ERR;
+			return xx;
+		}
+
+		return ok;
+	}
+
+	int recv_visit(Redic::Visitor &visitor)
+	{
+        char pre;
+
+		if (read_prefix(pre) != ok)
+		{
+			LOG("fail to read list prefix");
+			return xx;
+		}
+
+        if (pre == REDIC_ERROR || pre == REDIC_BLOBERR)
+        {
+            read_error(pre);
+            return xx;
+        }
+
+        if (pre != REDIC_MULTI && pre != REDIC_SET && pre != REDIC_MAP && pre != REDIC_NULL)
+        {
+			LOG("illegal list prefix [%c]", pre);
+            err = Redic::SYNTAX_ERR;
+			return xx;
+        }
+
+        int num;
+
+		if (read_size(pre, num) != ok)
+		{
+			LOG("fail to read list size");
+			return xx;
+		}
+
+		if (num <= 0)
+		{
+			err = Redic::RECORD_NUL;
+			return xx;
+		}
+
+        //keep draining the reply after the visitor stops, so the next
+        //request does not see the rest of it
+        int rc = Redic::OK;
+
+        for (int i=0; i<num; i++)
+        {
+            if (recv_bulk(visitor, i, rc) != ok)
+                return xx;
+        }
+
+        if (rc != Redic::OK)
+        {
+            err = rc;
+            return xx;
+        }
+
+		return ok;
+	}
+
+	int recv_reply(Redic::Reply &reply)
+	{
+        if (skip_push() != ok)
+            return xx;
+
+        return parse_reply(reply);
+	}
+
+	int parse_reply(Redic::Reply &reply)
+	{
+        parser.reset(reply);
+
+        while (!parser.done())
+        {
+            if (head == tail)
+            {
+                int ret = skt_read(fd, buffer, sizeof(buffer));
+    			if (ret <= 0)
+    			{
+    				LOG("fail to read reply");
+    				return xx;
+    			}
+
+                head = 0;
+    			tail = ret;
+            }
+
+            int ret = parser.feed(buffer+head, tail-head);
+            if (ret < 0)
+            {
+                LOG("fail to parse reply");
+                err = Redic::SYNTAX_ERR;
+                return xx;
+            }
+
+            head += ret;
+        }
+
+		return ok;
+	}
+
+	int operate_inline(string &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_inline(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_bulk(string &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_bulk(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_int(int &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_int(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_int(int64_t &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_int(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_double(double &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_double(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_list(std::list<string> &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_list(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_set(std::set<string> &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_set(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_visit(Redic::Visitor &visitor, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_visit(visitor) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	//send several commands at once, each replying a status, and keep a code per command
+	int operate_status(const string &cmds, int num, std::vector<int> &results)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (skt_write(fd, cmds.data(), cmds.length()) <= 0)
+		{
+			LOG("fail to send batch");
+			return xx;
+		}
+
+        int fail = Redic::OK;
+
+        for (int i=0; i<num; i++)
+        {
+            if (recv_inline(line) != ok)
+            {
+                //an error reply keeps the stream in step, read on
+                if (err != Redic::SERVER_ERR)
+                    return xx;
+
+                fail = err;
+                results.push_back(err);
+                continue;
+            }
+
+            results.push_back(line == "OK" ? Redic::OK : Redic::SYNTAX_ERR);
+        }
+
+        if (fail != Redic::OK)
+        {
+            err = fail;
+            return xx;
+        }
+
+		return ok;
+	}
+
+	//send several commands at once, each replying an integer
+	int operate_ints(const string &cmds, int num, int64_t &sum, int &last)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (skt_write(fd, cmds.data(), cmds.length()) <= 0)
+		{
+			LOG("fail to send batch");
+			return xx;
+		}
+
+        int fail = Redic::OK;
+        sum = 0;
+
+        for (int i=0; i<num; i++)
+        {
+            int64_t val;
+
+            if (recv_int(val) != ok)
+            {
+                //an error reply keeps the stream in step, read on
+                if (err != Redic::SERVER_ERR)
+                    return xx;
+
+                fail = err;
+                continue;
+            }
+
+            sum += val;
+            last = (int)val;
+        }
+
+        if (fail != Redic::OK)
+        {
+            err = fail;
+            return xx;
+        }
+
+		return ok;
+	}
+
+	//send several commands at once and keep the reply to the last one
+	int operate_batch(Redic::Reply &result, const string &cmds, int num)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (skt_write(fd, cmds.data(), cmds.length()) <= 0)
+		{
+			LOG("fail to send batch");
+			return xx;
+		}
+
+        for (int i=0; i<num; i++)
+        {
+            result.clear();
+
+    		if (recv_reply(result) != ok)
+    			return xx;
+        }
+
+        if (result.type() == Redic::Reply::TYPE_ERROR)
+        {
+            svrerr.assign(result.data(), result.length());
+            err = Redic::SERVER_ERR;
+            return xx;
+        }
+
+        if (result.type() == Redic::Reply::TYPE_NIL)
+        {
+            err = Redic::RECORD_NUL;
+            return xx;
+        }
+
+		return ok;
+	}
+
+	//send several commands at once and keep every reply, errors included
+	int operate_replies(const string &cmds, int num, std::vector<Redic::Reply> &results)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (skt_write(fd, cmds.data(), cmds.length()) <= 0)
+		{
+			LOG("fail to send batch");
+			return xx;
+		}
+
+        results.resize(num);
+
+        for (int i=0; i<num; i++)
+        {
+            results[i].clear();
+
+    		if (recv_reply(results[i]) != ok)
+    			return xx;
+        }
+
+		return ok;
+	}
+
+	int operate_reply(Redic::Reply &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+        result.clear();
+
+		if (recv_reply(result) != ok)
+			return xx;
+
+        //keep the server error at hand as for the other replies
+        if (result.type() == Redic::Reply::TYPE_ERROR)
+        {
+            svrerr.assign(result.data(), result.length());
+            err = Redic::SERVER_ERR;
+            return xx;
+        }
+
+        if (result.type() == Redic::Reply::TYPE_NIL)
+        {
+            err = Redic::RECORD_NUL;
+            return xx;
+        }
+
+		return ok;
+	}
+
+	int operate_bitmap(Redic::Bitmap &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_bitmap(result) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_scores(Redic::Array &members, std::vector<double> &scores, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_scores(members, scores) != ok)
+			return xx;
+
+		return ok;
+	}
+
+	int operate_array(Redic::Array &result, Request &req)
+	{
+		arm();
+
+		rewind();
+		arena.reset();
+
+        if (send_req(req) != ok)
+			return xx;
+
+		if (recv_array(result) != ok)
+			return xx;
+
+		return ok;
+	}
+};
+
+///Near cache of get and hget results, invalidated by CLIENT TRACKING.
+///Entries are per key, so a key invalidates its value and all its fields
+///at once; the least recently used keys go first when over the bound.
+class RedicCache : public Redic::PushHandler
+{
+private:
+    struct Slot
+    {
+        bool has_val;
+        bool nil;
+        string val;
+        std::map<string, string> fields;
+        std::set<string> nil_fields;
+        int bytes;
+        std::list<string>::iterator lru;
+    };
+
+    typedef std::map<string, Slot> Slots;
+
+    //rough per entry overhead of the containers
+    static const int SLOT_COST = 96;
+    static const int FIELD_COST = 64;
+
+    Slots slots;
+    std::list<string> lru;
+    int bytes;
+    int limit;
+
+    RedicEntity *entity;
+    RedicEntity *watcher;
+    bool broken;
+
+public:
+    int64_t hits;
+    int64_t misses;
+
+    RedicCache(RedicEntity *entity, int max_bytes)
+    {
+        this->entity = entity;
+        watcher = NULL;
+        broken = false;
+        bytes = 0;
+        limit = max_bytes;
+        hits = 0;
+        misses = 0;
+    }
+
+    ~RedicCache()
+    {
+        delete watcher;
+    }
+
+    //the connection receiving invalidations when they are redirected
+    void watch(RedicEntity *entity)
+    {
+        delete watcher;
+        watcher = entity;
+        watcher->set_tracker(this);
+    }
+
+    //hand over invalidations received so far, before serving from the cache
+    void poll()
+    {
+        if (broken)
+            return;
+
+        int rc = watcher ? watcher->poll_push(REDIC_MULTI) : entity->poll_push(REDIC_PUSH);
+
+        //invalidations may be lost, nothing cached can be trusted anymore
+        if (rc != 0)
+        {
+            flush();
+            broken = true;
+        }
+    }
+
+    bool get(const char *key, string &val, int &rc)
+    {
+        Slot *slot = find(key);
+
+        if (slot == NULL || !slot->has_val)
+        {
+            misses++;
+            return false;
+        }
+
+        hits++;
+        val = slot->val;
+        rc = slot->nil ? Redic::RECORD_NUL : Redic::OK;
+        return true;
+    }
+
+    bool hget(const char *key, const char *field, string &val, int &rc)
+    {
+        Slot *slot = find(key);
+
+        if (slot != NULL)
+        {
+            std::map<string, string>::iterator it = slot->fields.find(field);
+
+            if (it != slot->fields.end())
+            {
+                hits++;
+                val = it->second;
+                rc = Redic::OK;
+                return true;
+            }
+
+            if (slot->nil_fields.count(field))
+            {
+                hits++;
+                rc = Redic::RECORD_NUL;
+                return true;
+            }
+        }
+
+        misses++;
+        return false;
+    }
+
+    void put(const char *key, const string &val, int rc)
+    {
+        if (broken || (rc != Redic::OK && rc != Redic::RECORD_NUL))
+            return;
+
+        Slot &slot = touch(key);
+        bytes -= slot.bytes;
+        slot.bytes -= slot.val.length();
+
+        slot.has_val = true;
+        slot.nil = rc == Redic::RECORD_NUL;
+        slot.val = slot.nil ? string() : val;
+
+        slot.bytes += slot.val.length();
+        bytes += slot.bytes;
+        shrink();
+    }
+
+    void hput(const char *key, const char *field, const string &val, int rc)
+    {
+        if (broken || (rc != Redic::OK && rc != Redic::RECORD_NUL))
+            return;
+
+        Slot &slot = touch(key);
+        bytes -= slot.bytes;
+
+        if (rc == Redic::OK)
+        {
+            std::pair<std::map<string, string>::iterator, bool> ret;
+            ret = slot.fields.insert(std::make_pair(string(field), string()));
+
+            if (ret.second)
+                slot.bytes += FIELD_COST + strlen(field);
+            else
+                slot.bytes -= ret.first->second.length();
+
+            ret.first->second = val;
+            slot.bytes += val.length();
+        }
+        else if (slot.nil_fields.insert(field).second)
+        {
+            slot.bytes += FIELD_COST + strlen(field);
+        }
+
+        bytes += slot.bytes;
+        shrink();
+    }
+
+    void invalidate(const string &key)
+    {
+        Slots::iterator it = slots.find(key);
+
+        if (it == slots.end())
+            return;
+
+        bytes -= it->second.bytes;
+        lru.erase(it->second.lru);
+        slots.erase(it);
+    }
+
+    void flush()
+    {
+        slots.clear();
+        lru.clear();
+        bytes = 0;
+    }
+
+    int size()
+    {
+        return bytes;
+    }
+
+    //invalidate <keys>, or message __redis__:invalidate <keys> if redirected;
+    //a nil list of keys stands for all of them
+    void push(const Redic::Reply &msg)
+    {
+        if (msg.empty() || !msg.aggregate() || msg.count() < 2)
+            return;
+
+        string kind = msg.str(msg.child(0, 0));
+
+        if (kind == "message" && msg.str(msg.child(0, 1)) != "__redis__:invalidate")
+            return;
+
+        if (kind != "invalidate" && kind != "message")
+            return;
+
+        int keys = msg.child(0, msg.count()-1);
+
+        if (msg.type(keys) == Redic::Reply::TYPE_NIL)
+        {
+            flush();
+            return;
+        }
+
+        for (int i=0; i<msg.count(keys); i++)
+            invalidate(msg.str(msg.child(keys, i)));
+    }
+
+private:
+    Slot *find(const char *key)
+    {
+        if (broken)
+            return NULL;
+
+        Slots::iterator it = slots.find(key);
+
+        if (it == slots.end())
+            return NULL;
+
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return &it->second;
+    }
+
+    Slot &touch(const char *key)
+    {
+        std::pair<Slots::iterator, bool> ret;
+        ret = slots.insert(std::make_pair(string(key), Slot()));
+
+        Slot &slot = ret.first->second;
+
+        if (ret.second)
+        {
+            lru.push_front(ret.first->first);
+            slot.lru = lru.begin();
+            slot.has_val = false;
+            slot.nil = false;
+            slot.bytes = SLOT_COST + ret.first->first.length();
+            bytes += slot.bytes;
+        }
+        else
+        {
+            lru.splice(lru.begin(), lru, slot.lru);
+        }
+
+        return slot;
+    }
+
+    void shrink()
+    {
+        //keep the most recent key even if it alone is over the bound
+        while (bytes > limit && lru.size() > 1)
+            invalidate(lru.back());
+    }
+};
+
+///Shards of the TTL cache, keyed by Redis key and each with its own lock.
+///A key holds the results of all the reads of it, e.g. "g" for get and
+///"f<field>" for hget, so a write drops them at once.
+class RedicTtlStore
+{
+public:
+    struct Item
+    {
+        int rc;
+        int64_t expire;
+        string val;
+        Redic::List list;
+        Redic::Set set;
+    };
+
+private:
+    typedef std::map<string, Item> Items;
+
+    struct Slot
+    {
+        Items items;
+        std::list<string>::iterator lru;
+    };
+
+    typedef std::map<string, Slot> Slots;
+
+    struct Shard
+    {
+        RedicMutex lock;
+        Slots slots;
+        std::list<string> lru;
+        int64_t version;
+        int64_t hits;
+        int64_t misses;
+    };
+
+    Shard *shards;
+    int count;
+    int ttl;
+    int limit;
+
+public:
+    //serializes the calls to the server
+    RedicMutex conn;
+
+    RedicTtlStore(int ttl, int max_keys, int shards)
+    {
+        count = shards > 0 ? shards : 1;
+        this->shards = new Shard[count];
+        this->ttl = ttl;
+        limit = max_keys/count > 0 ? max_keys/count : 1;
+
+        for (int i=0; i<count; i++)
+        {
+            this->shards[i].version = 0;
+            this->shards[i].hits = 0;
+            this->shards[i].misses = 0;
+        }
+    }
+
+    ~RedicTtlStore()
+    {
+        delete [] shards;
+    }
+
+    //copy out a live result, or return false and the version to store with
+    bool find(const char *key, const string &sub, Item &out, int64_t &version)
+    {
+        Shard &shard = pick(key);
+        RedicGuard guard(shard.lock);
+
+        version = shard.version;
+        Slots::iterator it = shard.slots.find(key);
+
+        if (it != shard.slots.end())
+        {
+            Items::iterator item = it->second.items.find(sub);
+
+            if (item != it->second.items.end() && item->second.expire > redic_clock())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+                shard.hits++;
+                out.rc = item->second.rc;
+                out.val = item->second.val;
+                out.list = item->second.list;
+                out.set = item->second.set;
+                return true;
+            }
+
+            if (item != it->second.items.end())
+                it->second.items.erase(item);
+        }
+
+        shard.misses++;
+        return false;
+    }
+
+    //keep a result unless its key was written since the read began
+    void keep(const char *key, const string &sub, const Item &item, int64_t version)
+    {
+        if (item.rc != Redic::OK && item.rc != Redic::RECORD_NUL)
+            return;
+
+        Shard &shard = pick(key);
+        RedicGuard guard(shard.lock);
+
+        if (shard.version != version)
+            return;
+
+        std::pair<Slots::iterator, bool> ret;
+        ret = shard.slots.insert(std::make_pair(string(key), Slot()));
+
+        if (ret.second)
+        {
+            shard.lru.push_front(ret.first->first);
+            ret.first->second.lru = shard.lru.begin();
+        }
+        else
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, ret.first->second.lru);
+        }
+
+        Item &dst = ret.first->second.items[sub];
+        dst = item;
+        dst.expire = redic_clock() + ttl;
+
+        while ((int)shard.slots.size() > limit)
+        {
+            shard.slots.erase(shard.lru.back());
+            shard.lru.pop_back();
+        }
+    }
+
+    void invalidate(const char *key)
+    {
+        Shard &shard = pick(key);
+        RedicGuard guard(shard.lock);
+
+        shard.version++;
+        Slots::iterator it = shard.slots.find(key);
+
+        if (it != shard.slots.end())
+        {
+            shard.lru.erase(it->second.lru);
+            shard.slots.erase(it);
+        }
+    }
+
+    void clear()
+    {
+        for (int i=0; i<count; i++)
+        {
+            RedicGuard guard(shards[i].lock);
+            shards[i].version++;
+            shards[i].slots.clear();
+            shards[i].lru.clear();
+        }
+    }
+
+    int64_t hits()
+    {
+        int64_t sum = 0;
+
+        for (int i=0; i<count; i++)
+        {
+            RedicGuard guard(shards[i].lock);
+            sum += shards[i].hits;
+        }
+
+        return sum;
+    }
+
+    int64_t misses()
+    {
+        int64_t sum = 0;
+
+        for (int i=0; i<count; i++)
+        {
+            RedicGuard guard(shards[i].lock);
+            sum += shards[i].misses;
+        }
+
+        return sum;
+    }
+
+private:
+    Shard &pick(const char *key)
+    {
+        //FNV-1a
+        uint32_t h = 2166136261u;
+
+        for (; *key; key++)
+            h = (h ^ (unsigned char)*key) * 16777619u;
+
+        return shards[h % count];
+    }
+};
+
+//write all of data to a non-blocking socket, waiting TIMEOUT_VAL at most
+//for each part; for the connections written by one thread and read by another
+static int send_all(int fd, const char *data, int len)
+{
+    for (int off=0; off<len;)
+    {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+
+        timeval tv;
+		tv.tv_sec = TIMEOUT_VAL/1000;
+		tv.tv_usec = (TIMEOUT_VAL%1000)*1000;
+
+        int rc = select(fd+1, NULL, &fds, NULL, &tv);
+
+        if (rc > 0)
+            rc = send(fd, data+off, len-off, 0);
+
+        if (rc <= 0)
+            return Redic::CONNECT_ERR;
+
+        off += rc;
+    }
+
+    return Redic::OK;
+}
+
+///Connection of the bulk loader: the caller encodes and writes commands,
+///a reader thread parses and counts the replies as they come.
+class RedicPipe
+{
+public:
+    RedicEntity link;
+    string out;
+    int64_t sent;
+
+    RedicMutex lock;
+    RedicCond progress;
+    int64_t received;
+    int64_t errors;
+    int64_t first;
+    string message;
+    bool failed;
+    bool stop;
+
+    RedicThread reader;
+    Redic::Parser parser;
+    Redic::Reply reply;
+
+    RedicPipe()
+    {
+        sent = 0;
+        received = 0;
+        errors = 0;
+        first = -1;
+        failed = false;
+        stop = false;
+    }
+
+    ~RedicPipe()
+    {
+        halt();
+    }
+
+    void halt()
+    {
+        {
+            RedicGuard guard(lock);
+            stop = true;
+        }
+
+        reader.join();
+    }
+
+    static void *run(void *self)
+    {
+        ((RedicPipe *)self)->drain();
+        return NULL;
+    }
+
+    void drain()
+    {
+        char buf[64*1024];
+        int fd = link.handle();
+
+        parser.reset(reply);
+
+        while (true)
+        {
+            {
+                RedicGuard guard(lock);
+
+                if (stop || failed)
+                    return;
+            }
+
+            //wake up now and then to see if it is time to stop
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            timeval tv = {0, 100*1000};
+
+            int rc = select(fd+1, &fds, NULL, NULL, &tv);
+
+            if (rc == 0)
+                continue;
+
+            int len = rc < 0 ? -1 : recv(fd, buf, sizeof(buf), 0);
+            int64_t count = 0;
+            int64_t bad = 0;
+            bool broken = len <= 0;
+
+            //count the replies of a read locally, publish them at once
+            for (int pos=0; !broken && pos<len;)
+            {
+                int used = parser.feed(buf+pos, len-pos);
+
+                if (used < 0)
+                {
+                    broken = true;
+                    break;
+                }
+
+                pos += used;
+
+                if (!parser.done())
+                    continue;
+
+                if (reply.type() == Redic::Reply::TYPE_ERROR)
+                {
+                    RedicGuard guard(lock);
+
+                    if (first < 0)
+                    {
+                        first = received + count;
+                        message = reply.str();
+                    }
+
+                    bad++;
+                }
+
+                count++;
+                parser.reset(reply);
+            }
+
+            RedicGuard guard(lock);
+            received += count;
+            errors += bad;
+            failed = broken;
+            progress.broadcast();
+        }
+    }
+
+    int flush()
+    {
+        if (send_all(link.handle(), out.data(), out.length()) != Redic::OK)
+        {
+            LOG("fail to write bulk");
+            RedicGuard guard(lock);
+            failed = true;
+            progress.broadcast();
+            return Redic::CONNECT_ERR;
+        }
+
+        out.clear();
+        return Redic::OK;
+    }
+};
+
+///Connection of a subscriber: commands are written by the caller, messages
+///read, parsed and delivered in batches by the dispatch thread or by poll().
+class RedicSubscription
+{
+public:
+    RedicEntity link;
+    RedicMutex write;
+
+    RedicSubscriber::Handler &handler;
+    int batch;
+
+    RedicMutex lock;
+    bool stop;
+    bool running;
+    bool broken;
+    RedicThread thread;
+
+    Redic::Parser parser;
+    Redic::Reply reply;
+    std::vector<RedicSubscriber::Message> messages;
+    int64_t received;
+    int confirmed;
+
+    RedicSubscription(RedicSubscriber::Handler &h, int size) : handler(h)
+    {
+        batch = size > 0 ? size : 1;
+        stop = false;
+        running = false;
+        broken = false;
+        received = 0;
+        confirmed = 0;
+        parser.reset(reply);
+    }
+
+    ~RedicSubscription()
+    {
+        halt();
+    }
+
+    void halt()
+    {
+        {
+            RedicGuard guard(lock);
+            stop = true;
+        }
+
+        thread.join();
+
+        RedicGuard guard(lock);
+        stop = false;
+        running = false;
+    }
+
+    static void *run(void *self)
+    {
+        RedicSubscription *sub = (RedicSubscription *)self;
+
+        while (true)
+        {
+            {
+                RedicGuard guard(sub->lock);
+
+                if (sub->stop)
+                    break;
+            }
+
+            //wake up now and then to see if it is time to stop
+            if (sub->pump(100) < 0)
+            {
+                sub->handler.disconnected();
+
+                RedicGuard guard(sub->lock);
+                sub->running = false;
+                sub->broken = true;
+                break;
+            }
+        }
+
+        return NULL;
+    }
+
+    //read what has arrived within wait ms and deliver it,
+    //return the number of messages, or -1 if the connection is broken
+    int pump(int wait)
+    {
+        char buf[16*1024];
+        int fd = link.handle();
+        int count = 0;
+
+        while (true)
+        {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            timeval tv = {wait/1000, (wait%1000)*1000};
+
+            int rc = select(fd+1, &fds, NULL, NULL, &tv);
+
+            if (rc < 0)
+                return -1;
+
+            //nothing more for now, hand over the batch so far
+            if (rc == 0)
+                break;
+
+            int len = recv(fd, buf, sizeof(buf), 0);
+
+            if (len <= 0)
+                return -1;
+
+            for (int pos=0; pos<len;)
+            {
+                int used = parser.feed(buf+pos, len-pos);
+
+                if (used < 0)
+                    return -1;
+
+                pos += used;
+
+                if (!parser.done())
+                    continue;
+
+                if (take())
+                    count++;
+
+                parser.reset(reply);
+
+                if ((int)messages.size() >= batch)
+                    deliver();
+            }
+
+            wait = 0;
+        }
+
+        deliver();
+        return count;
+    }
+
+    //keep a message or pmessage frame, and the count of a confirmation
+    bool take()
+    {
+        if (!reply.aggregate() || reply.count() < 3)
+            return false;
+
+        string kind = reply.str(reply.child(0, 0));
+        int n = kind == "message" ? 3 : kind == "pmessage" ? 4 : 0;
+
+        if (n == 0 && reply.type(reply.child(0, 2)) == Redic::Reply::TYPE_INTEGER)
+        {
+            RedicGuard guard(lock);
+            confirmed = (int)reply.integer(reply.child(0, 2));
+            return false;
+        }
+
+        if (n == 0 || reply.count() != n)
+            return false;
+
+        messages.resize(messages.size()+1);
+        RedicSubscriber::Message &msg = messages.back();
+
+        if (n == 4)
+            msg.pattern = reply.str(reply.child(0, 1));
+        else
+            msg.pattern.clear();
+
+        msg.channel = reply.str(reply.child(0, n-2));
+        msg.payload = reply.str(reply.child(0, n-1));
+        return true;
+    }
+
+    void deliver()
+    {
+        if (messages.empty())
+            return;
+
+        handler.deliver(messages);
+
+        RedicGuard guard(lock);
+        received += messages.size();
+        messages.clear();
+    }
+
+    int command(const char *cmd, const char *arg)
+    {
+        Request req(2);
+        req.append(cmd);
+        req.append(arg);
+
+        RedicGuard guard(write);
+        return send_all(link.handle(), req.str(), req.len());
+    }
+};
+
+///Reads in flight of the single-flight layer, keyed by command and arguments.
+///The caller that opens a flight sends the command; the others joining it
+///wait for the reply, which is left untouched once landed.
+class RedicFlights
+{
+public:
+    struct Flight
+    {
+        RedicCond landed;
+        bool done;
+        int refs;
+
+        int rc;
+        string val;
+        Redic::List list;
+        Redic::Set set;
+        Redic::Reply reply;
+    };
+
+    //serializes the calls to the server
+    RedicMutex conn;
+
+private:
+    RedicMutex lock;
+    std::map<string, Flight *> flights;
+    int64_t calls;
+    int64_t collapsed;
+
+public:
+    RedicFlights()
+    {
+        calls = 0;
+        collapsed = 0;
+    }
+
+    //append an argument to the key of a flight, prefixed with its length
+    static void key(string &id, const char *arg, int len)
+    {
+        char buf[16];
+        id.append(buf, sprintf(buf, "%d:", len));
+        id.append(arg, len);
+    }
+
+    static void key(string &id, const char *arg)
+    {
+        key(id, arg, strlen(arg));
+    }
+
+    //join the flight of id, return true if the caller opened it
+    bool join(const string &id, Flight *&flight)
+    {
+        RedicGuard guard(lock);
+        calls++;
+
+        std::map<string, Flight *>::iterator it = flights.find(id);
+
+        if (it != flights.end())
+        {
+            collapsed++;
+            flight = it->second;
+            flight->refs++;
+            return false;
+        }
+
+        flight = new Flight;
+        flight->done = false;
+        flight->refs = 1;
+        flight->rc = Redic::OK;
+        flights[id] = flight;
+        return true;
+    }
+
+    //called by the opener with the reply in place
+    void land(const string &id, Flight *flight)
+    {
+        RedicGuard guard(lock);
+        flights.erase(id);
+        flight->done = true;
+        flight->landed.broadcast();
+    }
+
+    void wait(Flight *flight)
+    {
+        RedicGuard guard(lock);
+
+        while (!flight->done)
+            flight->landed.wait(lock);
+    }
+
+    void leave(Flight *flight)
+    {
+        RedicGuard guard(lock);
+
+        if (--flight->refs == 0)
+            delete flight;
+    }
+
+    int64_t total()
+    {
+        RedicGuard guard(lock);
+        return calls;
+    }
+
+    int64_t shared()
+    {
+        RedicGuard guard(lock);
+        return collapsed;
+    }
+};
+
+
+Redic::Array::Array()
+{
+}
+
+int Redic::Array::size() const
+{
+    return spans.size();
+}
+
+bool Redic::Array::empty() const
+{
+    return spans.empty();
+}
+
+void Redic::Array::clear()
+{
+    block.clear();
+    spans.clear();
+}
+
+void Redic::Array::reserve(int num, int bytes)
+{
+    spans.reserve(num);
+    block.reserve(bytes + num);
+}
+
+const char *Redic::Array::data(int i) const
+{
+    assert(i >= 0 && i < (int)spans.size());
+    return spans[i].len < 0 ? NULL : &block[spans[i].off];
+}
+
+int Redic::Array::length(int i) const
+{
+    assert(i >= 0 && i < (int)spans.size());
+    return spans[i].len;
+}
+
+bool Redic::Array::nil(int i) const
+{
+    return length(i) < 0;
+}
+
+string Redic::Array::str(int i) const
+{
+    return nil(i) ? string() : string(data(i), length(i));
+}
+
+const char *Redic::Array::operator[](int i) const
+{
+    return data(i);
+}
+
+void Redic::Array::push_back(const char *data, int len)
+{
+    memcpy(append(len), data, len);
+}
+
+char *Redic::Array::append(int len)
+{
+    Span span;
+    span.off = block.size();
+    span.len = len;
+    spans.push_back(span);
+
+    //each element is followed by a '\0', so data() is a C string
+    block.resize(span.off + len + 1);
+    block[span.off + len] = 0;
+    return &block[span.off];
+}
+
+void Redic::Array::push_nil()
+{
+    Span span;
+    span.off = block.size();
+    span.len = -1;
+    spans.push_back(span);
+}
+
+
+Redic::Hash::Hash()
+{
+}
+
+int Redic::Hash::size() const
+{
+    return pairs.size();
+}
+
+bool Redic::Hash::empty() const
+{
+    return pairs.empty();
+}
+
+void Redic::Hash::clear()
+{
+    items.clear();
+    pairs.clear();
+    std::fill(slots.begin(), slots.end(), -1);
+}
+
+int Redic::Hash::index(const char *field, int len) const
+{
+    if (slots.empty())
+        return -1;
+
+    int mask = slots.size() - 1;
+
+    for (int i=hash(field, len)&mask; slots[i]!=-1; i=(i+1)&mask)
+    {
+        const Pair &pair = pairs[slots[i]];
+
+        if (items.length(pair.field) == len
+            && memcmp(items.data(pair.field), field, len) == 0)
+            return slots[i];
+    }
+
+    return -1;
+}
+
+int Redic::Hash::index(const char *field) const
+{
+    return index(field, ::strlen(field));
+}
+
+const char *Redic::Hash::find(const char *field) const
+{
+    int i = index(field);
+    return i < 0 ? NULL : value(i);
+}
+
+const char *Redic::Hash::field(int i) const
+{
+    return items.data(pairs[i].field);
+}
+
+const char *Redic::Hash::value(int i) const
+{
+    return items.data(pairs[i].value);
+}
+
+int Redic::Hash::field_length(int i) const
+{
+    return items.length(pairs[i].field);
+}
+
+int Redic::Hash::value_length(int i) const
+{
+    return items.length(pairs[i].value);
+}
+
+void Redic::Hash::insert(const char *field, int flen, const char *value, int vlen)
+{
+    int i = items.size();
+    items.push_back(field, flen);
+    items.push_back(value, vlen);
+    link(i, i+1);
+}
+
+//FNV-1a
+unsigned int Redic::Hash::hash(const char *data, int len)
+{
+    unsigned int h = 2166136261u;
+
+    for (int i=0; i<len; i++)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+void Redic::Hash::link(int field, int value)
+{
+    int i = index(items.data(field), items.length(field));
+    if (i >= 0)
+    {
+        pairs[i].value = value;
+        return;
+    }
+
+    //keep the table at most half full
+    if ((int)(pairs.size()+1)*2 > (int)slots.size())
+        rehash(pairs.size()+1);
+
+    Pair pair;
+    pair.field = field;
+    pair.value = value;
+    pairs.push_back(pair);
+
+    int mask = slots.size() - 1;
+    int slot = hash(items.data(field), items.length(field)) & mask;
+
+    while (slots[slot] != -1)
+        slot = (slot+1) & mask;
+
+    slots[slot] = pairs.size() - 1;
+}
+
+void Redic::Hash::rehash(int num)
+{
+    int cap = 8;
+    while (cap < num*2)
+        cap *= 2;
+
+    if (cap <= (int)slots.size())
+        return;
+
+    slots.assign(cap, -1);
+
+    int mask = cap - 1;
+
+    for (int k=0; k<(int)pairs.size(); k++)
+    {
+        int slot = hash(items.data(pairs[k].field), items.length(pairs[k].field)) & mask;
+
+        while (slots[slot] != -1)
+            slot = (slot+1) & mask;
+
+        slots[slot] = k;
+    }
+}
+
+
+Redic::Scores::Scores()
+{
+}
+
+int Redic::Scores::size() const
+{
+    return scores.size();
+}
+
+bool Redic::Scores::empty() const
+{
+    return scores.empty();
+}
+
+void Redic::Scores::clear()
+{
+    members.clear();
+    scores.clear();
+}
+
+void Redic::Scores::reserve(int num, int bytes)
+{
+    members.reserve(num, bytes);
+    scores.reserve(num);
+}
+
+const char *Redic::Scores::member(int i) const
+{
+    return members.data(i);
+}
+
+int Redic::Scores::length(int i) const
+{
+    return members.length(i);
+}
+
+double Redic::Scores::score(int i) const
+{
+    assert(i >= 0 && i < (int)scores.size());
+    return scores[i];
+}
+
+string Redic::Scores::str(int i) const
+{
+    return members.str(i);
+}
+
+
+//bits set in a word, with the popcount instruction where the compiler has it
+static inline int popcount64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+Redic::Bitmap::Bitmap()
+{
+    bytes = 0;
+}
+
+int Redic::Bitmap::size() const
+{
+    return bytes;
+}
+
+bool Redic::Bitmap::empty() const
+{
+    return bytes == 0;
+}
+
+void Redic::Bitmap::clear()
+{
+    words.clear();
+    bytes = 0;
+}
+
+char *Redic::Bitmap::resize(int num)
+{
+    int keep = bytes < num ? bytes : num;
+
+    words.resize((num+7)/8, 0);
+    bytes = num;
+
+    if (words.empty())
+        return NULL;
+
+    //the bytes past the value stay 0, for the word-wise operations
+    char *dst = (char *)&words[0];
+    memset(dst+keep, 0, words.size()*8 - keep);
+    return dst;
+}
+
+const char *Redic::Bitmap::data() const
+{
+    return words.empty() ? NULL : (const char *)&words[0];
+}
+
+int Redic::Bitmap::bit(int64_t offset) const
+{
+    if (offset < 0 || offset/8 >= bytes)
+        return 0;
+
+    unsigned char byte = data()[offset/8];
+    return (byte >> (7 - offset%8)) & 1;
+}
+
+void Redic::Bitmap::set(int64_t offset, int value)
+{
+    assert(offset >= 0);
+
+    if (offset/8 >= bytes)
+        resize(offset/8 + 1);
+
+    unsigned char *byte = (unsigned char *)&words[0] + offset/8;
+    unsigned char mask = 1 << (7 - offset%8);
+
+    if (value)
+        *byte |= mask;
+    else
+        *byte &= ~mask;
+}
+
+int64_t Redic::Bitmap::count() const
+{
+    int64_t sum = 0;
+
+    for (size_t i=0; i<words.size(); i++)
+        sum += popcount64(words[i]);
+
+    return sum;
+}
+
+Redic::Bitmap &Redic::Bitmap::operator&=(const Bitmap &other)
+{
+    if (other.bytes > bytes)
+        resize(other.bytes);
+
+    for (size_t i=0; i<words.size(); i++)
+        words[i] &= i < other.words.size() ? other.words[i] : 0;
+
+    return *this;
+}
+
+Redic::Bitmap &Redic::Bitmap::operator|=(const Bitmap &other)
+{
+    if (other.bytes > bytes)
+        resize(other.bytes);
+
+    for (size_t i=0; i<other.words.size(); i++)
+        words[i] |= other.words[i];
+
+    return *this;
+}
+
+Redic::Bitmap &Redic::Bitmap::operator^=(const Bitmap &other)
+{
+    if (other.bytes > bytes)
+        resize(other.bytes);
+
+    for (size_t i=0; i<other.words.size(); i++)
+        words[i] ^= other.words[i];
+
+    return *this;
+}
+
+
+Redic::Reply::Reply()
+{
+}
+
+void Redic::Reply::clear()
+{
+    block.clear();
+    nodes.clear();
+}
+
+bool Redic::Reply::empty() const
+{
+    return nodes.empty();
+}
+
+Redic::Reply::Type Redic::Reply::type(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+    return (Type)nodes[node].type;
+}
+
+const char *Redic::Reply::data(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+    return nodes[node].off < 0 ? NULL : &block[nodes[node].off];
+}
+
+int Redic::Reply::length(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+    return nodes[node].len;
+}
+
+string Redic::Reply::str(int node) const
+{
+    const char *ptr = data(node);
+    return ptr ? string(ptr, length(node)) : string();
+}
+
+int64_t Redic::Reply::integer(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+    return nodes[node].num;
+}
+
+double Redic::Reply::real(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+    return nodes[node].dbl;
+}
+
+bool Redic::Reply::aggregate(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+
+    switch (nodes[node].type)
+    {
+    case TYPE_ARRAY:
+    case TYPE_MAP:
+    case TYPE_SET:
+    case TYPE_PUSH:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+int Redic::Reply::count(int node) const
+{
+    return aggregate(node) ? (int)nodes[node].num : 0;
+}
+
+int Redic::Reply::first(int node) const
+{
+    return node + 1;
+}
+
+int Redic::Reply::next(int node) const
+{
+    assert(node >= 0 && node < (int)nodes.size());
+    return nodes[node].end;
+}
+
+int Redic::Reply::child(int node, int i) const
+{
+    if (i < 0 || i >= count(node))
+        return -1;
+
+    int c = first(node);
+
+    while (i-- > 0)
+        c = next(c);
+
+    return c;
+}
+
+void Redic::Reply::swap(Reply &other)
+{
+    block.swap(other.block);
+    nodes.swap(other.nodes);
+}
+
+int Redic::Reply::add(int type)
+{
+    Node node;
+    node.type = type;
+    node.off = -1;
+    node.len = 0;
+    node.end = nodes.size() + 1;
+    node.num = 0;
+    node.dbl = 0;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+char *Redic::Reply::payload(int node, int len)
+{
+    int off = block.size();
+    block.resize(off + len + 1);
+    block[off + len] = 0;
+
+    nodes[node].off = off;
+    nodes[node].len = len;
+    return &block[off];
+}
+
+
+enum
+{
+    PARSE_PREFIX,
+    PARSE_LINE,
+    PARSE_LINE_LF,
+    PARSE_BULK,
+    PARSE_BULK_CR,
+    PARSE_BULK_LF,
+    PARSE_DONE,
+    PARSE_FAIL,
+};
+
+static bool parse_int(const string &str, int64_t &val)
+{
+    size_t i = 0;
+    bool neg = false;
+
+    if (i < str.length() && str[i] == '-')
+    {
+        neg = true;
+        i++;
+    }
+
+    if (i == str.length())
+        return false;
+
+    val = 0;
+
+    for (; i<str.length(); i++)
+    {
+        if (str[i] < '0' || str[i] > '9')
+            return false;
+
+        val = val*10 + (str[i]-'0');
+    }
+
+    if (neg)
+        val = -val;
+
+    return true;
+}
+
+Redic::Parser::Parser()
+{
+    reset();
+}
+
+void Redic::Parser::reset()
+{
+    reset(own);
+}
+
+void Redic::Parser::reset(Reply &target)
+{
+    out = &target;
+    out->clear();
+
+    state = PARSE_PREFIX;
+    stack.clear();
+}
+
+bool Redic::Parser::done() const
+{
+    return state == PARSE_DONE;
+}
+
+Redic::Reply &Redic::Parser::reply()
+{
+    return *out;
+}
+
+int Redic::Parser::feed(const char *data, int len)
+{
+    int pos = 0;
+
+    while (pos < len && state != PARSE_DONE)
+    {
+        switch (state)
+        {
+        case PARSE_PREFIX:
+            prefix = data[pos++];
+            line.clear();
+            state = PARSE_LINE;
+            break;
+
+        case PARSE_LINE:
+        {
+            const char *cr = (const char *)memchr(data+pos, '\r', len-pos);
+            int end = cr ? cr-data : len;
+
+            line.append(data+pos, end-pos);
+            pos = end;
+
+            if (cr)
+            {
+                pos++;
+                state = PARSE_LINE_LF;
+            }
+            break;
+        }
+
+        case PARSE_LINE_LF:
+            if (data[pos++] != '\n' || finish_line() != OK)
+                state = PARSE_FAIL;
+            break;
+
+        case PARSE_BULK:
+        {
+            int num = want-got < len-pos ? want-got : len-pos;
+
+            memcpy(&out->block[out->nodes[node].off + got], data+pos, num);
+            got += num;
+            pos += num;
+
+            if (got == want)
+                state = PARSE_BULK_CR;
+            break;
+        }
+
+        case PARSE_BULK_CR:
+            state = data[pos++] == '\r' ? PARSE_BULK_LF : PARSE_FAIL;
+            break;
+
+        case PARSE_BULK_LF:
+            if (data[pos++] != '\n')
+            {
+                state = PARSE_FAIL;
+                break;
+            }
+
+            finish_value();
+            break;
+
+        default:
+            LOG("fail to parse reply");
+            return -1;
+        }
+    }
+
+    if (state == PARSE_FAIL)
+        return -1;
+
+    return pos;
+}
+
+int Redic::Parser::finish_line()
+{
+    int64_t num = 0;
+
+    int type;
+    Frame frame;
+
+    switch (prefix)
+    {
+    case REDIC_INLINE:
+    case REDIC_ERROR:
+    case REDIC_BIGNUM:
+    case REDIC_DOUBLE:
+        type = prefix == REDIC_INLINE ? Reply::TYPE_STATUS :
+               prefix == REDIC_ERROR ? Reply::TYPE_ERROR :
+               prefix == REDIC_BIGNUM ? Reply::TYPE_BIGNUM : Reply::TYPE_DOUBLE;
+
+        node = out->add(type);
+        memcpy(out->payload(node, line.length()), line.data(), line.length());
+
+        if (type == Reply::TYPE_DOUBLE)
+            out->nodes[node].dbl = redic_strtod(line.c_str());
+
+        finish_value();
+        return OK;
+
+    case REDIC_BOOL:
+        if (line != "t" && line != "f")
+            return SYNTAX_ERR;
+
+        node = out->add(Reply::TYPE_BOOLEAN);
+        out->nodes[node].num = line == "t";
+        finish_value();
+        return OK;
+
+    case REDIC_NULL:
+        if (!line.empty())
+            return SYNTAX_ERR;
+
+        out->add(Reply::TYPE_NIL);
+        finish_value();
+        return OK;
+
+    case REDIC_INT:
+        if (!parse_int(line, num))
+            return SYNTAX_ERR;
+
+        node = out->add(Reply::TYPE_INTEGER);
+        out->nodes[node].num = num;
+        finish_value();
+        return OK;
+
+    case REDIC_BULK:
+    case REDIC_BLOBERR:
+    case REDIC_VERBATIM:
+        if (!parse_int(line, num))
+            return SYNTAX_ERR;
+
+        if (num < 0)
+        {
+            out->add(Reply::TYPE_NIL);
+            finish_value();
+            return OK;
+        }
+
+        type = prefix == REDIC_BULK ? Reply::TYPE_STRING :
+               prefix == REDIC_BLOBERR ? Reply::TYPE_ERROR : Reply::TYPE_VERBATIM;
+
+        node = out->add(type);
+        out->payload(node, num);
+        want = num;
+        got = 0;
+        state = num ? PARSE_BULK : PARSE_BULK_CR;
+        return OK;
+
+    case REDIC_MULTI:
+    case REDIC_SET:
+    case REDIC_PUSH:
+    case REDIC_MAP:
+        if (!parse_int(line, num))
+            return SYNTAX_ERR;
+
+        if (num < 0)
+        {
+            out->add(Reply::TYPE_NIL);
+            finish_value();
+            return OK;
+        }
+
+        type = prefix == REDIC_MULTI ? Reply::TYPE_ARRAY :
+               prefix == REDIC_SET ? Reply::TYPE_SET :
+               prefix == REDIC_PUSH ? Reply::TYPE_PUSH : Reply::TYPE_MAP;
+
+        //a map holds a field and a value per entry
+        if (prefix == REDIC_MAP)
+            num *= 2;
+
+        node = out->add(type);
+        out->nodes[node].num = num;
+
+        if (num == 0)
+        {
+            finish_value();
+            return OK;
+        }
+
+        frame.node = node;
+        frame.mark = 0;
+        frame.bytes = 0;
+        frame.left = num;
+        stack.push_back(frame);
+        state = PARSE_PREFIX;
+        return OK;
+
+    case REDIC_ATTR:
+        if (!parse_int(line, num) || num < 0)
+            return SYNTAX_ERR;
+
+        state = PARSE_PREFIX;
+
+        if (num == 0)
+            return OK;
+
+        //parse the attribute to drop it afterwards, it is not a value itself
+        frame.node = -1;
+        frame.mark = out->nodes.size();
+        frame.bytes = out->block.size();
+        frame.left = num*2;
+        stack.push_back(frame);
+        return OK;
+
+    default:
+        LOG("illegal reply prefix [%c]", prefix);
+        return SYNTAX_ERR;
+    }
+}
+
+void Redic::Parser::finish_value()
+{
+    //a completed value may complete its parents as well
+    while (!stack.empty())
+    {
+        Frame &frame = stack.back();
+
+        if (--frame.left > 0)
+        {
+            state = PARSE_PREFIX;
+            return;
+        }
+
+        //an attribute is done, go on with the value it annotates
+        if (frame.node < 0)
+        {
+            out->nodes.resize(frame.mark);
+            out->block.resize(frame.bytes);
+            stack.pop_back();
+            state = PARSE_PREFIX;
+            return;
+        }
+
+        out->nodes[frame.node].end = out->nodes.size();
+        stack.pop_back();
+    }
+
+    state = PARSE_DONE;
+}
+
+
+Redic::Redic()
+{
+	entity = new RedicEntity;
+	cache = NULL;
+}
+
+Redic::~Redic()
+{
+	delete cache;
+	delete entity;
+}
+
+int Redic::connect(const char *host, short port)
+{
+    host = host ? host : "localhost";
+    port = port ? port : 6379;
+
+	delete cache;
+	cache = NULL;
+	entity->set_tracker(NULL);
+	return entity->conn(host, port);
+}
+
+void Redic::disconn()
+{
+	delete cache;
+	cache = NULL;
+	entity->set_tracker(NULL);
+	entity->disconn();
+}
+
+int Redic::hello(int version)
+{
+    Request req(2);
+    req.append("HELLO");
+    req.append(version);
+
+    Reply reply;
+
+	if (entity->operate_reply(reply, req) != OK)
+		return entity->errnum();
+
+    entity->set_protocol(version);
+	return OK;
+}
+
+int Redic::protocol()
+{
+    return entity->protocol();
+}
+
+void Redic::on_push(PushHandler *handler)
+{
+    entity->set_handler(handler);
+}
+
+int Redic::enable_cache(int max_bytes)
+{
+	disable_cache();
+
+	RedicCache *near = new RedicCache(entity, max_bytes);
+	string result;
+    Request req(entity->protocol() == 3 ? 3 : 5);
+    req.append("CLIENT");
+    req.append("TRACKING");
+    req.append("ON");
+
+	//under RESP2 invalidations go to a subscriber of __redis__:invalidate
+	if (entity->protocol() != 3)
+	{
+		RedicEntity *watcher = new RedicEntity;
+		Reply reply;
+		int id;
+
+		near->watch(watcher);
+
+		if (watcher->conn(entity->peer_host().c_str(), entity->peer_port()) != OK)
+		{
+			delete near;
+			return CONNECT_ERR;
+		}
+
+		if (!entity->password().empty())
+		{
+			Request auth(2);
+			auth.append("AUTH");
+			auth.append(entity->password());
+
+			if (watcher->operate_inline(result, auth) != OK)
+			{
+				delete near;
+				return watcher->errnum();
+			}
+		}
+
+		Request client(2);
+		client.append("CLIENT");
+		client.append("ID");
+
+		Request subscribe(2);
+		subscribe.append("SUBSCRIBE");
+		subscribe.append("__redis__:invalidate");
+
+		if (watcher->operate_int(id, client) != OK || watcher->operate_reply(reply, subscribe) != OK)
+		{
+			int rc = watcher->errnum();
+			delete near;
+			return rc;
+		}
+
+		req.append("REDIRECT");
+		req.append(id);
+	}
+
+	if (entity->operate_inline(result, req) != OK)
+	{
+		delete near;
+		return entity->errnum();
+	}
+
+	cache = near;
+	entity->set_tracker(cache);
+	return OK;
+}
+
+void Redic::disable_cache()
+{
+	if (cache == NULL)
+		return;
+
+	delete cache;
+	cache = NULL;
+	entity->set_tracker(NULL);
+
+    Request req(3);
+    req.append("CLIENT");
+    req.append("TRACKING");
+    req.append("OFF");
+
+	string result;
+	entity->operate_inline(result, req);
+}
+
+int64_t Redic::cache_hits()
+{
+	return cache ? cache->hits : 0;
+}
+
+int64_t Redic::cache_misses()
+{
+	return cache ? cache->misses : 0;
+}
+
+int Redic::arena_peak()
+{
+	return entity->reply_arena().high_water();
+}
+
+void Redic::arena_reserve(int bytes)
+{
+	entity->reply_arena().reserve(bytes);
+}
+
+int Redic::auth(const char *password)
+{
+    Request req(2);
+    req.append("AUTH");
+    req.append(password);
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	//kept for the second connection of the cache
+	entity->set_password(password);
+	return OK;
+}
+
+int Redic::info(string &info)
+{
+    Request req(1);
+    req.append("INFO");
+
+	if (entity->operate_bulk(info, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::ping()
+{
+    Request req(1);
+    req.append("PING");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "PONG")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::save()
+{
+    Request req(1);
+    req.append("SAVE");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::bgsave()
+{
+    Request req(1);
+    req.append("BGSAVE");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	//result is some tips string
+	return OK;
+}
+
+int Redic::lastsave(time_t &tm)
+{
+    Request req(1);
+    req.append("LASTSAVE");
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+	tm = result;
+	return OK;
+}
+
+int Redic::bgrewriteaof()
+{
+    Request req(1);
+    req.append("BGREWRITEAOF");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::select(int index)
+{
+    Request req(2);
+    req.append("SELECT");
+    req.append(index);
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	//cached keys are those of the previous database
+	if (cache)
+		cache->flush();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::randomkey(string &key)
+{
+    Request req(1);
+    req.append("RANDOMKEY");
+
+	if (entity->operate_bulk(key, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::dbsize(int &size)
+{
+    Request req(1);
+    req.append("DBSIZE");
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    size = result;
+	return OK;
+}
+
+int Redic::dbsize(int64_t &size)
+{
+    Request req(1);
+    req.append("DBSIZE");
+
+    int64_t result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    size = result;
+	return OK;
+}
+
+int Redic::flushdb()
+{
+    Request req(1);
+    req.append("FLUSHDB");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::flushall()
+{
+    Request req(1);
+    req.append("FLUSHALL");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::keys(const char *pattern, List &keys)
+{
+    Request req(2);
+    req.append("KEYS");
+    req.append(pattern);
+
+	if (entity->operate_list(keys, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::keys(const char *pattern, Array &keys)
+{
+    Request req(2);
+    req.append("KEYS");
+    req.append(pattern);
+
+	if (entity->operate_array(keys, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::keys(const char *pattern, Visitor &keys)
+{
+    Request req(2);
+    req.append("KEYS");
+    req.append(pattern);
+
+	if (entity->operate_visit(keys, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::exists(const char *key)
+{
+    Request req(2);
+    req.append("EXISTS");
+    req.append(key);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+	if (result != 1)
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::del(const char *key)
+{
+    Request req(2);
+    req.append("DEL");
+    req.append(key);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+	if (result != 1)
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::del(const List &keys, int &deleted)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "DEL", NULL, keys, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    deleted = (int)sum;
+	return OK;
+}
+
+int Redic::type(const char *key, string &type)
+{
+    Request req(2);
+    req.append("TYPE");
+    req.append(key);
+
+	if (entity->operate_inline(type, req) != OK)
+		return entity->errnum();
+
+    if (type == "none")
+        return RECORD_NUL;
+
+	return OK;
+}
+
+int Redic::rename(const char *key, const char *newkey)
+{
+    Request req(3);
+    req.append("RENAME");
+    req.append(key);
+    req.append(newkey);
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::renamenx(const char *key, const char *newkey)
+{
+    Request req(3);
+    req.append("RENAMENX");
+    req.append(key);
+    req.append(newkey);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+	if (result != 1)
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::expire(const char *key, int secs)
+{
+    Request req(3);
+    req.append("EXPIRE");
+    req.append(key);
+    req.append(secs);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+	if (result == 0)
+		return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::ttl(const char *key, int &value)
+{
+    Request req(2);
+    req.append("TTL");
+    req.append(key);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    value = result;
+	return OK;
+}
+
+int Redic::ttl(const char *key, int64_t &value)
+{
+    Request req(2);
+    req.append("TTL");
+    req.append(key);
+
+	int64_t result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    value = result;
+	return OK;
+}
+
+int Redic::move(const char *key, int index)
+{
+    Request req(3);
+    req.append("MOVE");
+    req.append(key);
+    req.append(index);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+	if (result == 0)
+		return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::append(const char *key, const char *value, int &length)
+{
+    Request req(3);
+    req.append("APPEND");
+    req.append(key);
+    req.append(value);
+
+	int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::set(const char *key, const char *value)
+{
+    Request req(3);
+    req.append("SET");
+    req.append(key);
+    req.append(value);
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::get(const char *key, string &value)
+{
+	int rc;
+
+	if (cache)
+	{
+		cache->poll();
+
+		if (cache->get(key, value, rc))
+			return rc;
+	}
+
+    Request req(2);
+    req.append("GET");
+    req.append(key);
+
+	rc = entity->operate_bulk(value, req) != OK ? entity->errnum() : OK;
+
+	if (cache)
+		cache->put(key, value, rc);
+
+	return rc;
+}
+
+int Redic::getset(const char *key, const char *value, string &old_val)
+{
+    Request req(3);
+    req.append("GETSET");
+    req.append(key);
+    req.append(value);
+
+	if (entity->operate_bulk(old_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::setex(const char *key, int secs, const char *value)
+{
+    Request req(4);
+    req.append("SETEX");
+    req.append(key);
+    req.append(secs);
+    req.append(value);
+
+    string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+    if (result != "OK")
+        return SYNTAX_ERR;
+
+    return OK;
+}
+
+int Redic::setnx(const char *key, const char *value)
+{
+    Request req(3);
+    req.append("SETNX");
+    req.append(key);
+    req.append(value);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+    return OK;
+}
+
+int Redic::strlen(const char *key, int &length)
+{
+    Request req(2);
+    req.append("STRLEN");
+    req.append(key);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::substr(const char *key, int start, int end, string &value)
+{
+    Request req(4);
+    req.append("SUBSTR");
+    req.append(key);
+    req.append(start);
+    req.append(end);
+
+	if (entity->operate_bulk(value, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::mget(const List &keys, List &values)
+{
+    Request req(1+keys.size());
+    req.append("MGET");
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_list(values, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::mget(const List &keys, Array &values)
+{
+    Request req(1+keys.size());
+    req.append("MGET");
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_array(values, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::mget(const List &keys, Visitor &values)
+{
+    Request req(1+keys.size());
+    req.append("MGET");
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_visit(values, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::mset(const List &pairs)
+{
+    Request req(1+pairs.size());
+    req.append("MSET");
+
+    for (List::const_iterator it=pairs.begin(); it!=pairs.end(); it++)
+        req.append(*it);
+
+    string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+    if (result != "OK")
+        return SYNTAX_ERR;
+
+    return OK;
+}
+
+int Redic::msetnx(const List &pairs)
+{
+    Request req(1+pairs.size());
+    req.append("MSETNX");
+
+    for (List::const_iterator it=pairs.begin(); it!=pairs.end(); it++)
+        req.append(*it);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+    return OK;
+}
+
+int Redic::setex(const Array &keys, const Array &values, int secs, std::vector<int> &results)
+{
+    results.clear();
+
+    if (keys.size() != values.size())
+        return SYNTAX_ERR;
+
+    //a nil element, as mget() gives for a missing key, is neither key nor value
+    for (int i=0; i<keys.size(); i++)
+    {
+        if (keys.nil(i) || values.nil(i))
+            return SYNTAX_ERR;
+    }
+
+    results.reserve(keys.size());
+    int fail = OK;
+
+    //REDIC_CHUNK_ARGS commands per write, to bound the memory of a pipeline
+    for (int i=0; i<keys.size(); i+=REDIC_CHUNK_ARGS)
+    {
+        string cmds;
+        int num = keys.size()-i < REDIC_CHUNK_ARGS ? keys.size()-i : REDIC_CHUNK_ARGS;
+
+        for (int k=i; k<i+num; k++)
+        {
+            Request req(5);
+            req.append("SET");
+            req.append(keys.data(k), keys.length(k));
+            req.append(values.data(k), values.length(k));
+            req.append("EX");
+            req.append(secs);
+            cmds.append(req.str(), req.len());
+        }
+
+        if (entity->operate_status(cmds, num, results) != OK)
+        {
+            if (entity->errnum() != SERVER_ERR)
+                return entity->errnum();
+
+            fail = SERVER_ERR;
+        }
+    }
+
+	return fail;
+}
+
+int Redic::incr(const char *key, int &new_val)
+{
+    Request req(2);
+    req.append("INCR");
+    req.append(key);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::incr(const char *key, int64_t &new_val)
+{
+    Request req(2);
+    req.append("INCR");
+    req.append(key);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::incrby(const char *key, int increment, int &new_val)
+{
+    Request req(3);
+    req.append("INCRBY");
+    req.append(key);
+    req.append(increment);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::incrby(const char *key, int64_t increment, int64_t &new_val)
+{
+    Request req(3);
+    req.append("INCRBY");
+    req.append(key);
+    req.append(increment);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::decr(const char *key, int &new_val)
+{
+    Request req(2);
+    req.append("DECR");
+    req.append(key);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::decr(const char *key, int64_t &new_val)
+{
+    Request req(2);
+    req.append("DECR");
+    req.append(key);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::decrby(const char *key, int decrement, int &new_val)
+{
+    Request req(3);
+    req.append("DECRBY");
+    req.append(key);
+    req.append(decrement);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::decrby(const char *key, int64_t decrement, int64_t &new_val)
+{
+    Request req(3);
+    req.append("DECRBY");
+    req.append(key);
+    req.append(decrement);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::setbit(const char *key, int64_t offset, int value, int &old)
+{
+    Request req(4);
+    req.append("SETBIT");
+    req.append(key);
+    req.append(offset);
+    req.append(value ? 1 : 0);
+
+	if (entity->operate_int(old, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::getbit(const char *key, int64_t offset, int &value)
+{
+    Request req(3);
+    req.append("GETBIT");
+    req.append(key);
+    req.append(offset);
+
+	if (entity->operate_int(value, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::bitcount(const char *key, int64_t &count)
+{
+    Request req(2);
+    req.append("BITCOUNT");
+    req.append(key);
+
+	if (entity->operate_int(count, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::bitcount(const char *key, int start, int end, int64_t &count)
+{
+    Request req(4);
+    req.append("BITCOUNT");
+    req.append(key);
+    req.append(start);
+    req.append(end);
+
+	if (entity->operate_int(count, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::bitpos(const char *key, int bit, int64_t &pos)
+{
+    Request req(3);
+    req.append("BITPOS");
+    req.append(key);
+    req.append(bit ? 1 : 0);
+
+	if (entity->operate_int(pos, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::bitop(const char *op, const char *destkey, const List &keys, int &length)
+{
+    Request req(3+keys.size());
+    req.append("BITOP");
+    req.append(op);
+    req.append(destkey);
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_int(length, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::bitfield(const char *key, const List &ops, std::vector<int64_t> &results)
+{
+    Request req(2+ops.size());
+    req.append("BITFIELD");
+    req.append(key);
+
+	for(List::const_iterator it=ops.begin(); it!=ops.end(); it++)
+        req.append(*it);
+
+    Reply reply;
+
+	if (entity->operate_reply(reply, req) != OK)
+		return entity->errnum();
+
+    int rc = OK;
+    results.clear();
+
+    int node = reply.first(0);
+
+    for (int i=0; i<reply.count(0); i++, node=reply.next(node))
+    {
+        if (reply.type(node) == Reply::TYPE_NIL)
+            rc = RECORD_NUL;
+
+        results.push_back(reply.type(node) == Reply::TYPE_INTEGER ? reply.integer(node) : 0);
+    }
+
+	return rc;
+}
+
+int Redic::getbits(const char *key, Bitmap &bitmap)
+{
+    Request req(2);
+    req.append("GET");
+    req.append(key);
+
+	if (entity->operate_bitmap(bitmap, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::rpush(const char *key, const char *element, int &length)
+{
+    Request req(3);
+    req.append("RPUSH");
+    req.append(key);
+    req.append(element);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::rpush(const char *key, const List &elements, int &length)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "RPUSH", key, elements, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    length = last;
+	return OK;
+}
+
+int Redic::rpushx(const char *key, const char *element, int &length)
+{
+    Request req(3);
+    req.append("RPUSHX");
+    req.append(key);
+    req.append(element);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::lpush(const char *key, const char *element, int &length)
+{
+    Request req(3);
+    req.append("LPUSH");
+    req.append(key);
+    req.append(element);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::lpush(const char *key, const List &elements, int &length)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "LPUSH", key, elements, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    length = last;
+	return OK;
+}
+
+int Redic::lpushx(const char *key, const char *element, int &length)
+{
+    Request req(3);
+    req.append("LPUSHX");
+    req.append(key);
+    req.append(element);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::lpop(const char *key, string &element)
+{
+    Request req(2);
+    req.append("LPOP");
+    req.append(key);
+
+	if (entity->operate_bulk(element, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::rpop(const char *key, string &element)
+{
+    Request req(2);
+    req.append("RPOP");
+    req.append(key);
+
+	if (entity->operate_bulk(element, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::llen(const char *key, int &length)
+{
+    Request req(2);
+    req.append("LLEN");
+    req.append(key);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::llen(const char *key, int64_t &length)
+{
+    Request req(2);
+    req.append("LLEN");
+    req.append(key);
+
+    int64_t result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::lrange(const char *key, int start, int range, List &elements)
+{
+    Request req(4);
+    req.append("LRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(range);
+
+	if (entity->operate_list(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::lrange(const char *key, int start, int range, Array &elements)
+{
+    Request req(4);
+    req.append("LRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(range);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::lrange(const char *key, int start, int range, Visitor &elements)
+{
+    Request req(4);
+    req.append("LRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(range);
+
+	if (entity->operate_visit(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::ltrim(const char *key, int start, int end)
+{
+    Request req(4);
+    req.append("LTRIM");
+    req.append(key);
+    req.append(start);
+    req.append(end);
+
+    string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+    if (result != "OK")
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::lset(const char *key, int index, const char *element)
+{
+    Request req(4);
+    req.append("LSET");
+    req.append(key);
+    req.append(index);
+    req.append(element);
+
+    string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+    if (result != "OK")
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::lindex(const char *key, int index, string &element)
+{
+    Request req(3);
+    req.append("LINDEX");
+    req.append(key);
+    req.append(index);
+
+	if (entity->operate_bulk(element, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+///count > 0: Remove elements from head to tail.
+///count < 0: Remove elements from tail to head.
+///count = 0: Remove all elements.
+int Redic::lrem(const char *key, int count, const char *element, int &length)
+{
+    Request req(4);
+    req.append("LREM");
+    req.append(key);
+    req.append(count);
+    req.append(element);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+//the timeout of a blocking command in seconds, fractional since Redis 6.0
+static void block_timeout(Request &req, int timeout)
+{
+    char buf[32];
+
+    if (timeout % 1000 == 0)
+        sprintf(buf, "%d", timeout/1000);
+    else
+        sprintf(buf, "%d.%03d", timeout/1000, timeout%1000);
+
+    req.append(buf);
+}
+
+static int block_pop(RedicEntity *entity, const char *cmd, const Redic::List &keys,
+                     int timeout, string &key, string &element)
+{
+    Request req(2+keys.size());
+    req.append(cmd);
+
+	for(Redic::List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+    block_timeout(req, timeout);
+    entity->extend(timeout ? timeout : INT_MAX - TIMEOUT_VAL);
+
+    Redic::Reply reply;
+
+	if (entity->operate_reply(reply, req) != Redic::OK)
+		return entity->errnum();
+
+    if (reply.count() != 2)
+        return Redic::SYNTAX_ERR;
+
+    key = reply.str(reply.child(0, 0));
+    element = reply.str(reply.child(0, 1));
+	return Redic::OK;
+}
+
+int Redic::blpop(const List &keys, int timeout, string &key, string &element)
+{
+    return block_pop(entity, "BLPOP", keys, timeout, key, element);
+}
+
+int Redic::brpop(const List &keys, int timeout, string &key, string &element)
+{
+    return block_pop(entity, "BRPOP", keys, timeout, key, element);
+}
+
+int Redic::blmove(const char *source, const char *destination, const char *wherefrom,
+                  const char *whereto, int timeout, string &element)
+{
+    Request req(6);
+    req.append("BLMOVE");
+    req.append(source);
+    req.append(destination);
+    req.append(wherefrom);
+    req.append(whereto);
+
+    block_timeout(req, timeout);
+    entity->extend(timeout ? timeout : INT_MAX - TIMEOUT_VAL);
+
+	if (entity->operate_bulk(element, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::sadd(const char *key, const char *member)
+{
+    Request req(3);
+    req.append("SADD");
+    req.append(key);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::srem(const char *key, const char *member)
+{
+    Request req(3);
+    req.append("SREM");
+    req.append(key);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::sadd(const char *key, const List &members, int &added)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "SADD", key, members, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    added = (int)sum;
+	return OK;
+}
+
+int Redic::srem(const char *key, const List &members, int &removed)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "SREM", key, members, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    removed = (int)sum;
+	return OK;
+}
+
+int Redic::spop(const char *key, string &value)
+{
+    Request req(2);
+    req.append("SPOP");
+    req.append(key);
+
+	if (entity->operate_bulk(value, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::smove(const char *srckey, const char *destkey, const char *member)
+{
+    Request req(4);
+    req.append("SMOVE");
+    req.append(srckey);
+    req.append(destkey);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::scard(const char *key, int &length)
+{
+    Request req(2);
+    req.append("SCARD");
+    req.append(key);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::scard(const char *key, int64_t &length)
+{
+    Request req(2);
+    req.append("SCARD");
+    req.append(key);
+
+    int64_t result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::sismember(const char *key, const char *member)
+{
+    Request req(3);
+    req.append("SISMEMBER");
+    req.append(key);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::sinter(const Set &keys, Set &members)
+{
+    Request req(1+keys.size());
+    req.append("SINTER");
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_set(members, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::sinter(const Set &keys, Array &members)
+{
+    Request req(1+keys.size());
+    req.append("SINTER");
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_array(members, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::sinterstore(const char *destkey, const Set &keys, int &length)
+{
+    Request req(2+keys.size());
+    req.append("SINTERSTORE");
+    req.append(destkey);
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+    return OK;
+}
+
+int Redic::sunion(const Set &keys, Set &members)
+{
+    Request req(1+keys.size());
+    req.append("SUNION");
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_set(members, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::sunion(const Set &keys, Array &members)
+{
+    Request req(1+keys.size());
+    req.append("SUNION");
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_array(members, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::sunionstore(const char *destkey, const Set &keys, int &length)
+{
+    Request req(2+keys.size());
+    req.append("SUNIONSTORE");
+    req.append(destkey);
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+    return OK;
+}
+
+int Redic::sdiff(const Set &keys, Set &members)
+{
+    Request req(1+keys.size());
+    req.append("SDIFF");
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_set(members, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::sdiff(const Set &keys, Array &members)
+{
+    Request req(1+keys.size());
+    req.append("SDIFF");
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_array(members, req) != OK)
+		return entity->errnum();
+
+    return OK;
+}
+
+int Redic::sdiffstore(const char *destkey, const Set &keys, int &length)
+{
+    Request req(2+keys.size());
+    req.append("SDIFFSTORE");
+    req.append(destkey);
+
+	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+    return OK;
+}
+
+int Redic::smembers(const char *key, Set &members)
+{
+    Request req(2);
+    req.append("SMEMBERS");
+    req.append(key);
+
+	if (entity->operate_set(members, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::smembers(const char *key, Array &members)
+{
+    Request req(2);
+    req.append("SMEMBERS");
+    req.append(key);
+
+	if (entity->operate_array(members, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::smembers(const char *key, Visitor &members)
+{
+    Request req(2);
+    req.append("SMEMBERS");
+    req.append(key);
+
+	if (entity->operate_visit(members, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::srandmember(const char *key, string &member)
+{
+    Request req(2);
+    req.append("SRANDMEMBER");
+    req.append(key);
+
+	if (entity->operate_bulk(member, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zadd(const char *key, double score, const char *member)
+{
+    Request req(4);
+    req.append("ZADD");
+    req.append(key);
+    req.append(score);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result != 0 && result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::zrem(const char *key, const char *member)
+{
+    Request req(3);
+    req.append("ZREM");
+    req.append(key);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::zadd(const char *key, const ScoreList &members, int &added)
+{
+    List pairs;
+    char buf[32];
+
+    //scores go as the shortest digits that read back as the same double
+    for (ScoreList::const_iterator it=members.begin(); it!=members.end(); it++)
+    {
+        pairs.push_back(string(buf, redic_dtoa(it->first, buf)));
+        pairs.push_back(it->second);
+    }
+
+    string cmds;
+    int num = encode_chunks(cmds, "ZADD", key, pairs, 2);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    added = (int)sum;
+	return OK;
+}
+
+int Redic::zrem(const char *key, const List &members, int &removed)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "ZREM", key, members, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    removed = (int)sum;
+	return OK;
+}
+
+int Redic::zincrby(const char *key, double increment, const char *member, double &new_score)
+{
+    Request req(4);
+    req.append("ZINCRBY");
+    req.append(key);
+    req.append(increment);
+    req.append(member);
+
+	if (entity->operate_double(new_score, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrank(const char *key, const char *member, int &rank)
+{
+    Request req(3);
+    req.append("ZRANK");
+    req.append(key);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    rank = result;
+	return OK;
+}
+
+int Redic::zrevrank(const char *key, const char *member, int &rank)
+{
+    Request req(3);
+    req.append("ZREVRANK");
+    req.append(key);
+    req.append(member);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    rank = result;
+	return OK;
+}
+
+int Redic::zrange(const char *key, int start, int stop, List &elements)
+{
+    Request req(4);
+    req.append("ZRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+
+	if (entity->operate_list(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrange(const char *key, int start, int stop, Array &elements)
+{
+    Request req(4);
+    req.append("ZRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrange(const char *key, int start, int stop, Visitor &elements)
+{
+    Request req(4);
+    req.append("ZRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+
+	if (entity->operate_visit(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrevrange(const char *key, int start, int stop, List &elements)
+{
+    Request req(4);
+    req.append("ZREVRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+
+	if (entity->operate_list(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrevrange(const char *key, int start, int stop, Array &elements)
+{
+    Request req(4);
+    req.append("ZREVRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrange(const char *key, int start, int stop, Scores &elements)
+{
+    Request req(5);
+    req.append("ZRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+    req.append("WITHSCORES");
+
+	if (entity->operate_scores(elements.members, elements.scores, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrevrange(const char *key, int start, int stop, Scores &elements)
+{
+    Request req(5);
+    req.append("ZREVRANGE");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+    req.append("WITHSCORES");
+
+	if (entity->operate_scores(elements.members, elements.scores, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+//a range by score or lex, with its LIMIT if any
+static void range_request(Request &req, const char *cmd, const char *key,
+                          const char *from, const char *to, bool withscores,
+                          int offset, int count)
+{
+    req.append(cmd);
+    req.append(key);
+    req.append(from);
+    req.append(to);
+
+    if (withscores)
+        req.append("WITHSCORES");
+
+    if (offset > 0 || count >= 0)
+    {
+        req.append("LIMIT");
+        req.append(offset);
+        req.append(count);
+    }
+}
+
+static int range_args(bool withscores, int offset, int count)
+{
+    return 4 + (withscores ? 1 : 0) + (offset > 0 || count >= 0 ? 3 : 0);
+}
+
+int Redic::zrangebyscore(const char *key, double min, double max, Array &elements,
+                         int offset, int count)
+{
+    char from[32];
+    char to[32];
+    redic_dtoa(min, from);
+    redic_dtoa(max, to);
+
+    return zrangebyscore(key, from, to, elements, offset, count);
+}
+
+int Redic::zrangebyscore(const char *key, double min, double max, Scores &elements,
+                         int offset, int count)
+{
+    char from[32];
+    char to[32];
+    redic_dtoa(min, from);
+    redic_dtoa(max, to);
+
+    return zrangebyscore(key, from, to, elements, offset, count);
+}
+
+int Redic::zrangebyscore(const char *key, const char *min, const char *max, Array &elements,
+                         int offset, int count)
+{
+    Request req(range_args(false, offset, count));
+    range_request(req, "ZRANGEBYSCORE", key, min, max, false, offset, count);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrangebyscore(const char *key, const char *min, const char *max, Scores &elements,
+                         int offset, int count)
+{
+    Request req(range_args(true, offset, count));
+    range_request(req, "ZRANGEBYSCORE", key, min, max, true, offset, count);
+
+	if (entity->operate_scores(elements.members, elements.scores, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrevrangebyscore(const char *key, double max, double min, Array &elements,
+                            int offset, int count)
+{
+    char from[32];
+    char to[32];
+    redic_dtoa(max, from);
+    redic_dtoa(min, to);
+
+    return zrevrangebyscore(key, from, to, elements, offset, count);
+}
+
+int Redic::zrevrangebyscore(const char *key, double max, double min, Scores &elements,
+                            int offset, int count)
+{
+    char from[32];
+    char to[32];
+    redic_dtoa(max, from);
+    redic_dtoa(min, to);
+
+    return zrevrangebyscore(key, from, to, elements, offset, count);
+}
+
+int Redic::zrevrangebyscore(const char *key, const char *max, const char *min, Array &elements,
+                            int offset, int count)
+{
+    Request req(range_args(false, offset, count));
+    range_request(req, "ZREVRANGEBYSCORE", key, max, min, false, offset, count);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrevrangebyscore(const char *key, const char *max, const char *min, Scores &elements,
+                            int offset, int count)
+{
+    Request req(range_args(true, offset, count));
+    range_request(req, "ZREVRANGEBYSCORE", key, max, min, true, offset, count);
+
+	if (entity->operate_scores(elements.members, elements.scores, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrangebylex(const char *key, const char *min, const char *max, Array &elements,
+                       int offset, int count)
+{
+    Request req(range_args(false, offset, count));
+    range_request(req, "ZRANGEBYLEX", key, min, max, false, offset, count);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zrevrangebylex(const char *key, const char *max, const char *min, Array &elements,
+                          int offset, int count)
+{
+    Request req(range_args(false, offset, count));
+    range_request(req, "ZREVRANGEBYLEX", key, max, min, false, offset, count);
+
+	if (entity->operate_array(elements, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zcard(const char *key, int& length)
+{
+    Request req(2);
+    req.append("ZCARD");
+    req.append(key);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::zcard(const char *key, int64_t &length)
+{
+    Request req(2);
+    req.append("ZCARD");
+    req.append(key);
+
+    int64_t result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::zscore(const char *key, const char *member, double &score)
+{
+    Request req(3);
+    req.append("ZSCORE");
+    req.append(key);
+    req.append(member);
+
+	if (entity->operate_double(score, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::zremrangebyscore(const char *key, double min, double max, int &removed)
+{
+    Request req(4);
+    req.append("ZREMRANGEBYSCORE");
+    req.append(key);
+    req.append(min);
+    req.append(max);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    removed = result;
+	return OK;
+}
+
+int Redic::zremrangebyrank(const char *key, int start, int stop, int &removed)
+{
+    Request req(4);
+    req.append("ZREMRANGEBYRANK");
+    req.append(key);
+    req.append(start);
+    req.append(stop);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    removed = result;
+	return OK;
+}
+
+int Redic::zcount(const char *key, double min, double max, int &removed)
+{
+    Request req(4);
+    req.append("ZCOUNT");
+    req.append(key);
+    req.append(min);
+    req.append(max);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    removed = result;
+	return OK;
+}
+
+int Redic::hset(const char *key, const char *field, const char *value)
+{
+    Request req(4);
+    req.append("HSET");
+    req.append(key);
+    req.append(field);
+    req.append(value);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result != 0 && result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::hset(const char *key, const List &pairs, int &added)
+{
+    //a field apart from its value would go in another chunk
+    if (pairs.size() % 2 != 0)
+        return SYNTAX_ERR;
+
+    string cmds;
+    int num = encode_chunks(cmds, "HSET", key, pairs, 2);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    added = (int)sum;
+	return OK;
+}
+
+int Redic::hsetnx(const char *key, const char *field, const char *value)
+{
+    Request req(4);
+    req.append("HSETNX");
+    req.append(key);
+    req.append(field);
+    req.append(value);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::hget(const char *key, const char *field, string &value)
+{
+	int rc;
+
+	if (cache)
+	{
+		cache->poll();
+
+		if (cache->hget(key, field, value, rc))
+			return rc;
+	}
+
+    Request req(3);
+    req.append("HGET");
+    req.append(key);
+    req.append(field);
+
+	rc = entity->operate_bulk(value, req) != OK ? entity->errnum() : OK;
+
+	if (cache)
+		cache->hput(key, field, value, rc);
+
+	return rc;
+}
+
+int Redic::hmset(const char *key, const List &pairs)
+{
+    Request req(2+pairs.size());
+    req.append("HMSET");
+    req.append(key);
+
+	for(List::const_iterator it=pairs.begin(); it!=pairs.end(); it++)
+        req.append(*it);
+
+    string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+    if (result != "OK")
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::hmget(const char *key, const List &fields, List &values)
+{
+    Request req(2+fields.size());
+    req.append("HMGET");
+    req.append(key);
+
+	for(List::const_iterator it=fields.begin(); it!=fields.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_list(values, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hmget(const char *key, const List &fields, Array &values)
+{
+    Request req(2+fields.size());
+    req.append("HMGET");
+    req.append(key);
+
+	for(List::const_iterator it=fields.begin(); it!=fields.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_array(values, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hmget(const char *key, const List &fields, Visitor &values)
+{
+    Request req(2+fields.size());
+    req.append("HMGET");
+    req.append(key);
+
+	for(List::const_iterator it=fields.begin(); it!=fields.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_visit(values, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hmget(const char *key, const List &fields, Hash &values)
+{
+    Request req(2+fields.size());
+    req.append("HMGET");
+    req.append(key);
+
+	for(List::const_iterator it=fields.begin(); it!=fields.end(); it++)
+        req.append(*it);
+
+    values.clear();
+
+	if (entity->operate_array(values.items, req) != OK)
+		return entity->errnum();
+
+    int num = values.items.size();
+    if (num != (int)fields.size())
+        return SYNTAX_ERR;
+
+    //values come first in the array, then the fields are appended after them
+    values.rehash(num);
+
+	for(List::const_iterator it=fields.begin(); it!=fields.end(); it++)
+        values.items.push_back(it->data(), it->length());
+
+    //missing fields come back nil, leave them out
+    for (int i=0; i<num; i++)
+    {
+        if (!values.items.nil(i))
+            values.link(num+i, i);
+    }
+
+	return OK;
+}
+
+int Redic::hkeys(const char *key, List &fields)
+{
+    Request req(2);
+    req.append("HKEYS");
+    req.append(key);
+
+	if (entity->operate_list(fields, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hkeys(const char *key, Array &fields)
+{
+    Request req(2);
+    req.append("HKEYS");
+    req.append(key);
+
+	if (entity->operate_array(fields, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hvals(const char *key, List &values)
+{
+    Request req(2);
+    req.append("HVALS");
+    req.append(key);
+
+	if (entity->operate_list(values, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hvals(const char *key, Array &values)
+{
+    Request req(2);
+    req.append("HVALS");
+    req.append(key);
+
+	if (entity->operate_array(values, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hgetall(const char *key, List &pairs)
+{
+    Request req(2);
+    req.append("HGETALL");
+    req.append(key);
+
+	if (entity->operate_list(pairs, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hgetall(const char *key, Array &pairs)
+{
+    Request req(2);
+    req.append("HGETALL");
+    req.append(key);
+
+	if (entity->operate_array(pairs, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hgetall(const char *key, Visitor &pairs)
+{
+    Request req(2);
+    req.append("HGETALL");
+    req.append(key);
+
+	if (entity->operate_visit(pairs, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hgetall(const char *key, Hash &pairs)
+{
+    Request req(2);
+    req.append("HGETALL");
+    req.append(key);
+
+    pairs.clear();
+
+	if (entity->operate_array(pairs.items, req) != OK)
+		return entity->errnum();
+
+    int num = pairs.items.size();
+    if (num % 2 != 0)
+        return SYNTAX_ERR;
+
+    pairs.rehash(num/2);
+
+    for (int i=0; i<num; i+=2)
+        pairs.link(i, i+1);
+
+    return OK;
+}
+
+int Redic::hexists(const char *key, const char *field)
+{
+    Request req(3);
+    req.append("HEXISTS");
+    req.append(key);
+    req.append(field);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::hdel(const char *key, const char *field)
+{
+    Request req(3);
+    req.append("HDEL");
+    req.append(key);
+    req.append(field);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result == 0)
+        return RECORD_NUL;
+
+    if (result != 1)
+        return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::hdel(const char *key, const List &fields, int &removed)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "HDEL", key, fields, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    removed = (int)sum;
+	return OK;
+}
+
+int Redic::hlen(const char *key, int &length)
+{
+    Request req(2);
+    req.append("HLEN");
+    req.append(key);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::hlen(const char *key, int64_t &length)
+{
+    Request req(2);
+    req.append("HLEN");
+    req.append(key);
+
+    int64_t result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    if (result < 0)
+        return SYNTAX_ERR;
+
+    length = result;
+	return OK;
+}
+
+int Redic::hincrby(const char *key, const char *field, int increment, int &new_val)
+{
+    Request req(4);
+    req.append("HINCRBY");
+    req.append(key);
+    req.append(field);
+    req.append(increment);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::hincrby(const char *key, const char *field, int64_t increment, int64_t &new_val)
+{
+    Request req(4);
+    req.append("HINCRBY");
+    req.append(key);
+    req.append(field);
+    req.append(increment);
+
+	if (entity->operate_int(new_val, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::command(const List &args, Reply &reply)
+{
+    Request req(args.size());
+
+	for(List::const_iterator it=args.begin(); it!=args.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_reply(reply, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::watch(const List &keys)
+{
+    Request req(keys.size()+1);
+    req.append("WATCH");
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::unwatch()
+{
+    Request req(1);
+    req.append("UNWATCH");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::exec(Transaction &tx)
+{
+    Request multi(1);
+    multi.append("MULTI");
+
+    Request exec(1);
+    exec.append("EXEC");
+
+    string cmds(multi.str(), multi.len());
+    cmds.append(tx.cmds);
+    cmds.append(exec.str(), exec.len());
+
+    //the replies to MULTI and the queued commands are only acknowledgements
+	if (entity->operate_batch(tx.replies, cmds, tx.num+2) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::exec(const List &keys, Optimistic &body, Transaction &tx, int tries)
+{
+    int rc = RECORD_NUL;
+
+    for (int i=0; i<tries && rc == RECORD_NUL; i++)
+    {
+        tx.clear();
+
+        if ((rc = watch(keys)) != OK)
+            return rc;
+
+        if ((rc = body.prepare(*this, tx)) != OK)
+        {
+            unwatch();
+            return rc;
+        }
+
+        rc = exec(tx);
+    }
+
+    return rc;
+}
+
+
+//SHA1 of RFC 3174, in hex
+static string redic_sha1(const string &data)
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint64_t bits = (uint64_t)data.length() * 8;
+
+    //pad with 0x80, zeros and the length in bits to a multiple of 64 bytes
+    string msg(data);
+    msg += (char)0x80;
+
+    while (msg.length() % 64 != 56)
+        msg += (char)0;
+
+    for (int i=7; i>=0; i--)
+        msg += (char)(bits >> (i*8));
+
+    for (size_t off=0; off<msg.length(); off+=64)
+    {
+        uint32_t w[80];
+        const unsigned char *p = (const unsigned char *)msg.data() + off;
+
+        for (int i=0; i<16; i++)
+            w[i] = (uint32_t)p[i*4] << 24 | (uint32_t)p[i*4+1] << 16 | (uint32_t)p[i*4+2] << 8 | p[i*4+3];
+
+        for (int i=16; i<80; i++)
+        {
+            uint32_t x = w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16];
+            w[i] = x << 1 | x >> 31;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+        for (int i=0; i<80; i++)
+        {
+            uint32_t f, k;
+
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t t = (a << 5 | a >> 27) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = b << 30 | b >> 2;
+            b = a;
+            a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    char hex[41];
+
+    for (int i=0; i<5; i++)
+        sprintf(hex + i*8, "%08x", h[i]);
+
+    return string(hex, 40);
+}
+
+Redic::Script::Script(const char *body) : src(body)
+{
+    digest = redic_sha1(src);
+}
+
+const string &Redic::Script::body() const
+{
+    return src;
+}
+
+const string &Redic::Script::sha1() const
+{
+    return digest;
+}
+
+int Redic::eval(const Script &script, const List &keys, const List &args, Reply &reply)
+{
+    Request req(keys.size() + args.size() + 3);
+    req.append("EVALSHA");
+    req.append(script.sha1());
+    req.append((int)keys.size());
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	for(List::const_iterator it=args.begin(); it!=args.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_reply(reply, req) == OK)
+		return OK;
+
+    //only a script unknown to the server is sent again in full
+    if (entity->errnum() != SERVER_ERR || reply.empty() || reply.type() != Reply::TYPE_ERROR
+        || strncmp(reply.data(), "NOSCRIPT", 8) != 0)
+		return entity->errnum();
+
+    Request full(keys.size() + args.size() + 3);
+    full.append("EVAL");
+    full.append(script.body());
+    full.append((int)keys.size());
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        full.append(*it);
+
+	for(List::const_iterator it=args.begin(); it!=args.end(); it++)
+        full.append(*it);
+
+	if (entity->operate_reply(reply, full) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::script_load(const Script &script)
+{
+    Request req(3);
+    req.append("SCRIPT");
+    req.append("LOAD");
+    req.append(script.body());
+
+	string result;
+
+	if (entity->operate_bulk(result, req) != OK)
+		return entity->errnum();
+
+	if (result != script.sha1())
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::xadd(const char *key, const List &fields_values, string &id)
+{
+    Request req(3+fields_values.size());
+    req.append("XADD");
+    req.append(key);
+    req.append("*");
+
+	for(List::const_iterator it=fields_values.begin(); it!=fields_values.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_bulk(id, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::xlen(const char *key, int &length)
+{
+    Request req(2);
+    req.append("XLEN");
+    req.append(key);
+
+	if (entity->operate_int(length, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::xgroup_create(const char *key, const char *group, const char *id)
+{
+    Request req(6);
+    req.append("XGROUP");
+    req.append("CREATE");
+    req.append(key);
+    req.append(group);
+    req.append(id);
+    req.append("MKSTREAM");
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::xreadgroup(const char *group, const char *consumer, const List &keys,
+                      int count, int block, Entries &entries, const char *id)
+{
+    Request req(5 + (count > 0 ? 2 : 0) + (block >= 0 ? 2 : 0) + keys.size()*2);
+    req.append("XREADGROUP");
+    req.append("GROUP");
+    req.append(group);
+    req.append(consumer);
+
+    if (count > 0)
+    {
+        req.append("COUNT");
+        req.append(count);
+    }
+
+    if (block >= 0)
+    {
+        req.append("BLOCK");
+        req.append(block);
+
+        //no socket timeout while the server blocks, 0 is for ever
+        entity->extend(block ? block : INT_MAX - TIMEOUT_VAL);
+    }
+
+    req.append("STREAMS");
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	for(size_t i=0; i<keys.size(); i++)
+        req.append(id);
+
+    entries.clear();
+
+	if (entity->operate_reply(entries.reply, req) != OK)
+		return entity->errnum();
+
+    //an array of [key, entries] under RESP2, a map of key to entries under RESP3
+    const Reply &reply = entries.reply;
+
+    //walked by next(), as child() counts from the first each time
+    int node = reply.first(0);
+
+    if (reply.type() == Reply::TYPE_MAP)
+    {
+        for (int i=0; i+1<reply.count(); i+=2)
+        {
+            int list = reply.next(node);
+            entries.load(node, list);
+            node = reply.next(list);
+        }
+    }
+    else
+    {
+        for (int i=0; i<reply.count(); i++, node=reply.next(node))
+        {
+            if (reply.count(node) >= 2)
+                entries.load(reply.first(node), reply.next(reply.first(node)));
+        }
+    }
+
+    return entries.empty() ? RECORD_NUL : OK;
+}
+
+int Redic::xack(const char *key, const char *group, const List &ids, int &acked)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "XACK", key, ids, 1, group);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    acked = (int)sum;
+	return OK;
+}
+
+int Redic::xack(const char *key, const char *group, const Entries &entries, int &acked)
+{
+    List ids;
+
+    for (int i=0; i<entries.size(); i++)
+    {
+        string stream = entries.stream(i);
+
+        if (stream.empty() || stream == key)
+            ids.push_back(entries.id(i));
+    }
+
+    return xack(key, group, ids, acked);
+}
+
+int Redic::xautoclaim(const char *key, const char *group, const char *consumer,
+                      int min_idle, const char *start, int count, Entries &entries, string &next)
+{
+    Request req(8);
+    req.append("XAUTOCLAIM");
+    req.append(key);
+    req.append(group);
+    req.append(consumer);
+    req.append(min_idle);
+    req.append(start);
+    req.append("COUNT");
+    req.append(count);
+
+    entries.clear();
+
+	if (entity->operate_reply(entries.reply, req) != OK)
+		return entity->errnum();
+
+    //[next, entries, deleted ids], the last one since 7.0
+    const Reply &reply = entries.reply;
+
+    if (reply.count() < 2)
+        return SYNTAX_ERR;
+
+    next = reply.str(reply.child(0, 0));
+    entries.load(-1, reply.child(0, 1));
+    return OK;
+}
+
+int Redic::pfadd(const char *key, const List &elements, int &changed)
+{
+    string cmds;
+    int num = encode_chunks(cmds, "PFADD", key, elements, 1);
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    changed = sum > 0 ? 1 : 0;
+	return OK;
+}
+
+int Redic::pfadd(const List &keys, const std::vector<List> &elements, int &changed)
+{
+    assert(keys.size() == elements.size());
+
+    string cmds;
+    int num = 0;
+    int i = 0;
+
+    for (List::const_iterator it=keys.begin(); it!=keys.end(); it++, i++)
+        num += encode_chunks(cmds, "PFADD", it->c_str(), elements[i], 1);
+
+    int64_t sum = 0;
+    int last = 0;
+
+    if (num > 0 && entity->operate_ints(cmds, num, sum, last) != OK)
+		return entity->errnum();
+
+    changed = sum > 0 ? 1 : 0;
+	return OK;
+}
+
+int Redic::pfcount(const char *key, int64_t &count)
+{
+    Request req(2);
+    req.append("PFCOUNT");
+    req.append(key);
+
+	if (entity->operate_int(count, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::pfcount(const List &keys, int64_t &count)
+{
+    Request req(1+keys.size());
+    req.append("PFCOUNT");
+
+	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+        req.append(*it);
+
+	if (entity->operate_int(count, req) != OK)
+		return entity->errnum();
+
+	return OK;
+}
+
+int Redic::pfmerge(const char *destkey, const List &sources)
+{
+    Request req(2+sources.size());
+    req.append("PFMERGE");
+    req.append(destkey);
+
+	for(List::const_iterator it=sources.begin(); it!=sources.end(); it++)
+        req.append(*it);
+
+	string result;
+
+	if (entity->operate_inline(result, req) != OK)
+		return entity->errnum();
+
+	if (result != "OK")
+		return SYNTAX_ERR;
+
+	return OK;
+}
+
+int Redic::publish(const char *channel, const char *message, int &receivers)
+{
+    Request req(3);
+    req.append("PUBLISH");
+    req.append(channel);
+    req.append(message);
+
+    int result;
+
+	if (entity->operate_int(result, req) != OK)
+		return entity->errnum();
+
+    receivers = result;
+	return OK;
+}
+
+
+Redic::Entries::Entries()
+{
+}
+
+void Redic::Entries::clear()
+{
+    reply.clear();
+    entries.clear();
+}
+
+int Redic::Entries::size() const
+{
+    return entries.size();
+}
+
+bool Redic::Entries::empty() const
+{
+    return entries.empty();
+}
+
+string Redic::Entries::stream(int i) const
+{
+    assert(i >= 0 && i < (int)entries.size());
+    return entries[i].stream < 0 ? string() : reply.str(entries[i].stream);
+}
+
+const char *Redic::Entries::id(int i) const
+{
+    assert(i >= 0 && i < (int)entries.size());
+    return reply.data(entries[i].id);
+}
+
+int Redic::Entries::fields(int i) const
+{
+    assert(i >= 0 && i < (int)entries.size());
+    return entries[i].count;
+}
+
+//the fields and values of an entry are consecutive leaf nodes
+const char *Redic::Entries::field(int i, int j) const
+{
+    assert(j >= 0 && j < fields(i));
+    return reply.data(entries[i].first + j*2);
+}
+
+const char *Redic::Entries::value(int i, int j) const
+{
+    assert(j >= 0 && j < fields(i));
+    return reply.data(entries[i].first + j*2 + 1);
+}
+
+int Redic::Entries::field_length(int i, int j) const
+{
+    assert(j >= 0 && j < fields(i));
+    return reply.length(entries[i].first + j*2);
+}
+
+int Redic::Entries::value_length(int i, int j) const
+{
+    assert(j >= 0 && j < fields(i));
+    return reply.length(entries[i].first + j*2 + 1);
+}
+
+//add the entries of list, each an [id, [field, value, ...]] array
+void Redic::Entries::load(int stream, int list)
+{
+    if (list < 0 || !reply.aggregate(list))
+        return;
+
+    int node = reply.first(list);
+
+    for (int i=0; i<reply.count(list); i++, node=reply.next(node))
+    {
+        if (reply.count(node) < 1)
+            continue;
+
+        Entry entry;
+        entry.stream = stream;
+        entry.id = reply.first(node);
+        entry.first = -1;
+        entry.count = 0;
+
+        //a deleted entry still pending has nil fields
+        int pairs = reply.count(node) > 1 ? reply.next(entry.id) : -1;
+
+        if (pairs >= 0 && reply.aggregate(pairs))
+        {
+            entry.first = reply.first(pairs);
+            entry.count = reply.count(pairs) / 2;
+        }
+
+        entries.push_back(entry);
+    }
+}
+
+
+Redic::Transaction::Transaction()
+{
+    num = 0;
+}
+
+void Redic::Transaction::clear()
+{
+    cmds.clear();
+    num = 0;
+    replies.clear();
+}
+
+void Redic::Transaction::add(const List &args)
+{
+    Request req(args.size());
+
+	for(List::const_iterator it=args.begin(); it!=args.end(); it++)
+        req.append(*it);
+
+    cmds.append(req.str(), req.len());
+    num++;
+}
+
+void Redic::Transaction::add(const char *cmd, const char *arg1, const char *arg2, const char *arg3)
+{
+    Request req(1 + (arg1 != NULL) + (arg2 != NULL) + (arg3 != NULL));
+    req.append(cmd);
+
+    if (arg1)
+        req.append(arg1);
+
+    if (arg2)
+        req.append(arg2);
+
+    if (arg3)
+        req.append(arg3);
+
+    cmds.append(req.str(), req.len());
+    num++;
+}
+
+int Redic::Transaction::size() const
+{
+    return num;
+}
+
+int Redic::Transaction::node(int i) const
+{
+    if (replies.empty() || !replies.aggregate())
+        return -1;
+
+    return replies.child(0, i);
+}
+
+int Redic::Transaction::result(int i) const
+{
+    int n = node(i);
+
+    if (n < 0)
+        return SYNTAX_ERR;
+
+    switch (replies.type(n))
+    {
+    case Reply::TYPE_ERROR:
+        return SERVER_ERR;
+
+    case Reply::TYPE_NIL:
+        return RECORD_NUL;
+
+    default:
+        return OK;
+    }
+}
+
+int Redic::Transaction::integer(int i, int64_t &val) const
+{
+    int rc = result(i);
+
+    if (rc != OK)
+        return rc;
+
+    int n = node(i);
+
+    if (replies.type(n) != Reply::TYPE_INTEGER && replies.type(n) != Reply::TYPE_BOOLEAN)
+        return SYNTAX_ERR;
+
+    val = replies.integer(n);
+    return OK;
+}
+
+int Redic::Transaction::str(int i, string &val) const
+{
+    int rc = result(i);
+
+    if (rc != OK)
+        return rc;
+
+    int n = node(i);
+
+    if (replies.data(n) == NULL)
+        return SYNTAX_ERR;
+
+    val.assign(replies.data(n), replies.length(n));
+    return OK;
+}
+
+const Redic::Reply &Redic::Transaction::reply() const
+{
+    return replies;
+}
+
+
+RedicTtlCache::RedicTtlCache(Redic &redic, int ttl, int max_keys, int shards) : redic(redic)
+{
+	store = new RedicTtlStore(ttl, max_keys, shards);
+}
+
+RedicTtlCache::~RedicTtlCache()
+{
+	delete store;
+}
+
+int RedicTtlCache::get(const char *key, string &value)
+{
+	RedicTtlStore::Item item;
+	int64_t version;
+
+	if (!store->find(key, "g", item, version))
+	{
+		{
+			RedicGuard guard(store->conn);
+			item.rc = redic.get(key, item.val);
+		}
+
+		store->keep(key, "g", item, version);
+	}
+
+	value.swap(item.val);
+	return item.rc;
+}
+
+int RedicTtlCache::hget(const char *key, const char *field, string &value)
+{
+	RedicTtlStore::Item item;
+	int64_t version;
+	string sub = string("f") + field;
+
+	if (!store->find(key, sub, item, version))
+	{
+		{
+			RedicGuard guard(store->conn);
+			item.rc = redic.hget(key, field, item.val);
+		}
+
+		store->keep(key, sub, item, version);
+	}
+
+	value.swap(item.val);
+	return item.rc;
+}
+
+int RedicTtlCache::hgetall(const char *key, Redic::List &fields_values)
+{
+	RedicTtlStore::Item item;
+	int64_t version;
+
+	if (!store->find(key, "a", item, version))
+	{
+		{
+			RedicGuard guard(store->conn);
+			item.rc = redic.hgetall(key, item.list);
+		}
+
+		store->keep(key, "a", item, version);
+	}
+
+	fields_values.swap(item.list);
+	return item.rc;
+}
+
+int RedicTtlCache::smembers(const char *key, Redic::Set &members)
+{
+	RedicTtlStore::Item item;
+	int64_t version;
+
+	if (!store->find(key, "s", item, version))
+	{
+		{
+			RedicGuard guard(store->conn);
+			item.rc = redic.smembers(key, item.set);
+		}
+
+		store->keep(key, "s", item, version);
+	}
+
+	members.swap(item.set);
+	return item.rc;
+}
+
+int RedicTtlCache::set(const char *key, const char *value)
+{
+	int rc;
+
+	{
+		RedicGuard guard(store->conn);
+		rc = redic.set(key, value);
+	}
+
+	store->invalidate(key);
+	return rc;
+}
+
+int RedicTtlCache::del(const char *key)
+{
+	int rc;
+
+	{
+		RedicGuard guard(store->conn);
+		rc = redic.del(key);
+	}
+
+	store->invalidate(key);
+	return rc;
+}
+
+int RedicTtlCache::hset(const char *key, const char *field, const char *value)
+{
+	int rc;
+
+	{
+		RedicGuard guard(store->conn);
+		rc = redic.hset(key, field, value);
+	}
+
+	store->invalidate(key);
+	return rc;
+}
+
+void RedicTtlCache::clear()
+{
+	store->clear();
+}
+
+int64_t RedicTtlCache::hits()
+{
+	return store->hits();
+}
+
+int64_t RedicTtlCache::misses()
+{
+	return store->misses();
+}
+
+
+RedicSingleFlight::RedicSingleFlight(Redic &redic) : redic(redic)
+{
+	flights = new RedicFlights;
+}
+
+RedicSingleFlight::~RedicSingleFlight()
+{
+	delete flights;
+}
+
+int RedicSingleFlight::get(const char *key, string &value)
+{
+	RedicFlights::Flight *flight;
+	string id("GET");
+	RedicFlights::key(id, key);
+
+	if (flights->join(id, flight))
+	{
+		{
+			RedicGuard guard(flights->conn);
+			flight->rc = redic.get(key, flight->val);
+		}
+
+		flights->land(id, flight);
+	}
+	else
+	{
+		flights->wait(flight);
+	}
+
+	int rc = flight->rc;
+	value = flight->val;
+	flights->leave(flight);
+	return rc;
+}
+
+int RedicSingleFlight::hget(const char *key, const char *field, string &value)
+{
+	RedicFlights::Flight *flight;
+	string id("HGET");
+	RedicFlights::key(id, key);
+	RedicFlights::key(id, field);
+
+	if (flights->join(id, flight))
+	{
+		{
+			RedicGuard guard(flights->conn);
+			flight->rc = redic.hget(key, field, flight->val);
+		}
+
+		flights->land(id, flight);
+	}
+	else
+	{
+		flights->wait(flight);
+	}
+
+	int rc = flight->rc;
+	value = flight->val;
+	flights->leave(flight);
+	return rc;
+}
+
+int RedicSingleFlight::hgetall(const char *key, Redic::List &fields_values)
+{
+	RedicFlights::Flight *flight;
+	string id("HGETALL");
+	RedicFlights::key(id, key);
+
+	if (flights->join(id, flight))
+	{
+		{
+			RedicGuard guard(flights->conn);
+			flight->rc = redic.hgetall(key, flight->list);
+		}
 
-	int operate_inline(string &result, Request &req)
+		flights->land(id, flight);
+	}
+	else
 	{
-		tv.tv_sec = TIMEOUT_VAL/1000;
-		tv.tv_usec = (TIMEOUT_VAL%1000)*1000;
+		flights->wait(flight);
+	}
 
-		head = 0;
-		tail = 0;
+	int rc = flight->rc;
+	fields_values = flight->list;
+	flights->leave(flight);
+	return rc;
+}
 
-        if (send_req(req) != ok)
-			return xx;
+int RedicSingleFlight::smembers(const char *key, Redic::Set &members)
+{
+	RedicFlights::Flight *flight;
+	string id("SMEMBERS");
+	RedicFlights::key(id, key);
 
-		if (recv_inline(result) != ok)
-			return xx;
+	if (flights->join(id, flight))
+	{
+		{
+			RedicGuard guard(flights->conn);
+			flight->rc = redic.smembers(key, flight->set);
+		}
 
-		return ok;
+		flights->land(id, flight);
+	}
+	else
+	{
+		flights->wait(flight);
 	}
 
-	int operate_bulk(string &result, Request &req)
+	int rc = flight->rc;
+	members = flight->set;
+	flights->leave(flight);
+	return rc;
+}
+
+//commands with no side effect, which several callers may share
+static bool redic_readonly(const string &cmd)
+{
+	static const char *reads[] = {
+		"BITCOUNT", "BITPOS", "EXISTS", "GET", "GETBIT", "GETRANGE", "HEXISTS", "HGET",
+		"HGETALL", "HKEYS", "HLEN", "HMGET", "HSTRLEN", "HVALS", "LINDEX", "LLEN",
+		"LPOS", "LRANGE", "MGET", "PTTL", "SCARD", "SDIFF", "SINTER", "SISMEMBER",
+		"SMEMBERS", "SMISMEMBER", "STRLEN", "SUNION", "TTL", "TYPE", "XLEN", "XRANGE",
+		"XREVRANGE", "ZCARD", "ZCOUNT", "ZLEXCOUNT", "ZMSCORE", "ZRANGE", "ZRANGEBYLEX",
+		"ZRANGEBYSCORE", "ZRANK", "ZREVRANGE", "ZREVRANGEBYLEX", "ZREVRANGEBYSCORE",
+		"ZREVRANK", "ZSCORE",
+	};
+	string name(cmd);
+
+	for (size_t i=0; i<name.size(); i++)
+		name[i] = toupper((unsigned char)name[i]);
+
+	for (size_t i=0; i<sizeof(reads)/sizeof(reads[0]); i++)
 	{
-		tv.tv_sec = TIMEOUT_VAL/1000;
-		tv.tv_usec = (TIMEOUT_VAL%1000)*1000;
+		if (name == reads[i])
+			return true;
+	}
 
-		head = 0;
-		tail = 0;
+	return false;
+}
 
-        if (send_req(req) != ok)
-			return xx;
+int RedicSingleFlight::command(const Redic::List &args, Redic::Reply &reply)
+{
+	RedicFlights::Flight *flight;
+	string id;
 
-		if (recv_bulk(result) != ok)
-			return xx;
+	if (args.empty() || !redic_readonly(args.front()))
+		return Redic::SYNTAX_ERR;
 
-		return ok;
-	}
+	for (Redic::List::const_iterator it=args.begin(); it!=args.end(); it++)
+		RedicFlights::key(id, it->data(), it->length());
 
-	int operate_int(int &result, Request &req)
+	if (flights->join(id, flight))
 	{
-		tv.tv_sec = TIMEOUT_VAL/1000;
-		tv.tv_usec = (TIMEOUT_VAL%1000)*1000;
+		{
+			RedicGuard guard(flights->conn);
+			flight->rc = redic.command(args, flight->reply);
+		}
 
-		head = 0;
-		tail = 0;
+		flights->land(id, flight);
+	}
+	else
+	{
+		flights->wait(flight);
+	}
 
-        if (send_req(req) != ok)
-			return xx;
+	int rc = flight->rc;
+	reply = flight->reply;
+	flights->leave(flight);
+	return rc;
+}
 
-		if (recv_int(result) != ok)
-			return xx;
+int64_t RedicSingleFlight::calls()
+{
+	return flights->total();
+}
 
-		return ok;
-	}
+int64_t RedicSingleFlight::collapsed()
+{
+	return flights->shared();
+}
 
-	int operate_list(std::list<string> &result, Request &req)
-	{
-		tv.tv_sec = TIMEOUT_VAL/1000;
-		tv.tv_usec = (TIMEOUT_VAL%1000)*1000;
 
-		head = 0;
-		tail = 0;
+RedicLoader::RedicLoader(int buffer)
+{
+	pipe = NULL;
+	limit = buffer;
+}
 
-        if (send_req(req) != ok)
-			return xx;
+RedicLoader::~RedicLoader()
+{
+	delete pipe;
+}
 
-		if (recv_list(result) != ok)
-			return xx;
+int RedicLoader::connect(const char *host, short port, const char *password)
+{
+	delete pipe;
+	pipe = new RedicPipe;
 
-		return ok;
-	}
+    host = host ? host : "localhost";
+    port = port ? port : 6379;
 
-	int operate_set(std::set<string> &result, Request &req)
+	if (pipe->link.conn(host, port) != Redic::OK)
+		return pipe->link.errnum();
+
+	if (password)
 	{
-		tv.tv_sec = TIMEOUT_VAL/1000;
-		tv.tv_usec = (TIMEOUT_VAL%1000)*1000;
+		Request req(2);
+		req.append("AUTH");
+		req.append(password);
 
-		head = 0;
-		tail = 0;
+		string result;
 
-        if (send_req(req) != ok)
-			return xx;
+		if (pipe->link.operate_inline(result, req) != Redic::OK)
+			return pipe->link.errnum();
+	}
 
-		if (recv_set(result) != ok)
-			return xx;
+	if (!pipe->reader.start(RedicPipe::run, pipe))
+		return Redic::CONNECT_ERR;
 
-		return ok;
+	pipe->out.reserve(limit);
+	return Redic::OK;
+}
+
+int RedicLoader::add(const Redic::List &args)
+{
+	if (pipe == NULL)
+		return Redic::CONNECT_ERR;
+
+    Request req(args.size());
+
+	for(Redic::List::const_iterator it=args.begin(); it!=args.end(); it++)
+        req.append(*it);
+
+	pipe->out.append(req.str(), req.len());
+	pipe->sent++;
+
+	if ((int)pipe->out.length() >= limit)
+		return pipe->flush();
+
+	return Redic::OK;
+}
+
+int RedicLoader::add(const char *cmd, const char *arg1, const char *arg2, const char *arg3)
+{
+	if (pipe == NULL)
+		return Redic::CONNECT_ERR;
+
+    Request req(1 + (arg1 != NULL) + (arg2 != NULL) + (arg3 != NULL));
+    req.append(cmd);
+
+    if (arg1)
+        req.append(arg1);
+
+    if (arg2)
+        req.append(arg2);
+
+    if (arg3)
+        req.append(arg3);
+
+    pipe->out.append(req.str(), req.len());
+    pipe->sent++;
+
+    if ((int)pipe->out.length() >= limit)
+        return pipe->flush();
+
+    return Redic::OK;
+}
+
+int RedicLoader::finish()
+{
+	if (pipe == NULL)
+		return Redic::CONNECT_ERR;
+
+	if (pipe->flush() != Redic::OK)
+		return Redic::CONNECT_ERR;
+
+	RedicGuard guard(pipe->lock);
+
+	//give up once no reply comes for as long as a command may take
+	int64_t deadline = redic_clock() + TIMEOUT_VAL;
+	int64_t seen = pipe->received;
+
+	while (!pipe->failed && pipe->received < pipe->sent)
+	{
+		int64_t left = deadline - redic_clock();
+
+		if (pipe->received != seen)
+		{
+			seen = pipe->received;
+			left = TIMEOUT_VAL;
+			deadline = redic_clock() + left;
+		}
+
+		if (left <= 0)
+		{
+			LOG("no reply to bulk in time");
+			pipe->failed = true;
+			break;
+		}
+
+		pipe->progress.wait(pipe->lock, (int)left);
 	}
-};
 
+	if (pipe->failed)
+		return Redic::CONNECT_ERR;
 
-Redic::Redic()
+	return pipe->errors ? Redic::SERVER_ERR : Redic::OK;
+}
+
+int64_t RedicLoader::sent()
 {
-	entity = new RedicEntity;
+	return pipe ? pipe->sent : 0;
 }
 
-Redic::~Redic()
+int64_t RedicLoader::received()
 {
-	delete entity;
+	if (pipe == NULL)
+		return 0;
+
+	RedicGuard guard(pipe->lock);
+	return pipe->received;
 }
 
-int Redic::connect(const char *host, short port)
+int64_t RedicLoader::errors()
 {
-    host = host ? host : "localhost";
-    port = port ? port : 6379;
-	return entity->conn(host, port);
+	if (pipe == NULL)
+		return 0;
+
+	RedicGuard guard(pipe->lock);
+	return pipe->errors;
 }
 
-void Redic::disconn()
+int64_t RedicLoader::first_error(string &message)
 {
-	entity->disconn();
+	if (pipe == NULL)
+		return -1;
+
+	RedicGuard guard(pipe->lock);
+	message = pipe->message;
+	return pipe->first;
 }
 
-int Redic::auth(const char *password)
+
+RedicSubscriber::RedicSubscriber(Handler &handler, int batch)
 {
-    Request req(2);
-    req.append("AUTH");
-    req.append(password);
+	sub = new RedicSubscription(handler, batch);
+}
 
-	string result;
+RedicSubscriber::~RedicSubscriber()
+{
+	delete sub;
+}
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+int RedicSubscriber::connect(const char *host, short port, const char *password)
+{
+	sub->halt();
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+    host = host ? host : "localhost";
+    port = port ? port : 6379;
 
-	return OK;
+	if (sub->link.conn(host, port) != Redic::OK)
+		return sub->link.errnum();
+
+	{
+		RedicGuard guard(sub->lock);
+		sub->broken = false;
+	}
+
+	sub->parser.reset(sub->reply);
+
+	if (password)
+	{
+		Request req(2);
+		req.append("AUTH");
+		req.append(password);
+
+		string result;
+
+		if (sub->link.operate_inline(result, req) != Redic::OK)
+			return sub->link.errnum();
+	}
+
+	return Redic::OK;
 }
 
-int Redic::info(string &info)
+int RedicSubscriber::subscribe(const char *channel)
 {
-    Request req(1);
-    req.append("INFO");
+	return sub->command("SUBSCRIBE", channel);
+}
 
-	if (entity->operate_bulk(info, req) != OK)
-		return entity->errnum();
+int RedicSubscriber::psubscribe(const char *pattern)
+{
+	return sub->command("PSUBSCRIBE", pattern);
+}
 
-	return OK;
+int RedicSubscriber::unsubscribe(const char *channel)
+{
+	return sub->command("UNSUBSCRIBE", channel);
 }
 
-int Redic::ping()
+int RedicSubscriber::punsubscribe(const char *pattern)
 {
-    Request req(1);
-    req.append("PING");
+	return sub->command("PUNSUBSCRIBE", pattern);
+}
 
-	string result;
+int RedicSubscriber::start()
+{
+	sub->halt();
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+	{
+		RedicGuard guard(sub->lock);
 
-	if (result != "PONG")
-		return SYNTAX_ERR;
+		if (sub->broken)
+			return Redic::CONNECT_ERR;
 
-	return OK;
+		//set before the thread runs, which clears it if the connection breaks
+		sub->running = true;
+	}
+
+	if (!sub->thread.start(RedicSubscription::run, sub))
+	{
+		RedicGuard guard(sub->lock);
+		sub->running = false;
+		return Redic::CONNECT_ERR;
+	}
+
+	return Redic::OK;
 }
 
-int Redic::save()
+void RedicSubscriber::stop()
 {
-    Request req(1);
-    req.append("SAVE");
+	sub->halt();
+}
 
-	string result;
+int RedicSubscriber::poll(int wait)
+{
+	//the dispatch thread owns the connection while it runs
+	{
+		RedicGuard guard(sub->lock);
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+		if (sub->broken)
+			return -Redic::CONNECT_ERR;
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+		if (sub->running)
+			return -Redic::SYNTAX_ERR;
+	}
 
-	return OK;
+	int count = sub->pump(wait);
+
+	if (count < 0)
+	{
+		RedicGuard guard(sub->lock);
+		sub->broken = true;
+		return -Redic::CONNECT_ERR;
+	}
+
+	return count;
 }
 
-int Redic::bgsave()
+int RedicSubscriber::subscriptions()
 {
-    Request req(1);
-    req.append("BGSAVE");
+	RedicGuard guard(sub->lock);
+	return sub->confirmed;
+}
 
-	string result;
+int64_t RedicSubscriber::received()
+{
+	RedicGuard guard(sub->lock);
+	return sub->received;
+}
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
 
-	//result is some tips string
-	return OK;
-}
 
-int Redic::lastsave(time_t &tm)
+///Queues of a worker, the one to block on first at the front.
+class RedicQueues
 {
-    Request req(1);
-    req.append("LASTSAVE");
+public:
+	RedicQueues(RedicWorker::Handler &handler, int batch)
+		: handler(handler), batch(batch > 0 ? batch : 1), processed(0)
+	{
+	}
 
-	int result;
+	RedicWorker::Handler &handler;
+	int batch;
+	int64_t processed;
+	Redic::List names;
+	Redic::List elements;
+	Redic::Transaction tx;
+};
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+RedicWorker::RedicWorker(Redic &redic, Handler &handler, int batch)
+	: redic(redic), queues(new RedicQueues(handler, batch))
+{
+}
 
-	tm = result;
-	return OK;
+RedicWorker::~RedicWorker()
+{
+	delete queues;
 }
 
-int Redic::bgrewriteaof()
+void RedicWorker::add(const char *queue)
 {
-    Request req(1);
-    req.append("BGREWRITEAOF");
+	queues->names.push_back(queue);
+}
+
+int RedicWorker::work(int timeout)
+{
+	string queue;
+	string element;
+
+	int rc = redic.blpop(queues->names, timeout, queue, element);
+
+	if (rc == Redic::RECORD_NUL)
+		return 0;
+
+	if (rc != Redic::OK)
+		return -rc;
+
+	Redic::List &elements = queues->elements;
+	elements.clear();
+	elements.push_back(element);
+
+	//take the rest of the batch at once, the range and trim being atomic
+	if (queues->batch > 1)
+	{
+		char last[16];
+		char first[16];
+		sprintf(last, "%d", queues->batch - 2);
+		sprintf(first, "%d", queues->batch - 1);
+
+		Redic::Transaction &tx = queues->tx;
+		tx.clear();
+		tx.add("LRANGE", queue.c_str(), "0", last);
+		tx.add("LTRIM", queue.c_str(), first, "-1");
+
+		if ((rc = redic.exec(tx)) != Redic::OK)
+			return -rc;
+
+		const Redic::Reply &reply = tx.reply();
+		int list = reply.first(0);
+		int node = reply.first(list);
 
-	string result;
+		for (int i=0; i<reply.count(list); i++, node=reply.next(node))
+			elements.push_back(reply.str(node));
+	}
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+	//block on the queue woken last at the end next time
+	Redic::List &names = queues->names;
+	Redic::List::iterator it = std::find(names.begin(), names.end(), queue);
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+	if (it != names.end())
+		names.splice(names.end(), names, it);
 
-	return OK;
+	queues->handler.process(queue, elements);
+	queues->processed += elements.size();
+	return elements.size();
 }
 
-int Redic::select(int index)
+int64_t RedicWorker::processed()
 {
-    Request req(2);
-    req.append("SELECT");
-    req.append(index);
+	return queues->processed;
+}
 
-	string result;
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+///Elements of a PFADD batch, per key in the order the keys came.
+class RedicPfBuffer
+{
+public:
+	RedicPfBuffer(int max_elements, int max_wait)
+		: max_elements(max_elements > 0 ? max_elements : 1), max_wait(max_wait),
+		  count(0), since(0), flushed(0)
+	{
+	}
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+	int max_elements;
+	int max_wait;
+	int count;
+	int64_t since;
+	int64_t flushed;
+	std::map<string, int> index;
+	Redic::List keys;
+	std::vector<Redic::List> elements;
+};
 
-	return OK;
+RedicPfBatch::RedicPfBatch(Redic &redic, int max_elements, int max_wait)
+	: redic(redic), buffer(new RedicPfBuffer(max_elements, max_wait))
+{
 }
 
-int Redic::randomkey(string &key)
+RedicPfBatch::~RedicPfBatch()
 {
-    Request req(1);
-    req.append("RANDOMKEY");
-
-	if (entity->operate_bulk(key, req) != OK)
-		return entity->errnum();
-
-	return OK;
+	delete buffer;
 }
 
-int Redic::dbsize(int &size)
+int RedicPfBatch::add(const char *key, const char *element)
 {
-    Request req(1);
-    req.append("DBSIZE");
+	std::map<string, int>::iterator it = buffer->index.find(key);
 
-    int result;
+	if (it == buffer->index.end())
+	{
+		it = buffer->index.insert(std::make_pair(string(key), (int)buffer->keys.size())).first;
+		buffer->keys.push_back(key);
+		buffer->elements.push_back(Redic::List());
+	}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+	if (buffer->count == 0)
+		buffer->since = redic_clock();
 
-    if (result < 0)
-        return SYNTAX_ERR;
+	buffer->elements[it->second].push_back(element);
+	buffer->count++;
 
-    size = result;
-	return OK;
+	if (buffer->count >= buffer->max_elements)
+		return flush();
+
+	return poll();
 }
 
-int Redic::flushdb()
+int RedicPfBatch::poll()
 {
-    Request req(1);
-    req.append("FLUSHDB");
+	if (buffer->count > 0 && redic_clock() - buffer->since >= buffer->max_wait)
+		return flush();
 
-	string result;
+	return Redic::OK;
+}
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+int RedicPfBatch::flush()
+{
+	if (buffer->count == 0)
+		return Redic::OK;
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+	int changed;
+	int rc = redic.pfadd(buffer->keys, buffer->elements, changed);
 
-	return OK;
+	//kept for the next flush on failure, adding twice to a HyperLogLog is harmless
+	if (rc != Redic::OK)
+		return rc;
+
+	buffer->flushed += buffer->count;
+	buffer->count = 0;
+	buffer->index.clear();
+	buffer->keys.clear();
+	buffer->elements.clear();
+	return Redic::OK;
 }
 
-int Redic::flushall()
+int RedicPfBatch::pending()
 {
-    Request req(1);
-    req.append("FLUSHALL");
+	return buffer->count;
+}
 
-	string result;
+int64_t RedicPfBatch::flushed()
+{
+	return buffer->flushed;
+}
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+///Migration shared by the scanning thread and the workers: batches of keys
+///go through a bounded queue, and the workers pace themselves to the rate.
+class RedicMigration
+{
+public:
+    struct Server
+    {
+        string host;
+        short port;
+        string password;
+        int db;
+    };
+
+    Server src;
+    Server dst;
+    int batch;
+    int workers;
+    int rate;
+
+    RedicMutex lock;
+    RedicCond changed;
+    std::list<Redic::List> queue;
+    bool done;
+    int rc;
+    string message;
+    double slot;
+
+    int64_t scanned;
+    int64_t migrated;
+    int64_t skipped;
+    int64_t failed;
+    int64_t bytes;
+
+    RedicMigration(int batch, int workers, int rate)
+        : batch(batch > 0 ? batch : 1), workers(workers > 0 ? workers : 1), rate(rate)
+    {
+        src.port = dst.port = 6379;
+        src.db = dst.db = 0;
+        reset();
+    }
 
-	return OK;
-}
+    void reset()
+    {
+        queue.clear();
+        done = false;
+        rc = Redic::OK;
+        message.clear();
+        slot = 0;
+        scanned = migrated = skipped = failed = bytes = 0;
+    }
 
-int Redic::keys(const char *pattern, List &keys)
-{
-    Request req(2);
-    req.append("KEYS");
-    req.append(pattern);
+    static int open(RedicEntity &link, const Server &server)
+    {
+        if (link.conn(server.host.c_str(), server.port) != Redic::OK)
+            return link.errnum();
 
-	if (entity->operate_list(keys, req) != OK)
-		return entity->errnum();
+        string result;
 
-	return OK;
-}
+        if (!server.password.empty())
+        {
+            Request req(2);
+            req.append("AUTH");
+            req.append(server.password);
 
-int Redic::exists(const char *key)
-{
-    Request req(2);
-    req.append("EXISTS");
-    req.append(key);
+            if (link.operate_inline(result, req) != Redic::OK)
+                return link.errnum();
+        }
 
-	int result;
+        if (server.db != 0)
+        {
+            Request req(2);
+            req.append("SELECT");
+            req.append(server.db);
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+            if (link.operate_inline(result, req) != Redic::OK)
+                return link.errnum();
+        }
 
-    if (result == 0)
-        return RECORD_NUL;
+        return Redic::OK;
+    }
 
-	if (result != 1)
-		return SYNTAX_ERR;
+    //stop everyone at the first connection error
+    void abort(int err, const char *what)
+    {
+        RedicGuard guard(lock);
 
-	return OK;
-}
+        if (rc == Redic::OK || rc == Redic::SERVER_ERR)
+        {
+            rc = err;
+            message = what;
+        }
 
-int Redic::del(const char *key)
-{
-    Request req(2);
-    req.append("DEL");
-    req.append(key);
+        changed.broadcast();
+    }
 
-	int result;
+    //hand a batch to the workers, waiting while they are behind
+    bool put(const Redic::List &keys)
+    {
+        RedicGuard guard(lock);
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        while ((int)queue.size() >= workers*2 && (rc == Redic::OK || rc == Redic::SERVER_ERR))
+            changed.wait(lock);
 
-    if (result == 0)
-        return RECORD_NUL;
+        if (rc != Redic::OK && rc != Redic::SERVER_ERR)
+            return false;
 
-	if (result != 1)
-		return SYNTAX_ERR;
+        queue.push_back(keys);
+        scanned += keys.size();
+        changed.broadcast();
+        return true;
+    }
 
-	return OK;
-}
+    bool take(Redic::List &keys)
+    {
+        RedicGuard guard(lock);
 
-int Redic::type(const char *key, string &type)
-{
-    Request req(2);
-    req.append("TYPE");
-    req.append(key);
+        while (queue.empty() && !done && (rc == Redic::OK || rc == Redic::SERVER_ERR))
+            changed.wait(lock);
 
-	if (entity->operate_inline(type, req) != OK)
-		return entity->errnum();
+        if (queue.empty() || (rc != Redic::OK && rc != Redic::SERVER_ERR))
+            return false;
 
-    if (type == "none")
-        return RECORD_NUL;
+        keys.swap(queue.front());
+        queue.pop_front();
+        changed.broadcast();
+        return true;
+    }
 
-	return OK;
-}
+    //wait for the turn of num keys, so that all workers keep to the rate
+    void pace(int num)
+    {
+        if (rate <= 0)
+            return;
 
-int Redic::rename(const char *key, const char *newkey)
-{
-    Request req(3);
-    req.append("RENAME");
-    req.append(key);
-    req.append(newkey);
+        double now = (double)redic_clock();
+        double at;
 
-	string result;
+        {
+            RedicGuard guard(lock);
+            at = slot > now ? slot : now;
+            slot = at + num*1000.0/rate;
+        }
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+        if (at > now)
+            redic_sleep((int)(at - now));
+    }
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+    static void *run(void *self)
+    {
+        ((RedicMigration *)self)->work();
+        return NULL;
+    }
 
-	return OK;
-}
+    void work()
+    {
+        RedicEntity from;
+        RedicEntity to;
+        int err;
 
-int Redic::renamenx(const char *key, const char *newkey)
-{
-    Request req(3);
-    req.append("RENAMENX");
-    req.append(key);
-    req.append(newkey);
+        if ((err = open(from, src)) != Redic::OK || (err = open(to, dst)) != Redic::OK)
+        {
+            abort(err, "fail to connect");
+            return;
+        }
 
-	int result;
+        Redic::List keys;
+        std::vector<Redic::Reply> dumps;
+        std::vector<Redic::Reply> restores;
+        std::vector<const string *> restored;
+        string cmds;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        while (take(keys))
+        {
+            pace(keys.size());
 
-    if (result == 0)
-        return RECORD_NUL;
+            cmds.clear();
 
-	if (result != 1)
-		return SYNTAX_ERR;
+            for (Redic::List::const_iterator it=keys.begin(); it!=keys.end(); it++)
+            {
+                Request dump(2);
+                dump.append("DUMP");
+                dump.append(*it);
+                cmds.append(dump.str(), dump.len());
+
+                Request pttl(2);
+                pttl.append("PTTL");
+                pttl.append(*it);
+                cmds.append(pttl.str(), pttl.len());
+            }
 
-	return OK;
-}
+            if (from.operate_replies(cmds, keys.size()*2, dumps) != Redic::OK)
+            {
+                abort(from.errnum(), "fail to dump");
+                return;
+            }
 
-int Redic::expire(const char *key, int secs)
-{
-    Request req(3);
-    req.append("EXPIRE");
-    req.append(key);
-    req.append(secs);
+            int64_t gone = 0;
+            int64_t size = 0;
+            int i = 0;
 
-	int result;
+            cmds.clear();
+            restored.clear();
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+            for (Redic::List::const_iterator it=keys.begin(); it!=keys.end(); it++, i+=2)
+            {
+                const Redic::Reply &payload = dumps[i];
+                const Redic::Reply &ttl = dumps[i+1];
+
+                //expired or deleted since scanned
+                if (payload.type() != Redic::Reply::TYPE_STRING || ttl.type() != Redic::Reply::TYPE_INTEGER || ttl.integer() == -2)
+                {
+                    gone++;
+                    continue;
+                }
+
+                Request req(5);
+                req.append("RESTORE");
+                req.append(*it);
+                req.append(ttl.integer() > 0 ? ttl.integer() : (int64_t)0);
+                req.append(payload.data(), payload.length());
+                req.append("REPLACE");
+                cmds.append(req.str(), req.len());
+
+                restored.push_back(&*it);
+                size += payload.length();
+            }
 
-	if (result == 0)
-		return RECORD_NUL;
+            if (!restored.empty() && to.operate_replies(cmds, restored.size(), restores) != Redic::OK)
+            {
+                abort(to.errnum(), "fail to restore");
+                return;
+            }
 
-    if (result != 1)
-        return SYNTAX_ERR;
+            RedicGuard guard(lock);
 
-	return OK;
-}
+            for (size_t k=0; k<restored.size(); k++)
+            {
+                if (restores[k].type() != Redic::Reply::TYPE_ERROR)
+                {
+                    migrated++;
+                    continue;
+                }
+
+                failed++;
+
+                if (rc == Redic::OK)
+                {
+                    rc = Redic::SERVER_ERR;
+                    message = *restored[k] + ": " + restores[k].str();
+                }
+            }
 
-int Redic::ttl(const char *key, int &value)
-{
-    Request req(2);
-    req.append("TTL");
-    req.append(key);
+            skipped += gone;
+            bytes += size;
+        }
+    }
+};
 
-	int result;
+RedicMigrator::RedicMigrator(int batch, int workers, int rate)
+	: migration(new RedicMigration(batch, workers, rate))
+{
+}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+RedicMigrator::~RedicMigrator()
+{
+	delete migration;
+}
 
-    if (result < 0)
-        return SYNTAX_ERR;
+void RedicMigrator::source(const char *host, short port, const char *password, int db)
+{
+	migration->src.host = host ? host : "localhost";
+	migration->src.port = port ? port : 6379;
+	migration->src.password = password ? password : "";
+	migration->src.db = db;
+}
 
-    value = result;
-	return OK;
+void RedicMigrator::destination(const char *host, short port, const char *password, int db)
+{
+	migration->dst.host = host ? host : "localhost";
+	migration->dst.port = port ? port : 6379;
+	migration->dst.password = password ? password : "";
+	migration->dst.db = db;
 }
 
-int Redic::move(const char *key, int index)
+int RedicMigrator::run(const char *pattern)
 {
-    Request req(3);
-    req.append("MOVE");
-    req.append(key);
-    req.append(index);
+	RedicMigration &m = *migration;
+	RedicEntity scan;
 
-	int result;
+	{
+		RedicGuard guard(m.lock);
+		m.reset();
+	}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+	int rc = RedicMigration::open(scan, m.src);
 
-	if (result == 0)
-		return RECORD_NUL;
+	if (rc != Redic::OK)
+		return rc;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+	std::list<RedicThread> threads;
 
-	return OK;
-}
+	for (int i=0; i<m.workers; i++)
+	{
+		threads.push_back(RedicThread());
 
-int Redic::append(const char *key, const char *value, int &length)
-{
-    Request req(3);
-    req.append("APPEND");
-    req.append(key);
-    req.append(value);
+		if (!threads.back().start(RedicMigration::run, &m))
+		{
+			m.abort(Redic::CONNECT_ERR, "fail to start worker");
+			break;
+		}
+	}
+
+	string cursor = "0";
+	Redic::Reply reply;
+	Redic::List keys;
+
+	do
+	{
+		Request req(6);
+		req.append("SCAN");
+		req.append(cursor);
+		req.append("MATCH");
+		req.append(pattern);
+		req.append("COUNT");
+		req.append(m.batch);
+
+		if (scan.operate_reply(reply, req) != Redic::OK || reply.count() != 2)
+		{
+			m.abort(scan.errnum() != Redic::OK ? scan.errnum() : Redic::SYNTAX_ERR, "fail to scan");
+			break;
+		}
 
-	int result;
+		cursor = reply.str(reply.child(0, 0));
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+		int list = reply.child(0, 1);
+		int node = reply.first(list);
 
-    if (result < 0)
-        return SYNTAX_ERR;
+		keys.clear();
 
-    length = result;
-	return OK;
-}
+		bool ok = true;
 
-int Redic::set(const char *key, const char *value)
-{
-    Request req(3);
-    req.append("SET");
-    req.append(key);
-    req.append(value);
+		//COUNT is only a hint, a SCAN may return more than a batch
+		for (int i=0; ok && i<reply.count(list); i++, node=reply.next(node))
+		{
+			keys.push_back(reply.str(node));
 
-	string result;
+			if ((int)keys.size() == m.batch)
+			{
+				ok = m.put(keys);
+				keys.clear();
+			}
+		}
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+		if (!ok || (!keys.empty() && !m.put(keys)))
+			break;
+	} while (cursor != "0");
 
-	if (result != "OK")
-		return SYNTAX_ERR;
+	{
+		RedicGuard guard(m.lock);
+		m.done = true;
+		m.changed.broadcast();
+	}
 
-	return OK;
+	for (std::list<RedicThread>::iterator it=threads.begin(); it!=threads.end(); it++)
+		it->join();
+
+	RedicGuard guard(m.lock);
+	return m.rc;
 }
 
-int Redic::get(const char *key, string &value)
+int64_t RedicMigrator::scanned()
 {
-    Request req(2);
-    req.append("GET");
-    req.append(key);
+	RedicGuard guard(migration->lock);
+	return migration->scanned;
+}
 
-	if (entity->operate_bulk(value, req) != OK)
-		return entity->errnum();
+int64_t RedicMigrator::migrated()
+{
+	RedicGuard guard(migration->lock);
+	return migration->migrated;
+}
 
-	return OK;
+int64_t RedicMigrator::skipped()
+{
+	RedicGuard guard(migration->lock);
+	return migration->skipped;
 }
 
-int Redic::getset(const char *key, const char *value, string &old_val)
+int64_t RedicMigrator::failed()
 {
-    Request req(3);
-    req.append("GETSET");
-    req.append(key);
-    req.append(value);
+	RedicGuard guard(migration->lock);
+	return migration->failed;
+}
 
-	if (entity->operate_bulk(old_val, req) != OK)
-		return entity->errnum();
+int64_t RedicMigrator::bytes()
+{
+	RedicGuard guard(migration->lock);
+	return migration->bytes;
+}
 
-    return OK;
+int RedicMigrator::first_error(string &message)
+{
+	RedicGuard guard(migration->lock);
+	message = migration->message;
+	return migration->rc;
 }
 
-int Redic::setex(const char *key, int secs, const char *value)
+
+///State of a replica connection. The stream goes through states: the reply
+///to PSYNC, the size of the RDB, the RDB, then the commands, one at a time.
+class RedicReplication
 {
-    Request req(4);
-    req.append("SETEX");
-    req.append(key);
-    req.append(secs);
-    req.append(value);
+public:
+    enum State
+    {
+        REPL_IDLE,
+        REPL_REPLY,
+        REPL_SIZE,
+        REPL_RDB,
+        REPL_STREAM,
+    };
+
+    RedicEntity link;
+    RedicReplica::Handler &handler;
+    std::vector<char> buffer;
+
+    State state;
+    string line;
+    int64_t left;
+    string mark;
+    string tail;
+
+    string id;
+    int64_t reached;
+    int64_t pending;
+    int64_t acked;
+
+    Redic::Parser parser;
+    Redic::Reply reply;
+
+    RedicReplication(RedicReplica::Handler &h, int size)
+        : handler(h), buffer(size > 4096 ? size : 4096)
+    {
+        state = REPL_IDLE;
+        left = 0;
+        reached = -1;
+        pending = 0;
+        acked = 0;
+    }
 
-    string result;
+    //read a line ending with CRLF, a bare LF being the keep-alive of the primary
+    bool take_line(const char *data, int len, int &pos)
+    {
+        while (pos < len)
+        {
+            char c = data[pos++];
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+            if (c == '\n')
+            {
+                if (line.empty())
+                    continue;
 
-    if (result != "OK")
-        return SYNTAX_ERR;
+                return true;
+            }
 
-    return OK;
-}
+            if (c != '\r')
+                line += c;
+        }
 
-int Redic::setnx(const char *key, const char *value)
-{
-    Request req(3);
-    req.append("SETNX");
-    req.append(key);
-    req.append(value);
+        return false;
+    }
 
-    int result;
+    //hand over the RDB up to its end, given by its size or by its EOF mark
+    bool take_rdb(const char *data, int len, int &pos)
+    {
+        if (mark.empty())
+        {
+            int num = left < len-pos ? (int)left : len-pos;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+            if (num > 0)
+                handler.snapshot(data+pos, num);
 
-    if (result == 0)
-        return RECORD_NUL;
+            pos += num;
+            left -= num;
+            return left == 0;
+        }
 
-    if (result != 1)
-        return SYNTAX_ERR;
+        //keep back what may be the start of the mark
+        tail.append(data+pos, len-pos);
+        pos = len;
 
-    return OK;
-}
+        size_t end = tail.find(mark);
 
-int Redic::strlen(const char *key, int &length)
-{
-    Request req(2);
-    req.append("STRLEN");
-    req.append(key);
+        if (end != string::npos)
+        {
+            if (end > 0)
+                handler.snapshot(tail.data(), end);
+
+            //the stream starts right after the mark
+            int rest = tail.length() - end - mark.length();
+            pos = len - rest;
+            tail.clear();
+            return true;
+        }
 
-    int result;
+        if (tail.length() > mark.length())
+        {
+            int num = tail.length() - mark.length();
+            handler.snapshot(tail.data(), num);
+            tail.erase(0, num);
+        }
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        return false;
+    }
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    //consume data, return the number of commands, or an error as a negative
+    int consume(const char *data, int len)
+    {
+        int count = 0;
+        int pos = 0;
 
-    length = result;
-	return OK;
-}
+        while (pos < len)
+        {
+            switch (state)
+            {
+            case REPL_IDLE:
+                return -Redic::SYNTAX_ERR;
+
+            case REPL_REPLY:
+                if (!take_line(data, len, pos))
+                    break;
+
+                if (line.compare(0, 12, "+FULLRESYNC ") == 0)
+                {
+                    size_t sp = line.find(' ', 12);
+
+                    if (sp == string::npos)
+                        return -Redic::SYNTAX_ERR;
+
+                    id = line.substr(12, sp-12);
+
+                    if (!parse_int(line.substr(sp+1), reached))
+                        return -Redic::SYNTAX_ERR;
+
+                    handler.resync(id, reached);
+                    state = REPL_SIZE;
+                }
+                else if (line.compare(0, 9, "+CONTINUE") == 0)
+                {
+                    //the primary may have taken a new id, e.g. after a failover
+                    if (line.length() > 10)
+                        id = line.substr(10);
+
+                    parser.reset(reply);
+                    state = REPL_STREAM;
+                }
+                else
+                {
+                    return line[0] == '-' ? -Redic::SERVER_ERR : -Redic::SYNTAX_ERR;
+                }
+
+                line.clear();
+                break;
+
+            case REPL_SIZE:
+                if (!take_line(data, len, pos))
+                    break;
+
+                //$<size>, or $EOF:<40 bytes> for a diskless sync
+                if (line.compare(0, 5, "$EOF:") == 0)
+                {
+                    mark = line.substr(5);
+                    left = 0;
+                }
+                else if (line[0] == '$' && parse_int(line.substr(1), left) && left >= 0)
+                {
+                    mark.clear();
+                }
+                else
+                {
+                    return -Redic::SYNTAX_ERR;
+                }
+
+                tail.clear();
+                line.clear();
+                state = REPL_RDB;
+
+                if (mark.empty() && left == 0)
+                {
+                    parser.reset(reply);
+                    state = REPL_STREAM;
+                }
+
+                break;
+
+            case REPL_RDB:
+                if (take_rdb(data, len, pos))
+                {
+                    parser.reset(reply);
+                    state = REPL_STREAM;
+                }
+
+                break;
+
+            case REPL_STREAM:
+            {
+                int used = parser.feed(data+pos, len-pos);
 
-int Redic::substr(const char *key, int start, int end, string &value)
-{
-    Request req(4);
-    req.append("SUBSTR");
-    req.append(key);
-    req.append(start);
-    req.append(end);
+                if (used < 0)
+                    return -Redic::SYNTAX_ERR;
 
-	if (entity->operate_bulk(value, req) != OK)
-		return entity->errnum();
+                pos += used;
+                pending += used;
 
-    return OK;
-}
+                //the offset moves by whole commands, so that a resume never
+                //starts inside one
+                if (!parser.done())
+                    break;
 
-int Redic::mget(const List &keys, List &values)
-{
-    Request req(1+keys.size());
-    req.append("MGET");
+                reached += pending;
+                pending = 0;
+                handler.command(reply, reached);
+                parser.reset(reply);
+                count++;
+                break;
+            }
+            }
+        }
 
-	for(List::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+        return count;
+    }
 
-	if (entity->operate_list(values, req) != OK)
-		return entity->errnum();
+    int ack()
+    {
+        Request req(3);
+        req.append("REPLCONF");
+        req.append("ACK");
+        req.append(reached);
 
-    return OK;
-}
+        acked = redic_clock();
+        return send_all(link.handle(), req.str(), req.len());
+    }
+};
 
-int Redic::incr(const char *key, int &new_val)
+RedicReplica::RedicReplica(Handler &handler, int buffer)
+	: repl(new RedicReplication(handler, buffer))
 {
-    Request req(2);
-    req.append("INCR");
-    req.append(key);
-
-	if (entity->operate_int(new_val, req) != OK)
-		return entity->errnum();
+}
 
-    return OK;
+RedicReplica::~RedicReplica()
+{
+	delete repl;
 }
 
-int Redic::incrby(const char *key, int increment, int &new_val)
+int RedicReplica::connect(const char *host, short port, const char *password)
 {
-    Request req(3);
-    req.append("INCRBY");
-    req.append(key);
-    req.append(increment);
+    host = host ? host : "localhost";
+    port = port ? port : 6379;
 
-	if (entity->operate_int(new_val, req) != OK)
-		return entity->errnum();
+	repl->state = RedicReplication::REPL_IDLE;
 
-    return OK;
-}
+	if (repl->link.conn(host, port) != Redic::OK)
+		return repl->link.errnum();
 
-int Redic::decr(const char *key, int &new_val)
-{
-    Request req(2);
-    req.append("DECR");
-    req.append(key);
+	string result;
 
-	if (entity->operate_int(new_val, req) != OK)
-		return entity->errnum();
+	if (password)
+	{
+		Request req(2);
+		req.append("AUTH");
+		req.append(password);
 
-    return OK;
-}
+		if (repl->link.operate_inline(result, req) != Redic::OK)
+			return repl->link.errnum();
+	}
 
-int Redic::decrby(const char *key, int decrement, int &new_val)
-{
-    Request req(3);
-    req.append("DECRBY");
-    req.append(key);
-    req.append(decrement);
+	//the RDB may come without a size, ended by a mark
+	Request capa(5);
+	capa.append("REPLCONF");
+	capa.append("capa");
+	capa.append("eof");
+	capa.append("capa");
+	capa.append("psync2");
 
-	if (entity->operate_int(new_val, req) != OK)
-		return entity->errnum();
+	if (repl->link.operate_inline(result, capa) != Redic::OK)
+		return repl->link.errnum();
 
-    return OK;
+	return Redic::OK;
 }
 
-int Redic::rpush(const char *key, const char *element, int &length)
+void RedicReplica::resume(const char *replid, int64_t offset)
 {
-    Request req(3);
-    req.append("RPUSH");
-    req.append(key);
-    req.append(element);
+	repl->id = replid ? replid : "";
+	repl->reached = replid ? offset : -1;
+}
 
-    int result;
+int RedicReplica::sync()
+{
+	Request req(3);
+	req.append("PSYNC");
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+	if (repl->id.empty() || repl->reached < 0)
+	{
+		req.append("?");
+		req.append(-1);
+	}
+	else
+	{
+		req.append(repl->id);
+		req.append(repl->reached + 1);
+	}
 
-    if (result < 0)
-        return SYNTAX_ERR;
+	//a command cut by the disconnection is sent again in full
+	repl->line.clear();
+	repl->pending = 0;
+	repl->parser.reset(repl->reply);
+	repl->state = RedicReplication::REPL_REPLY;
+	repl->acked = redic_clock();
 
-    length = result;
-	return OK;
+	return send_all(repl->link.handle(), req.str(), req.len());
 }
 
-int Redic::rpushx(const char *key, const char *element, int &length)
+int RedicReplica::poll(int wait)
 {
-    Request req(3);
-    req.append("RPUSHX");
-    req.append(key);
-    req.append(element);
+	if (repl->state == RedicReplication::REPL_IDLE)
+		return -Redic::CONNECT_ERR;
 
-    int result;
+	int fd = repl->link.handle();
+	char *buf = &repl->buffer[0];
+	int count = 0;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+	while (true)
+	{
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		timeval tv = {wait/1000, (wait%1000)*1000};
 
-    if (result < 0)
-        return SYNTAX_ERR;
+		int rc = select(fd+1, &fds, NULL, NULL, &tv);
 
-    length = result;
-	return OK;
-}
+		if (rc < 0)
+			return -Redic::CONNECT_ERR;
 
-int Redic::lpush(const char *key, const char *element, int &length)
-{
-    Request req(3);
-    req.append("LPUSH");
-    req.append(key);
-    req.append(element);
+		if (rc == 0)
+			break;
 
-    int result;
+		int len = recv(fd, buf, repl->buffer.size(), 0);
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+		if (len <= 0)
+			return -Redic::CONNECT_ERR;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+		int num = repl->consume(buf, len);
 
-    length = result;
-	return OK;
+		if (num < 0)
+			return num;
+
+		count += num;
+		wait = 0;
+	}
+
+	//the primary drops a replica silent for too long
+	if (repl->state == RedicReplication::REPL_STREAM && redic_clock() - repl->acked >= 1000
+		&& repl->ack() != Redic::OK)
+		return -Redic::CONNECT_ERR;
+
+	return count;
 }
 
-int Redic::lpushx(const char *key, const char *element, int &length)
+const string &RedicReplica::replid()
 {
-    Request req(3);
-    req.append("LPUSHX");
-    req.append(key);
-    req.append(element);
+	return repl->id;
+}
+
+int64_t RedicReplica::offset()
+{
+	return repl->reached;
+}
+
+
+
+//types of values and opcodes of an RDB file
+const int RDB_STRING            = 0;
+const int RDB_LIST              = 1;
+const int RDB_SET               = 2;
+const int RDB_ZSET              = 3;
+const int RDB_HASH              = 4;
+const int RDB_ZSET_2            = 5;
+const int RDB_MODULE_2          = 7;
+const int RDB_LIST_ZIPLIST      = 10;
+const int RDB_SET_INTSET        = 11;
+const int RDB_ZSET_ZIPLIST      = 12;
+const int RDB_HASH_ZIPLIST      = 13;
+const int RDB_LIST_QUICKLIST    = 14;
+const int RDB_STREAM            = 15;
+const int RDB_HASH_LISTPACK     = 16;
+const int RDB_ZSET_LISTPACK     = 17;
+const int RDB_LIST_QUICKLIST_2  = 18;
+const int RDB_STREAM_2          = 19;
+const int RDB_SET_LISTPACK      = 20;
+const int RDB_STREAM_3          = 21;
+
+const int RDB_SLOT_INFO         = 0xf4;
+const int RDB_FUNCTION2         = 0xf5;
+const int RDB_MODULE_AUX        = 0xf7;
+const int RDB_IDLE              = 0xf8;
+const int RDB_FREQ              = 0xf9;
+const int RDB_AUX               = 0xfa;
+const int RDB_RESIZEDB          = 0xfb;
+const int RDB_EXPIRETIME_MS     = 0xfc;
+const int RDB_EXPIRETIME        = 0xfd;
+const int RDB_SELECTDB          = 0xfe;
+const int RDB_EOF               = 0xff;
+
+///Cursor over the bytes of an RDB file, or of a value in it.
+struct RdbIn
+{
+    const unsigned char *p;
+    const unsigned char *end;
+};
 
-    int result;
+///Receiver of the elements of a value, each valid during the call only.
+///It returns false to stop, keeping why in rc.
+class RdbSink
+{
+public:
+    int rc;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    RdbSink() : rc(Redic::OK) {}
+    virtual ~RdbSink() {}
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    virtual bool item(const char *data, int len) = 0;
+};
 
-    length = result;
-	return OK;
+static bool rdb_raw(RdbIn &in, int64_t num, const unsigned char *&data)
+{
+    if (num < 0 || in.end - in.p < num)
+        return false;
+
+    data = in.p;
+    in.p += num;
+    return true;
 }
 
-int Redic::lpop(const char *key, string &element)
+static uint64_t rdb_le(const unsigned char *p, int num)
 {
-    Request req(2);
-    req.append("LPOP");
-    req.append(key);
+    uint64_t val = 0;
 
-	if (entity->operate_bulk(element, req) != OK)
-		return entity->errnum();
+    for (int i=num-1; i>=0; i--)
+        val = (val << 8) | p[i];
 
-	return OK;
+    return val;
 }
 
-int Redic::rpop(const char *key, string &element)
+static uint64_t rdb_be(const unsigned char *p, int num)
 {
-    Request req(2);
-    req.append("RPOP");
-    req.append(key);
+    uint64_t val = 0;
 
-	if (entity->operate_bulk(element, req) != OK)
-		return entity->errnum();
+    for (int i=0; i<num; i++)
+        val = (val << 8) | p[i];
 
-	return OK;
+    return val;
 }
 
-int Redic::llen(const char *key, int &length)
+//a little endian integer of num bytes, sign extended
+static int64_t rdb_int(const unsigned char *p, int num)
 {
-    Request req(2);
-    req.append("LLEN");
-    req.append(key);
+    int shift = 64 - num*8;
+    return (int64_t)(rdb_le(p, num) << shift) >> shift;
+}
 
-    int result;
+//a length, or the kind of a special string if encoded is given
+static bool rdb_length(RdbIn &in, uint64_t &len, bool *encoded = NULL)
+{
+    const unsigned char *b;
+    const unsigned char *n;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    if (!rdb_raw(in, 1, b))
+        return false;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    if (encoded)
+        *encoded = false;
 
-    length = result;
-	return OK;
+    switch (*b >> 6)
+    {
+    case 0:
+        len = *b & 0x3f;
+        return true;
+
+    case 1:
+        if (!rdb_raw(in, 1, n))
+            return false;
+
+        len = ((uint64_t)(*b & 0x3f) << 8) | *n;
+        return true;
+
+    case 2:
+        if ((*b != 0x80 && *b != 0x81) || !rdb_raw(in, *b == 0x80 ? 4 : 8, n))
+            return false;
+
+        len = rdb_be(n, *b == 0x80 ? 4 : 8);
+        return true;
+
+    default:
+        if (!encoded)
+            return false;
+
+        *encoded = true;
+        len = *b & 0x3f;
+        return true;
+    }
 }
 
-int Redic::lrange(const char *key, int start, int range, List &elements)
+//the number of items to follow, each taking a byte at least
+static bool rdb_count(RdbIn &in, int64_t &num)
 {
-    Request req(4);
-    req.append("LRANGE");
-    req.append(key);
-    req.append(start);
-    req.append(range);
+    uint64_t len;
 
-	if (entity->operate_list(elements, req) != OK)
-		return entity->errnum();
+    if (!rdb_length(in, len) || len > (uint64_t)(in.end - in.p))
+        return false;
 
-	return OK;
+    num = (int64_t)len;
+    return true;
 }
 
-int Redic::ltrim(const char *key, int start, int end)
+static bool lzf_expand(const unsigned char *ip, int in_len, char *out, int out_len)
 {
-    Request req(4);
-    req.append("LTRIM");
-    req.append(key);
-    req.append(start);
-    req.append(end);
+    const unsigned char *in_end = ip + in_len;
+    char *op = out;
+    char *out_end = out + out_len;
 
-    string result;
+    while (ip < in_end)
+    {
+        unsigned int ctrl = *ip++;
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+        //a literal run of ctrl+1 bytes
+        if (ctrl < 32)
+        {
+            ctrl++;
 
-    if (result != "OK")
-        return SYNTAX_ERR;
+            if (out_end - op < (int)ctrl || in_end - ip < (int)ctrl)
+                return false;
 
-	return OK;
-}
+            memcpy(op, ip, ctrl);
+            op += ctrl;
+            ip += ctrl;
+            continue;
+        }
 
-int Redic::lset(const char *key, int index, const char *element)
-{
-    Request req(4);
-    req.append("LSET");
-    req.append(key);
-    req.append(index);
-    req.append(element);
+        //a back reference, which may overlap what it writes
+        unsigned int len = ctrl >> 5;
 
-    string result;
+        if (ip >= in_end)
+            return false;
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+        if (len == 7)
+        {
+            len += *ip++;
 
-    if (result != "OK")
-        return SYNTAX_ERR;
+            if (ip >= in_end)
+                return false;
+        }
 
-	return OK;
-}
+        const char *ref = op - ((ctrl & 0x1f) << 8) - 1 - *ip++;
+        len += 2;
 
-int Redic::lindex(const char *key, int index, string &element)
-{
-    Request req(3);
-    req.append("LINDEX");
-    req.append(key);
-    req.append(index);
+        if (ref < out || out_end - op < (int)len)
+            return false;
 
-	if (entity->operate_bulk(element, req) != OK)
-		return entity->errnum();
+        while (len-- > 0)
+            *op++ = *ref++;
+    }
 
-	return OK;
+    return op == out_end;
 }
 
-///count > 0: Remove elements from head to tail.
-///count < 0: Remove elements from tail to head.
-///count = 0: Remove all elements.
-int Redic::lrem(const char *key, int count, const char *element, int &length)
+//a string: a view of the file if stored as is, or else decoded into buf;
+//only skipped if buf is NULL
+static bool rdb_string(RdbIn &in, const char *&data, int &len, string *buf)
 {
-    Request req(4);
-    req.append("LREM");
-    req.append(key);
-    req.append(count);
-    req.append(element);
+    uint64_t num;
+    bool encoded;
+    const unsigned char *raw;
 
-    int result;
+    if (!rdb_length(in, num, &encoded))
+        return false;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    if (!encoded)
+    {
+        if (num > INT_MAX || !rdb_raw(in, num, raw))
+            return false;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+        data = (const char *)raw;
+        len = (int)num;
+        return true;
+    }
 
-    length = result;
-	return OK;
-}
+    //an integer of 1, 2 or 4 bytes
+    if (num <= 2)
+    {
+        int size = 1 << num;
 
-int Redic::sadd(const char *key, const char *member)
-{
-    Request req(3);
-    req.append("SADD");
-    req.append(key);
-    req.append(member);
+        if (!rdb_raw(in, size, raw))
+            return false;
 
-    int result;
+        if (buf)
+        {
+            buf->resize(24);
+            len = redic_itoa(rdb_int(raw, size), &(*buf)[0]);
+            data = buf->data();
+        }
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        return true;
+    }
 
-    if (result == 0)
-        return RECORD_NUL;
+    //compressed with LZF
+    uint64_t clen;
+    uint64_t ulen;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+    if (num != 3 || !rdb_length(in, clen) || !rdb_length(in, ulen)
+        || clen > INT_MAX || ulen >= INT_MAX || !rdb_raw(in, clen, raw))
+        return false;
 
-	return OK;
+    if (buf)
+    {
+        buf->resize(ulen + 1);
+
+        if (!lzf_expand(raw, (int)clen, &(*buf)[0], (int)ulen))
+            return false;
+
+        (*buf)[ulen] = '\0';
+        data = buf->data();
+        len = (int)ulen;
+    }
+
+    return true;
 }
 
-int Redic::srem(const char *key, const char *member)
+static bool rdb_ziplist(const char *data, int len, RdbSink &sink)
 {
-    Request req(3);
-    req.append("SREM");
-    req.append(key);
-    req.append(member);
-
-    int result;
+    const unsigned char *p = (const unsigned char *)data + 10;
+    const unsigned char *end = (const unsigned char *)data + len;
+    char num[24];
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    if (len < 11)
+        return false;
 
-    if (result == 0)
-        return RECORD_NUL;
+    while (p < end && *p != 0xff)
+    {
+        //the length of the previous entry
+        p += *p < 254 ? 1 : 5;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+        if (p >= end)
+            return false;
 
-	return OK;
-}
+        unsigned char enc = *p;
+        int64_t slen = -1;
+        int64_t val = 0;
 
-int Redic::spop(const char *key, string &value)
-{
-    Request req(2);
-    req.append("SPOP");
-    req.append(key);
+        switch (enc >> 6)
+        {
+        case 0:
+            slen = enc & 0x3f;
+            p += 1;
+            break;
 
-	if (entity->operate_bulk(value, req) != OK)
-		return entity->errnum();
+        case 1:
+            if (end - p < 2)
+                return false;
 
-	return OK;
-}
+            slen = ((enc & 0x3f) << 8) | p[1];
+            p += 2;
+            break;
 
-int Redic::smove(const char *srckey, const char *destkey, const char *member)
-{
-    Request req(4);
-    req.append("SMOVE");
-    req.append(srckey);
-    req.append(destkey);
-    req.append(member);
+        case 2:
+            if (end - p < 5)
+                return false;
 
-    int result;
+            slen = rdb_be(p+1, 4);
+            p += 5;
+            break;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        default:
+        {
+            int size = enc == 0xc0 ? 2 : enc == 0xd0 ? 4 : enc == 0xe0 ? 8 :
+                       enc == 0xf0 ? 3 : enc == 0xfe ? 1 : 0;
+            p += 1;
 
-    if (result == 0)
-        return RECORD_NUL;
+            if (end - p < size)
+                return false;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+            //0 to 12 in the encoding itself
+            if (size == 0 && (enc < 0xf1 || enc > 0xfd))
+                return false;
 
-	return OK;
-}
+            val = size == 0 ? (enc & 0x0f) - 1 : rdb_int(p, size);
+            p += size;
+        }
+        }
 
-int Redic::scard(const char *key, int &length)
-{
-    Request req(2);
-    req.append("SCARD");
-    req.append(key);
+        if (slen < 0)
+        {
+            if (!sink.item(num, redic_itoa(val, num)))
+                return false;
 
-    int result;
+            continue;
+        }
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        if (end - p < slen || !sink.item((const char *)p, (int)slen))
+            return false;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+        p += slen;
+    }
 
-    length = result;
-	return OK;
+    return true;
 }
 
-int Redic::sismember(const char *key, const char *member)
+static bool rdb_listpack(const char *data, int len, RdbSink &sink)
 {
-    Request req(3);
-    req.append("SISMEMBER");
-    req.append(key);
-    req.append(member);
+    const unsigned char *p = (const unsigned char *)data + 6;
+    const unsigned char *end = (const unsigned char *)data + len;
+    char num[24];
 
-    int result;
+    if (len < 7)
+        return false;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    while (p < end && *p != 0xff)
+    {
+        unsigned char b = *p;
+        const unsigned char *str = NULL;
+        int64_t slen = 0;
+        int64_t val = 0;
+        int64_t size;
 
-    if (result == 0)
-        return RECORD_NUL;
+        if ((b & 0x80) == 0)
+        {
+            val = b & 0x7f;
+            size = 1;
+        }
+        else if ((b & 0xc0) == 0x80)
+        {
+            slen = b & 0x3f;
+            str = p + 1;
+            size = 1 + slen;
+        }
+        else if ((b & 0xe0) == 0xc0)
+        {
+            if (end - p < 2)
+                return false;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+            //13 bits, signed
+            val = ((b & 0x1f) << 8) | p[1];
+            val = val >= 4096 ? val - 8192 : val;
+            size = 2;
+        }
+        else if ((b & 0xf0) == 0xe0)
+        {
+            if (end - p < 2)
+                return false;
 
-	return OK;
-}
+            slen = ((b & 0x0f) << 8) | p[1];
+            str = p + 2;
+            size = 2 + slen;
+        }
+        else if (b == 0xf0)
+        {
+            if (end - p < 5)
+                return false;
 
-int Redic::sinter(const Set &keys, Set &members)
-{
-    Request req(1+keys.size());
-    req.append("SINTER");
+            slen = rdb_le(p+1, 4);
+            str = p + 5;
+            size = 5 + slen;
+        }
+        else if (b >= 0xf1 && b <= 0xf4)
+        {
+            int n = b == 0xf1 ? 2 : b == 0xf2 ? 3 : b == 0xf3 ? 4 : 8;
 
-	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+            if (end - p < 1 + n)
+                return false;
 
-	if (entity->operate_set(members, req) != OK)
-		return entity->errnum();
+            val = rdb_int(p+1, n);
+            size = 1 + n;
+        }
+        else
+        {
+            return false;
+        }
+
+        //each entry ends with its own length, to walk back, as lpEncodeBacklen() sizes it
+        int back = size < 128 ? 1 : size < 16383 ? 2 : size < 2097151 ? 3 : size < 268435455 ? 4 : 5;
+
+        if (end - p < size + back)
+            return false;
+
+        if (str ? !sink.item((const char *)str, (int)slen) : !sink.item(num, redic_itoa(val, num)))
+            return false;
+
+        p += size + back;
+    }
 
-    return OK;
+    return true;
 }
 
-int Redic::sinterstore(const char *destkey, const Set &keys, int &length)
+static bool rdb_intset(const char *data, int len, RdbSink &sink)
 {
-    Request req(2+keys.size());
-    req.append("SINTERSTORE");
-    req.append(destkey);
+    const unsigned char *p = (const unsigned char *)data;
+    char num[24];
 
-	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+    if (len < 8)
+        return false;
 
-    int result;
+    int size = (int)rdb_le(p, 4);
+    uint64_t count = rdb_le(p+4, 4);
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    if ((size != 2 && size != 4 && size != 8) || count*size > (uint64_t)(len - 8))
+        return false;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    for (uint64_t i=0; i<count; i++)
+    {
+        if (!sink.item(num, redic_itoa(rdb_int(p + 8 + i*size, size), num)))
+            return false;
+    }
 
-    length = result;
-    return OK;
+    return true;
 }
 
-int Redic::sunion(const Set &keys, Set &members)
+//the values of a module, typed by opcodes up to the end one
+static bool rdb_module(RdbIn &in)
 {
-    Request req(1+keys.size());
-    req.append("SUNION");
-
-	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+    const unsigned char *raw;
+    const char *data;
+    uint64_t len;
+    int size;
 
-	if (entity->operate_set(members, req) != OK)
-		return entity->errnum();
+    while (true)
+    {
+        if (!rdb_length(in, len))
+            return false;
 
-    return OK;
+        switch (len)
+        {
+        case 0:
+            return true;
+
+        case 1:
+        case 2:
+            if (!rdb_length(in, len))
+                return false;
+            break;
+
+        case 3:
+        case 4:
+            if (!rdb_raw(in, len == 3 ? 4 : 8, raw))
+                return false;
+            break;
+
+        case 5:
+            if (!rdb_string(in, data, size, NULL))
+                return false;
+            break;
+
+        default:
+            return false;
+        }
+    }
 }
 
-int Redic::sunionstore(const char *destkey, const Set &keys, int &length)
+static bool rdb_stream(RdbIn &in, int kind)
 {
-    Request req(2+keys.size());
-    req.append("SUNIONSTORE");
-    req.append(destkey);
+    const unsigned char *raw;
+    const char *data;
+    uint64_t len;
+    int64_t num;
+    int size;
+
+    //the listpacks of entries, each under its master id
+    if (!rdb_count(in, num))
+        return false;
 
-	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+    for (int64_t i=0; i<num; i++)
+    {
+        if (!rdb_string(in, data, size, NULL) || !rdb_string(in, data, size, NULL))
+            return false;
+    }
 
-    int result;
+    //the length and last id, then the first id, max deleted id and entries added
+    for (int i=0; i<(kind == RDB_STREAM ? 3 : 8); i++)
+    {
+        if (!rdb_length(in, len))
+            return false;
+    }
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    int64_t groups;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    if (!rdb_count(in, groups))
+        return false;
 
-    length = result;
-    return OK;
-}
+    for (int64_t g=0; g<groups; g++)
+    {
+        if (!rdb_string(in, data, size, NULL) || !rdb_length(in, len) || !rdb_length(in, len))
+            return false;
 
-int Redic::sdiff(const Set &keys, Set &members)
-{
-    Request req(1+keys.size());
-    req.append("SDIFF");
+        if (kind != RDB_STREAM && !rdb_length(in, len))
+            return false;
 
-	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+        //pending entries: id, delivery time and count
+        if (!rdb_count(in, num))
+            return false;
 
-	if (entity->operate_set(members, req) != OK)
-		return entity->errnum();
+        for (int64_t i=0; i<num; i++)
+        {
+            if (!rdb_raw(in, 24, raw) || !rdb_length(in, len))
+                return false;
+        }
 
-    return OK;
+        int64_t consumers;
+
+        if (!rdb_count(in, consumers))
+            return false;
+
+        for (int64_t c=0; c<consumers; c++)
+        {
+            if (!rdb_string(in, data, size, NULL) || !rdb_raw(in, kind == RDB_STREAM_3 ? 16 : 8, raw))
+                return false;
+
+            if (!rdb_count(in, num) || !rdb_raw(in, num*16, raw))
+                return false;
+        }
+    }
+
+    return true;
 }
 
-int Redic::sdiffstore(const char *destkey, const Set &keys, int &length)
+//walk a value, handing its elements to sink, or only skipping it if NULL
+static bool rdb_value(RdbIn &in, int kind, RdbSink *sink)
 {
-    Request req(2+keys.size());
-    req.append("SDIFFSTORE");
-    req.append(destkey);
+    string buf;
+    string *scratch = sink ? &buf : NULL;
+    const unsigned char *raw;
+    const char *data;
+    uint64_t len;
+    int64_t num;
+    int size;
+
+    switch (kind)
+    {
+    case RDB_STRING:
+        return rdb_string(in, data, size, scratch) && (!sink || sink->item(data, size));
 
-	for(Set::const_iterator it=keys.begin(); it!=keys.end(); it++)
-        req.append(*it);
+    case RDB_LIST:
+    case RDB_SET:
+    case RDB_HASH:
+        if (!rdb_count(in, num))
+            return false;
 
-    int result;
+        for (int64_t i=0; i<(kind == RDB_HASH ? num*2 : num); i++)
+        {
+            if (!rdb_string(in, data, size, scratch) || (sink && !sink->item(data, size)))
+                return false;
+        }
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        return true;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    case RDB_ZSET:
+    case RDB_ZSET_2:
+        if (!rdb_count(in, num))
+            return false;
 
-    length = result;
-    return OK;
-}
+        for (int64_t i=0; i<num; i++)
+        {
+            if (!rdb_string(in, data, size, scratch) || (sink && !sink->item(data, size)))
+                return false;
 
-int Redic::smembers(const char *key, Set &members)
-{
-    Request req(2);
-    req.append("SMEMBERS");
-    req.append(key);
+            char score[32];
 
-	if (entity->operate_set(members, req) != OK)
-		return entity->errnum();
+            //a binary double, or its text after a byte of length
+            if (kind == RDB_ZSET_2)
+            {
+                if (!rdb_raw(in, 8, raw))
+                    return false;
+
+                uint64_t bits = rdb_le(raw, 8);
+                double val;
+                memcpy(&val, &bits, sizeof(val));
+                size = redic_dtoa(val, score);
+                data = score;
+            }
+            else
+            {
+                if (!rdb_raw(in, 1, raw))
+                    return false;
 
-	return OK;
-}
+                size = *raw;
+                data = size == 253 ? "nan" : size == 254 ? "inf" : "-inf";
 
-int Redic::srandmember(const char *key, string &member)
-{
-    Request req(2);
-    req.append("SRANDMEMBER");
-    req.append(key);
+                if (size < 253 && !rdb_raw(in, size, raw))
+                    return false;
 
-	if (entity->operate_bulk(member, req) != OK)
-		return entity->errnum();
+                if (size < 253)
+                    data = (const char *)raw;
+                else
+                    size = strlen(data);
+            }
 
-	return OK;
-}
+            if (sink && !sink->item(data, size))
+                return false;
+        }
 
-int Redic::zadd(const char *key, double score, const char *member)
-{
-    Request req(4);
-    req.append("ZADD");
-    req.append(key);
-    req.append(score);
-    req.append(member);
+        return true;
 
-    int result;
+    case RDB_LIST_ZIPLIST:
+    case RDB_ZSET_ZIPLIST:
+    case RDB_HASH_ZIPLIST:
+        return rdb_string(in, data, size, scratch) && (!sink || rdb_ziplist(data, size, *sink));
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    case RDB_SET_LISTPACK:
+    case RDB_ZSET_LISTPACK:
+    case RDB_HASH_LISTPACK:
+        return rdb_string(in, data, size, scratch) && (!sink || rdb_listpack(data, size, *sink));
 
-    if (result != 0 && result != 1)
-        return SYNTAX_ERR;
+    case RDB_SET_INTSET:
+        return rdb_string(in, data, size, scratch) && (!sink || rdb_intset(data, size, *sink));
 
-	return OK;
-}
+    case RDB_LIST_QUICKLIST:
+    case RDB_LIST_QUICKLIST_2:
+        if (!rdb_count(in, num))
+            return false;
 
-int Redic::zrem(const char *key, const char *member)
-{
-    Request req(3);
-    req.append("ZREM");
-    req.append(key);
-    req.append(member);
+        for (int64_t i=0; i<num; i++)
+        {
+            //a node of a single large element, or of a packed list
+            len = 2;
 
-    int result;
+            if (kind == RDB_LIST_QUICKLIST_2 && !rdb_length(in, len))
+                return false;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+            if (!rdb_string(in, data, size, scratch))
+                return false;
 
-    if (result == 0)
-        return RECORD_NUL;
+            if (!sink)
+                continue;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+            if (kind == RDB_LIST_QUICKLIST && !rdb_ziplist(data, size, *sink))
+                return false;
 
-	return OK;
-}
+            if (kind == RDB_LIST_QUICKLIST_2 && !(len == 1 ? sink->item(data, size) :
+                                                  len == 2 ? rdb_listpack(data, size, *sink) : false))
+                return false;
+        }
 
-int Redic::zincrby(const char *key, double increment, const char *member, double &new_score)
-{
-    Request req(4);
-    req.append("ZINCRBY");
-    req.append(key);
-    req.append(increment);
-    req.append(member);
+        return true;
 
-    string result;
+    case RDB_STREAM:
+    case RDB_STREAM_2:
+    case RDB_STREAM_3:
+        return rdb_stream(in, kind);
 
-	if (entity->operate_bulk(result, req) != OK)
-		return entity->errnum();
+    case RDB_MODULE_2:
+        return rdb_length(in, len) && rdb_module(in);
 
-    new_score = atof(result.c_str());
-	return OK;
+    default:
+        return false;
+    }
 }
 
-int Redic::zrank(const char *key, const char *member, int &rank)
+///A file mapped in memory.
+class RedicRdbFile
 {
-    Request req(3);
-    req.append("ZRANK");
-    req.append(key);
-    req.append(member);
+public:
+    const char *data;
+    int64_t size;
 
-    int result;
+    RedicRdbFile() : data(NULL), size(0) {}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    ~RedicRdbFile()
+    {
+        unmap();
+    }
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    int open(const char *path)
+    {
+        unmap();
 
-    rank = result;
-	return OK;
-}
+#ifdef WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER len;
 
-int Redic::zrevrank(const char *key, const char *member, int &rank)
-{
-    Request req(3);
-    req.append("ZREVRANK");
-    req.append(key);
-    req.append(member);
+        if (file == INVALID_HANDLE_VALUE)
+            return Redic::RECORD_NUL;
 
-    int result;
+        if (!GetFileSizeEx(file, &len) || len.QuadPart < 9)
+        {
+            CloseHandle(file);
+            return Redic::SYNTAX_ERR;
+        }
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        //the view keeps the file mapped once the handles are closed
+        HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        void *addr = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+        if (mapping)
+            CloseHandle(mapping);
 
-    rank = result;
-	return OK;
-}
+        CloseHandle(file);
 
-int Redic::zrange(const char *key, int start, int stop, List &elements)
-{
-    Request req(4);
-    req.append("ZRANGE");
-    req.append(key);
-    req.append(start);
-    req.append(stop);
+        if (!addr)
+            return Redic::RECORD_NUL;
 
-	if (entity->operate_list(elements, req) != OK)
-		return entity->errnum();
+        size = len.QuadPart;
+#else
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
 
-	return OK;
-}
+        if (fd < 0)
+            return Redic::RECORD_NUL;
 
-int Redic::zrevrange(const char *key, int start, int stop, List &elements)
-{
-    Request req(4);
-    req.append("ZREVRANGE");
-    req.append(key);
-    req.append(start);
-    req.append(stop);
+        if (fstat(fd, &st) != 0 || st.st_size < 9)
+        {
+            ::close(fd);
+            return Redic::SYNTAX_ERR;
+        }
 
-	if (entity->operate_list(elements, req) != OK)
-		return entity->errnum();
+        void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
 
-	return OK;
-}
+        if (addr == MAP_FAILED)
+            return Redic::RECORD_NUL;
 
-int Redic::zcard(const char *key, int& length)
-{
-    Request req(2);
-    req.append("ZCARD");
-    req.append(key);
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        size = st.st_size;
+#endif
 
-    int result;
+        data = (const char *)addr;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+        if (memcmp(data, "REDIS", 5) != 0)
+        {
+            unmap();
+            return Redic::SYNTAX_ERR;
+        }
 
-    if (result == 0)
-        return RECORD_NUL;
+        return Redic::OK;
+    }
 
-    if (result < 0)
-        return SYNTAX_ERR;
+    void unmap()
+    {
+        if (!data)
+            return;
 
-    length = result;
-	return OK;
-}
+#ifdef WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void *)data, size);
+#endif
 
-int Redic::zscore(const char *key, const char *member, double &score)
-{
-    Request req(3);
-    req.append("ZSCORE");
-    req.append(key);
-    req.append(member);
+        data = NULL;
+        size = 0;
+    }
+
+    int scan(RedicRdb::Handler &handler, int index)
+    {
+        if (!data)
+            return Redic::RECORD_NUL;
+
+        RdbIn in;
+        in.p = (const unsigned char *)data + 9;
+        in.end = (const unsigned char *)data + size;
+
+        RedicRdb::Entry entry;
+        entry.index = index;
+        entry.dbnum = 0;
+        entry.expiry = -1;
+
+        const unsigned char *raw;
+        const char *str;
+        uint64_t len;
+        int num;
+
+        while (true)
+        {
+            if (!rdb_raw(in, 1, raw))
+                return Redic::SYNTAX_ERR;
+
+            bool ok = true;
 
-    string result;
+            switch (*raw)
+            {
+            case RDB_EOF:
+                return Redic::OK;
 
-	if (entity->operate_bulk(result, req) != OK)
-		return entity->errnum();
+            case RDB_SELECTDB:
+                ok = rdb_length(in, len);
+                entry.dbnum = ok ? (int)len : 0;
+                break;
 
-    score = atof(result.c_str());
-	return OK;
-}
+            case RDB_RESIZEDB:
+                ok = rdb_length(in, len) && rdb_length(in, len);
+                break;
 
-int Redic::zremrangebyscore(const char *key, double min, double max, int &removed)
-{
-    Request req(4);
-    req.append("ZREMRANGEBYSCORE");
-    req.append(key);
-    req.append(min);
-    req.append(max);
+            case RDB_SLOT_INFO:
+                ok = rdb_length(in, len) && rdb_length(in, len) && rdb_length(in, len);
+                break;
 
-    int result;
+            case RDB_AUX:
+                ok = rdb_string(in, str, num, NULL) && rdb_string(in, str, num, NULL);
+                break;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+            case RDB_FUNCTION2:
+                ok = rdb_string(in, str, num, NULL);
+                break;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+            case RDB_MODULE_AUX:
+                ok = rdb_length(in, len) && rdb_length(in, len) && rdb_length(in, len) && rdb_module(in);
+                break;
 
-    removed = result;
-	return OK;
-}
+            case RDB_EXPIRETIME:
+                ok = rdb_raw(in, 4, raw);
+                entry.expiry = ok ? (int64_t)rdb_le(raw, 4)*1000 : -1;
+                break;
 
-int Redic::zremrangebyrank(const char *key, int start, int stop, int &removed)
-{
-    Request req(4);
-    req.append("ZREMRANGEBYRANK");
-    req.append(key);
-    req.append(start);
-    req.append(stop);
+            case RDB_EXPIRETIME_MS:
+                ok = rdb_raw(in, 8, raw);
+                entry.expiry = ok ? (int64_t)rdb_le(raw, 8) : -1;
+                break;
 
-    int result;
+            case RDB_IDLE:
+                ok = rdb_length(in, len);
+                break;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+            case RDB_FREQ:
+                ok = rdb_raw(in, 1, raw);
+                break;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+            default:
+                //a key and its value, walked to find where the next starts
+                entry.kind = *raw;
 
-    removed = result;
-	return OK;
-}
+                if (!rdb_string(in, entry.keydata, entry.keylen, &entry.keybuf))
+                    return Redic::SYNTAX_ERR;
 
-int Redic::zcount(const char *key, double min, double max, int &removed)
-{
-    Request req(4);
-    req.append("ZCOUNT");
-    req.append(key);
-    req.append(min);
-    req.append(max);
+                entry.start = (const char *)in.p;
 
-    int result;
+                if (!rdb_value(in, entry.kind, NULL))
+                    return Redic::SYNTAX_ERR;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+                entry.finish = (const char *)in.p;
 
-    if (result < 0)
-        return SYNTAX_ERR;
+                int rc = handler.entry(entry);
 
-    removed = result;
-	return OK;
-}
+                if (rc != Redic::OK)
+                    return rc;
 
-int Redic::hset(const char *key, const char *field, const char *value)
+                entry.expiry = -1;
+                continue;
+            }
+
+            if (!ok)
+                return Redic::SYNTAX_ERR;
+        }
+    }
+};
+
+class RdbValueSink : public RdbSink
 {
-    Request req(4);
-    req.append("HSET");
-    req.append(key);
-    req.append(field);
-    req.append(value);
+public:
+    string &val;
 
-    int result;
+    RdbValueSink(string &v) : val(v) {}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    bool item(const char *data, int len)
+    {
+        val.assign(data, len);
+        return true;
+    }
+};
 
-    if (result != 0 && result != 1)
-        return SYNTAX_ERR;
+class RdbListSink : public RdbSink
+{
+public:
+    Redic::List &list;
 
-	return OK;
-}
+    RdbListSink(Redic::List &l) : list(l) {}
 
-int Redic::hsetnx(const char *key, const char *field, const char *value)
+    bool item(const char *data, int len)
+    {
+        list.push_back(string(data, len));
+        return true;
+    }
+};
+
+class RdbSetSink : public RdbSink
 {
-    Request req(4);
-    req.append("HSETNX");
-    req.append(key);
-    req.append(field);
-    req.append(value);
+public:
+    Redic::Set &set;
 
-    int result;
+    RdbSetSink(Redic::Set &s) : set(s) {}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+    bool item(const char *data, int len)
+    {
+        set.insert(string(data, len));
+        return true;
+    }
+};
 
-    if (result == 0)
-        return RECORD_NUL;
+//members and scores, one after the other
+class RdbScoreSink : public RdbSink
+{
+public:
+    Redic::ScoreList &list;
+    bool member;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+    RdbScoreSink(Redic::ScoreList &l) : list(l), member(true) {}
 
-	return OK;
-}
+    bool item(const char *data, int len)
+    {
+        if (member)
+            list.push_back(std::make_pair(0.0, string(data, len)));
+        else
+            list.back().first = redic_strtod(string(data, len).c_str());
 
-int Redic::hget(const char *key, const char *field, string &value)
+        member = !member;
+        return true;
+    }
+};
+
+class RdbVisitSink : public RdbSink
 {
-    Request req(3);
-    req.append("HGET");
-    req.append(key);
-    req.append(field);
+public:
+    Redic::Visitor &visitor;
+    int index;
 
-	if (entity->operate_bulk(value, req) != OK)
-		return entity->errnum();
+    RdbVisitSink(Redic::Visitor &v) : visitor(v), index(0) {}
 
-	return OK;
-}
+    bool item(const char *data, int len)
+    {
+        rc = visitor.visit(index++, data, len);
+        return rc == Redic::OK;
+    }
+};
 
-int Redic::hmset(const char *key, const List &pairs)
+struct RdbJob
 {
-    Request req(2+pairs.size());
-    req.append("HMSET");
-    req.append(key);
+    Redic::List::const_iterator next;
+    Redic::List::const_iterator end;
+    RedicRdb::Handler *handler;
 
-	for(List::const_iterator it=pairs.begin(); it!=pairs.end(); it++)
-        req.append(*it);
+    RedicMutex lock;
+    int index;
+    int rc;
 
-    string result;
+    //files are taken one at a time, until all are done or one fails
+    static void *run(void *arg)
+    {
+        RdbJob &job = *(RdbJob *)arg;
+        RedicRdbFile file;
 
-	if (entity->operate_inline(result, req) != OK)
-		return entity->errnum();
+        while (true)
+        {
+            string path;
+            int index;
 
-    if (result != "OK")
-        return SYNTAX_ERR;
+            {
+                RedicGuard guard(job.lock);
 
-	return OK;
-}
+                if (job.rc != Redic::OK || job.next == job.end)
+                    return NULL;
 
-int Redic::hmget(const char *key, const List &fields, List &values)
-{
-    Request req(2+fields.size());
-    req.append("HMGET");
-    req.append(key);
+                path = *job.next++;
+                index = job.index++;
+            }
 
-	for(List::const_iterator it=fields.begin(); it!=fields.end(); it++)
-        req.append(*it);
+            int rc = file.open(path.c_str());
 
-	if (entity->operate_list(values, req) != OK)
-		return entity->errnum();
+            if (rc == Redic::OK)
+                rc = file.scan(*job.handler, index);
 
-	return OK;
-}
+            file.unmap();
 
-int Redic::hkeys(const char *key, List &fields)
+            if (rc != Redic::OK)
+            {
+                RedicGuard guard(job.lock);
+
+                if (job.rc == Redic::OK)
+                    job.rc = rc;
+            }
+        }
+    }
+};
+
+static int rdb_decode(int kind, const char *start, const char *finish, RdbSink &sink)
 {
-    Request req(2);
-    req.append("HKEYS");
-    req.append(key);
+    RdbIn in;
+    in.p = (const unsigned char *)start;
+    in.end = (const unsigned char *)finish;
 
-	if (entity->operate_list(fields, req) != OK)
-		return entity->errnum();
+    if (!rdb_value(in, kind, &sink))
+        return sink.rc != Redic::OK ? sink.rc : Redic::SYNTAX_ERR;
 
-	return OK;
+    return Redic::OK;
 }
 
-int Redic::hvals(const char *key, List &values)
+int RedicRdb::Entry::file() const
 {
-    Request req(2);
-    req.append("HVALS");
-    req.append(key);
+	return index;
+}
 
-	if (entity->operate_list(values, req) != OK)
-		return entity->errnum();
+int RedicRdb::Entry::db() const
+{
+	return dbnum;
+}
 
-	return OK;
+const char *RedicRdb::Entry::key() const
+{
+	return keydata;
 }
 
-int Redic::hgetall(const char *key, List &pairs)
+int RedicRdb::Entry::key_length() const
 {
-    Request req(2);
-    req.append("HGETALL");
-    req.append(key);
+	return keylen;
+}
 
-	if (entity->operate_list(pairs, req) != OK)
-		return entity->errnum();
+int64_t RedicRdb::Entry::expire() const
+{
+	return expiry;
+}
 
-	return OK;
+RedicRdb::Type RedicRdb::Entry::type() const
+{
+	switch (kind)
+	{
+	case RDB_STRING:
+		return TYPE_STRING;
+
+	case RDB_LIST:
+	case RDB_LIST_ZIPLIST:
+	case RDB_LIST_QUICKLIST:
+	case RDB_LIST_QUICKLIST_2:
+		return TYPE_LIST;
+
+	case RDB_SET:
+	case RDB_SET_INTSET:
+	case RDB_SET_LISTPACK:
+		return TYPE_SET;
+
+	case RDB_ZSET:
+	case RDB_ZSET_2:
+	case RDB_ZSET_ZIPLIST:
+	case RDB_ZSET_LISTPACK:
+		return TYPE_ZSET;
+
+	case RDB_HASH:
+	case RDB_HASH_ZIPLIST:
+	case RDB_HASH_LISTPACK:
+		return TYPE_HASH;
+
+	case RDB_STREAM:
+	case RDB_STREAM_2:
+	case RDB_STREAM_3:
+		return TYPE_STREAM;
+
+	default:
+		return TYPE_MODULE;
+	}
 }
 
-int Redic::hexists(const char *key, const char *field)
+int RedicRdb::Entry::value(string &val) const
 {
-    Request req(3);
-    req.append("HEXISTS");
-    req.append(key);
-    req.append(field);
+	if (type() != TYPE_STRING)
+		return Redic::SYNTAX_ERR;
 
-    int result;
+	RdbValueSink sink(val);
+	return rdb_decode(kind, start, finish, sink);
+}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+int RedicRdb::Entry::elements(Redic::List &list) const
+{
+	if (type() != TYPE_LIST)
+		return Redic::SYNTAX_ERR;
 
-    if (result == 0)
-        return RECORD_NUL;
+	RdbListSink sink(list);
+	return rdb_decode(kind, start, finish, sink);
+}
 
-    if (result != 1)
-        return SYNTAX_ERR;
+int RedicRdb::Entry::members(Redic::Set &set) const
+{
+	if (type() != TYPE_SET)
+		return Redic::SYNTAX_ERR;
 
-	return OK;
+	RdbSetSink sink(set);
+	return rdb_decode(kind, start, finish, sink);
 }
 
-int Redic::hdel(const char *key, const char *field)
+int RedicRdb::Entry::members(Redic::ScoreList &list) const
 {
-    Request req(3);
-    req.append("HDEL");
-    req.append(key);
-    req.append(field);
-
-    int result;
+	if (type() != TYPE_ZSET)
+		return Redic::SYNTAX_ERR;
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+	RdbScoreSink sink(list);
+	return rdb_decode(kind, start, finish, sink);
+}
 
-    if (result == 0)
-        return RECORD_NUL;
+int RedicRdb::Entry::fields(Redic::List &fields_values) const
+{
+	if (type() != TYPE_HASH)
+		return Redic::SYNTAX_ERR;
 
-    if (result != 1)
-        return SYNTAX_ERR;
+	RdbListSink sink(fields_values);
+	return rdb_decode(kind, start, finish, sink);
+}
 
-	return OK;
+int RedicRdb::Entry::visit(Redic::Visitor &visitor) const
+{
+	RdbVisitSink sink(visitor);
+	return rdb_decode(kind, start, finish, sink);
 }
 
-int Redic::hlen(const char *key, int &length)
+RedicRdb::RedicRdb()
 {
-    Request req(2);
-    req.append("HLEN");
-    req.append(key);
+	file = new RedicRdbFile();
+}
 
-    int result;
+RedicRdb::~RedicRdb()
+{
+	delete file;
+}
 
-	if (entity->operate_int(result, req) != OK)
-		return entity->errnum();
+int RedicRdb::open(const char *path)
+{
+	return file->open(path);
+}
 
-    if (result < 0)
-        return SYNTAX_ERR;
+void RedicRdb::unmap()
+{
+	file->unmap();
+}
 
-    length = result;
-	return OK;
+int RedicRdb::scan(Handler &handler)
+{
+	return file->scan(handler, 0);
 }
 
-int Redic::hincrby(const char *key, const char *field, int increment, int &new_val)
+int RedicRdb::scan(const Redic::List &paths, Handler &handler, int threads)
 {
-    Request req(4);
-    req.append("HINCRBY");
-    req.append(key);
-    req.append(field);
-    req.append(increment);
+	RdbJob job;
+	job.next = paths.begin();
+	job.end = paths.end();
+	job.handler = &handler;
+	job.index = 0;
+	job.rc = Redic::OK;
 
-	if (entity->operate_int(new_val, req) != OK)
-		return entity->errnum();
+	std::list<RedicThread> workers;
+	int num = threads < (int)paths.size() ? threads : (int)paths.size();
 
-	return OK;
+	for (int i=0; i<num; i++)
+	{
+		workers.push_back(RedicThread());
+
+		if (!workers.back().start(RdbJob::run, &job))
+		{
+			workers.pop_back();
+			break;
+		}
+	}
+
+	//with no thread to spare, the caller does the work
+	if (workers.empty())
+		RdbJob::run(&job);
+
+	for (std::list<RedicThread>::iterator it=workers.begin(); it!=workers.end(); it++)
+		it->join();
+
+	return job.rc;
 }
 
@@ -20,23 +20,534 @@
 #ifndef _REDIC_H_
 #define _REDIC_H_
 
+#include <stdint.h>
 #include <list>
 #include <set>
 #include <string>
+#include <vector>
 using std::string;
 class RedicEntity;
+class RedicCache;
+class RedicTtlStore;
+class RedicFlights;
+class RedicPipe;
+class RedicSubscription;
+class RedicQueues;
+class RedicPfBuffer;
+class RedicMigration;
+class RedicReplication;
+class RedicRdbFile;
 
 
 #ifndef TIMEOUT_VAL
 #define TIMEOUT_VAL 1000
 #endif
 
+//limits of one command of the variadic operations, longer ones are split
+#ifndef REDIC_CHUNK_ARGS
+#define REDIC_CHUNK_ARGS 1024
+#endif
+
+#ifndef REDIC_CHUNK_BYTES
+#define REDIC_CHUNK_BYTES (1024*1024)
+#endif
+
 
 class Redic
 {
 public:
 	typedef std::list<string> List;
 	typedef std::set<string> Set;
+	typedef std::list<std::pair<double, string> > ScoreList;
+
+	///Contiguous container of strings.
+	///All elements are kept in one byte block and addressed by offset and length,
+	///so filling it costs no per-element allocation and it can be reused by clear().
+	class Array
+	{
+	public:
+		Array();
+
+		///Return the number of elements.
+		int size() const;
+
+		///Return true if there is no element.
+		bool empty() const;
+
+		///Remove all elements, keeping the allocated memory.
+		void clear();
+
+		///Preallocate room for num elements with bytes of payload in total.
+		void reserve(int num, int bytes);
+
+		///Return the bytes of element i, terminated with a '\0'.
+		///Return NULL if element i is nil.
+		const char *data(int i) const;
+
+		///Return the length of element i, or -1 if it is nil.
+		int length(int i) const;
+
+		///Return true if element i is nil, e.g. a missing key of mget.
+		bool nil(int i) const;
+
+		///Return a copy of element i.
+		string str(int i) const;
+
+		///Same as data(i).
+		const char *operator[](int i) const;
+
+		///Append an element.
+		void push_back(const char *data, int len);
+
+		///Append an element of len bytes and return the room to fill it.
+		char *append(int len);
+
+		///Append a nil element.
+		void push_nil();
+
+	private:
+		struct Span
+		{
+			int off;
+			int len;
+		};
+
+		std::vector<char> block;
+		std::vector<Span> spans;
+	};
+
+	///Field to value map of a hash, kept in one Array.
+	///Fields are indexed by an open-addressed table, so lookup is O(1)
+	///and filling it costs no per-field allocation.
+	class Hash
+	{
+	public:
+		Hash();
+
+		///Return the number of fields.
+		int size() const;
+
+		///Return true if there is no field.
+		bool empty() const;
+
+		///Remove all fields, keeping the allocated memory.
+		void clear();
+
+		///Return the index of field, or -1 if there is no such field.
+		int index(const char *field, int len) const;
+		int index(const char *field) const;
+
+		///Return the value of field, or NULL if there is no such field.
+		const char *find(const char *field) const;
+
+		///Return the field or value at index i, terminated with a '\0'.
+		const char *field(int i) const;
+		const char *value(int i) const;
+
+		///Return the length of the field or value at index i.
+		int field_length(int i) const;
+		int value_length(int i) const;
+
+		///Insert or overwrite a field.
+		void insert(const char *field, int flen, const char *value, int vlen);
+
+	private:
+		friend class Redic;
+
+		struct Pair
+		{
+			int field;
+			int value;
+		};
+
+		static unsigned int hash(const char *data, int len);
+
+		void link(int field, int value);
+		void rehash(int num);
+
+		Array items;
+		std::vector<Pair> pairs;
+		std::vector<int> slots;
+	};
+
+	///Members of a sorted set with their scores, e.g. a range WITHSCORES.
+	///Members lie back to back in one Array and scores in one vector,
+	///the scores being parsed to double as they are received.
+	class Scores
+	{
+	public:
+		Scores();
+
+		///Return the number of members.
+		int size() const;
+
+		///Return true if there is no member.
+		bool empty() const;
+
+		///Remove all members, keeping the allocated memory.
+		void clear();
+
+		///Preallocate room for num members with bytes of payload in total.
+		void reserve(int num, int bytes);
+
+		///Return the bytes of member i, terminated with a '\0'.
+		const char *member(int i) const;
+
+		///Return the length of member i.
+		int length(int i) const;
+
+		///Return the score of member i.
+		double score(int i) const;
+
+		///Return a copy of member i.
+		string str(int i) const;
+
+	private:
+		friend class Redic;
+
+		Array members;
+		std::vector<double> scores;
+	};
+
+	///Bitmap value of a string, in the bit order of SETBIT: the first bit is
+	///the high bit of the first byte. It is kept in 64-bit words, so bitmaps
+	///are counted and combined a word at a time; bytes past the value are 0.
+	class Bitmap
+	{
+	public:
+		Bitmap();
+
+		///Return the number of bytes of the value.
+		int size() const;
+
+		///Return true if the value is empty.
+		bool empty() const;
+
+		///Remove the value, keeping the allocated memory.
+		void clear();
+
+		///Resize the value to bytes, zeroing the new ones, and return its bytes.
+		char *resize(int bytes);
+
+		///Return the bytes of the value, aligned to 8 bytes; NULL if empty.
+		const char *data() const;
+
+		///Return the bit at offset, 0 past the value.
+		int bit(int64_t offset) const;
+
+		///Set the bit at offset to value, growing the value as SETBIT does.
+		void set(int64_t offset, int value);
+
+		///Return the number of bits set, as BITCOUNT does.
+		int64_t count() const;
+
+		///Combine with other as BITOP does, the shorter one padded with 0.
+		Bitmap &operator&=(const Bitmap &other);
+		Bitmap &operator|=(const Bitmap &other);
+		Bitmap &operator^=(const Bitmap &other);
+
+	private:
+		std::vector<uint64_t> words;
+		int bytes;
+	};
+
+	///Receiver of the elements of a multi-bulk reply, called in reply order.
+	///The bytes are only valid during the call.
+	class Visitor
+	{
+	public:
+		virtual ~Visitor() {}
+
+		///Return OK to go on, or an error code to skip the rest of the reply.
+		///A nil element is passed as NULL with len -1.
+		virtual int visit(int index, const char *data, int len) = 0;
+	};
+
+	class Parser;
+
+	///Reply of any type and nesting, of RESP2 or RESP3.
+	///Nodes are flat encoded in preorder in one vector, and their payloads
+	///kept in one byte block; node 0 is the root. Reuse it by clear().
+	///RESP3 attributes are skipped, the reply is the value they annotate.
+	class Reply
+	{
+	public:
+		enum Type
+		{
+			TYPE_NIL,
+			TYPE_STATUS,
+			TYPE_ERROR,
+			TYPE_INTEGER,
+			TYPE_STRING,
+			TYPE_ARRAY,
+
+			//RESP3 only
+			TYPE_DOUBLE,
+			TYPE_BOOLEAN,
+			TYPE_BIGNUM,
+			TYPE_VERBATIM,
+			TYPE_MAP,
+			TYPE_SET,
+			TYPE_PUSH,
+		};
+
+		Reply();
+
+		///Remove all nodes, keeping the allocated memory.
+		void clear();
+
+		///Return true if there is no node.
+		bool empty() const;
+
+		///Return the type of node.
+		Type type(int node = 0) const;
+
+		///Return the payload of a node, terminated with a '\0'.
+		///Status, error, string, double, big number and verbatim nodes have
+		///one; a verbatim one starts with its format, e.g. "txt:".
+		const char *data(int node = 0) const;
+
+		///Return the payload length of node.
+		int length(int node = 0) const;
+
+		///Return a copy of the payload of node.
+		string str(int node = 0) const;
+
+		///Return the value of an integer or boolean node.
+		int64_t integer(int node = 0) const;
+
+		///Return the value of a double node.
+		double real(int node = 0) const;
+
+		///Return true if node is an array, map, set or push node.
+		bool aggregate(int node = 0) const;
+
+		///Return the number of children of an aggregate node.
+		///Children of a map node are its fields and values in turn.
+		int count(int node = 0) const;
+
+		///Return the first child of an aggregate node.
+		int first(int node = 0) const;
+
+		///Return the node following node and all its children.
+		int next(int node) const;
+
+		///Return the i-th child of an aggregate node, or -1 if out of range.
+		int child(int node, int i) const;
+
+		///Exchange the content with another reply.
+		void swap(Reply &other);
+
+	private:
+		friend class Parser;
+
+		struct Node
+		{
+			int type;
+			int off;
+			int len;
+			int end;
+			int64_t num;
+			double dbl;
+		};
+
+		int add(int type);
+		char *payload(int node, int len);
+
+		std::vector<char> block;
+		std::vector<Node> nodes;
+	};
+
+	///Push parser of replies, fed with byte chunks of any size.
+	///It keeps its position across calls and never reads by itself, so any
+	///transport can drive it: an event loop, completion callbacks or tests.
+	class Parser
+	{
+	public:
+		Parser();
+
+		///Start a new reply, built in the parser's own Reply.
+		void reset();
+
+		///Start a new reply, built in target.
+		void reset(Reply &target);
+
+		///Consume bytes until the reply is complete or the bytes run out.
+		///Return the number of bytes consumed, or -1 on a protocol error.
+		int feed(const char *data, int len);
+
+		///Return true if the reply is complete.
+		bool done() const;
+
+		///Return the reply being built.
+		Reply &reply();
+
+	private:
+		struct Frame
+		{
+			int node;
+			int mark;
+			int bytes;
+			int64_t left;
+		};
+
+		int finish_line();
+		void finish_value();
+
+		Reply own;
+		Reply *out;
+
+		int state;
+		char prefix;
+		string line;
+		int node;
+		int64_t want;
+		int64_t got;
+		std::vector<Frame> stack;
+	};
+
+	///Commands queued to run as one MULTI ... EXEC, sent in a single write.
+	///After exec() the results of the commands are the children of reply().
+	class Transaction
+	{
+	public:
+		Transaction();
+
+		///Remove the commands and their results.
+		void clear();
+
+		///Queue a command with its arguments.
+		void add(const List &args);
+
+		///Queue a command with up to three arguments, the unused ones NULL.
+		void add(const char *cmd, const char *arg1 = NULL, const char *arg2 = NULL, const char *arg3 = NULL);
+
+		///Return the number of commands queued.
+		int size() const;
+
+		///Return OK, RECORD_NUL if the i-th command replied nil, or
+		///SERVER_ERR if it failed; the others are run anyway.
+		int result(int i) const;
+
+		///Get the result of the i-th command as an integer.
+		int integer(int i, int64_t &val) const;
+
+		///Get the result of the i-th command as a string.
+		int str(int i, string &val) const;
+
+		///Return the EXEC reply, an array with a child per command.
+		const Reply &reply() const;
+
+	private:
+		friend class Redic;
+
+		int node(int i) const;
+
+		string cmds;
+		int num;
+		Reply replies;
+	};
+
+	///Stream entries of XREADGROUP or XAUTOCLAIM, decoded in place: ids,
+	///fields and values all point into one Reply, with no string per field.
+	class Entries
+	{
+	public:
+		Entries();
+
+		///Remove all entries, keeping the allocated memory.
+		void clear();
+
+		///Return the number of entries.
+		int size() const;
+
+		///Return true if there is no entry.
+		bool empty() const;
+
+		///Return the key of the stream of the i-th entry, empty after XAUTOCLAIM.
+		string stream(int i) const;
+
+		///Return the id of the i-th entry.
+		const char *id(int i) const;
+
+		///Return the number of field/value pairs of the i-th entry, 0 if deleted.
+		int fields(int i) const;
+
+		///Return the j-th field or value of the i-th entry, terminated with a '\0'.
+		const char *field(int i, int j) const;
+		const char *value(int i, int j) const;
+		int field_length(int i, int j) const;
+		int value_length(int i, int j) const;
+
+	private:
+		friend class Redic;
+
+		struct Entry
+		{
+			int stream;
+			int id;
+			int first;
+			int count;
+		};
+
+		void load(int stream, int list);
+
+		Reply reply;
+		std::vector<Entry> entries;
+	};
+
+	///Lua script, run by its SHA1 which is computed locally once.
+	class Script
+	{
+	public:
+		Script(const char *body);
+
+		///Return the source of the script.
+		const string &body() const;
+
+		///Return the SHA1 of the script in hex, as EVALSHA takes it.
+		const string &sha1() const;
+
+	private:
+		string src;
+		string digest;
+	};
+
+	///Body of an optimistic transaction, run again if a watched key changes.
+	class Optimistic
+	{
+	public:
+		virtual ~Optimistic() {}
+
+		///Read the watched keys through redic and queue the commands in tx.
+		///Return OK to execute tx, or an error code to give up.
+		virtual int prepare(Redic &redic, Transaction &tx) = 0;
+	};
+
+	///Receiver of RESP3 push messages which arrive out of band,
+	///e.g. invalidation messages of client side caching.
+	class PushHandler
+	{
+	public:
+		virtual ~PushHandler() {}
+
+		///Called with each push message, only valid during the call.
+		virtual void push(const Reply &message) = 0;
+	};
+
+	//helpers to tell output iterators from visitors in the template overloads
+	template <bool cond, class T> struct EnableIf { typedef T type; };
+	template <class T> struct EnableIf<false, T> {};
+
+	template <class T> struct IsVisitor
+	{
+		static char test(const Visitor *);
+		static long test(...);
+		enum { value = sizeof(test((T *)0)) == sizeof(char) };
+	};
+
+	template <class OutputIt> class Inserter;
+	template <class OutputIt> class PairInserter;
 
 	enum {
 	    OK,
@@ -57,6 +568,42 @@ public:
 	///Disconnect from Redis server.
 	void disconn();
 
+	///Switch the protocol of the connection to RESP2 or RESP3 by HELLO.
+	///Under RESP3 the server replies with native maps, sets and doubles.
+	int hello(int version);
+
+	///Return the protocol version of the connection, 2 or 3.
+	int protocol();
+
+	///Set the receiver of RESP3 push messages, NULL to drop them.
+	void on_push(PushHandler *handler);
+
+	///Cache results of get and hget in process memory, up to about max_bytes,
+	///and have the server invalidate them by CLIENT TRACKING.
+	///Under RESP3 invalidations are push messages of this connection, under
+	///RESP2 they are redirected to a second connection to the same server.
+	///A hit still picks up the invalidations received so far, but does not
+	///wait for any. connect() and disconn() turn the cache off.
+	int enable_cache(int max_bytes);
+
+	///Turn the cache off and drop its content.
+	void disable_cache();
+
+	///Return the number of get and hget calls served from the cache.
+	int64_t cache_hits();
+
+	///Return the number of get and hget calls the cache could not serve.
+	int64_t cache_misses();
+
+	///Return the high-water mark in bytes of the reply arena of this connection.
+	///The arena, reset between commands, holds only the elements handed to a
+	///Visitor that do not fit in the receive buffer; strings, lists, sets,
+	///Array and Reply results are still stored in the caller's containers.
+	int arena_peak();
+
+	///Preallocate the reply arena of this connection.
+	void arena_reserve(int bytes);
+
 
     /* dataset operation */
 
@@ -89,6 +636,7 @@ public:
 
     ///Return the number of keys in the currently dataset.
     int dbsize(int &size);
+    int dbsize(int64_t &size);
 
     ///Delete all the keys of the currently dataset.
     int flushdb();
@@ -98,6 +646,13 @@ public:
 
 	///Find all keys matching the given pattern.
 	int keys(const char *pattern, List &keys);
+	int keys(const char *pattern, Array &keys);
+	int keys(const char *pattern, Visitor &keys);
+
+	///Same as above, writing each key as a string to an output iterator.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	keys(const char *pattern, OutputIt keys);
 
 
     /* key operation */
@@ -108,6 +663,12 @@ public:
     ///Remove the specified keys.
     int del(const char *key);
 
+    ///Remove the specified keys, Return the number of keys removed.
+    ///Variadic operations are split into commands of at most REDIC_CHUNK_ARGS
+    ///arguments or about REDIC_CHUNK_BYTES bytes, all sent in one write, so
+    ///they are only atomic as long as they fit in one command.
+    int del(const List &keys, int &deleted);
+
     ///Get the representation of the type of the key.
     ///The types: string, list, set, zset and hash.
     int type(const char *key, string &type);
@@ -123,6 +684,7 @@ public:
 
 	///Get the time to live for a key.
 	int ttl(const char *key, int &value);
+	int ttl(const char *key, int64_t &value);
 
 	///Move key from the currently dataset to another dataset.
 	int move(const char *key, int index);
@@ -156,18 +718,76 @@ public:
 
 	///Get the string values of all specified keys.
 	int mget(const List &keys, List &values);
+	int mget(const List &keys, Array &values);
+	int mget(const List &keys, Visitor &values);
+
+	///Same as above, writing each value as a string to an output iterator,
+	///an empty one for a missing key.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	mget(const List &keys, OutputIt values);
+
+	///Set keys to their values at once, pairs of key and value.
+	int mset(const List &pairs);
+
+	///Set keys to their values at once, only if none of the keys exists.
+	///Return RECORD_NUL if any key exists and nothing is set.
+	int msetnx(const List &pairs);
+
+	///Set each of keys to the value of the same index with a timeout of secs,
+	///pipelined as SET key value EX secs. results gets a code per key.
+	///Return SERVER_ERR if any key failed, or SYNTAX_ERR with nothing sent if a
+	///key or value is nil.
+	int setex(const Array &keys, const Array &values, int secs, std::vector<int> &results);
 
 	///Increment the number stored at key by one, and Get the value after increment
+	///The int forms return SYNTAX_ERR once the value is beyond int, rather than wrap;
+	///counters that may grow so far take the int64_t forms.
 	int incr(const char *key, int &new_val);
+	int incr(const char *key, int64_t &new_val);
 
 	///Increment the number stored at key by increment.
 	int incrby(const char *key, int increment, int &new_val);
+	int incrby(const char *key, int64_t increment, int64_t &new_val);
 
 	///Decrement the number stored at key by one.
 	int decr(const char *key, int &new_val);
+	int decr(const char *key, int64_t &new_val);
 
 	///Decrement the number stored at key by decrement.
 	int decrby(const char *key, int decrement, int &new_val);
+	int decrby(const char *key, int64_t decrement, int64_t &new_val);
+
+
+	/* bitmap operation */
+
+	///Set or clear the bit at offset in the string stored at key.
+	///Return the bit stored there before.
+	int setbit(const char *key, int64_t offset, int value, int &old);
+
+	///Return the bit at offset in the string stored at key.
+	int getbit(const char *key, int64_t offset, int &value);
+
+	///Count the bits set in the string stored at key, or in the bytes
+	///between start and end of it.
+	int bitcount(const char *key, int64_t &count);
+	int bitcount(const char *key, int start, int end, int64_t &count);
+
+	///Return the position of the first bit set to bit in the string stored
+	///at key, -1 if bit is 1 and there is none.
+	int bitpos(const char *key, int bit, int64_t &pos);
+
+	///Store the "AND", "OR", "XOR" or "NOT" of the strings stored at keys into
+	///destkey. Return the length of the string stored.
+	int bitop(const char *op, const char *destkey, const List &keys, int &length);
+
+	///Run the subcommands of BITFIELD, e.g. "INCRBY", "u8", "#0", "1", on the
+	///string stored at key, with a result per GET, SET and INCRBY.
+	///A nil result of OVERFLOW FAIL reads as 0, and RECORD_NUL is returned.
+	int bitfield(const char *key, const List &ops, std::vector<int64_t> &results);
+
+	///Get the string stored at key into bitmap, with no intermediate string.
+	int getbits(const char *key, Bitmap &bitmap);
 
 
 	/* list operation */
@@ -176,6 +796,10 @@ public:
     ///Return the length of the list after the push operation.
 	int rpush(const char *key, const char *element, int &length);
 
+    ///Insert elements in turn at the tail of the list stored at key.
+    ///Return the length of the list after the push operation.
+	int rpush(const char *key, const List &elements, int &length);
+
 	///Insert element at the tail of the list stored at key if key already exists and holds a list.
     ///Return the length of the list after the push operation.
 	int rpushx(const char *key, const char *element, int &length);
@@ -184,6 +808,10 @@ public:
     ///Return the length of the list after the push operation.
     int lpush(const char *key, const char *element, int &length);
 
+    ///Insert elements in turn at the head of the list stored at key.
+    ///Return the length of the list after the push operation.
+    int lpush(const char *key, const List &elements, int &length);
+
     ///Insert element at the head of the list stored at key if key already exists and holds a list.
     ///Return the length of the list after the push operation.
 	int lpushx(const char *key, const char *element, int &length);
@@ -196,9 +824,17 @@ public:
 
     ///Get the length of a list.
 	int llen(const char *key, int &length);
+	int llen(const char *key, int64_t &length);
 
     ///Get the specified elements of the list stored at key.
 	int lrange(const char *key, int start, int range, List &elements);
+	int lrange(const char *key, int start, int range, Array &elements);
+	int lrange(const char *key, int start, int range, Visitor &elements);
+
+    ///Same as above, writing each element as a string to an output iterator.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	lrange(const char *key, int start, int range, OutputIt elements);
 
     ///Trim an existing list to contain only the specified range of elements.
 	int ltrim(const char *key, int start, int end);
@@ -213,6 +849,21 @@ public:
     ///Return the number of removed elements.
 	int lrem(const char *key, int count, const char *element, int &length);
 
+    ///Remove and return the first element of the first non-empty list among keys,
+    ///waiting up to timeout milliseconds for one, for ever if 0.
+    ///The reply is awaited for timeout plus TIMEOUT_VAL, instead of TIMEOUT_VAL.
+    ///Return RECORD_NUL if the time ran out.
+	int blpop(const List &keys, int timeout, string &key, string &element);
+
+    ///Same as above, but the last element.
+	int brpop(const List &keys, int timeout, string &key, string &element);
+
+    ///Move an element from the "LEFT" or "RIGHT" of the list stored at source
+    ///to the "LEFT" or "RIGHT" of the list stored at destination,
+    ///waiting up to timeout milliseconds as above.
+	int blmove(const char *source, const char *destination, const char *wherefrom,
+               const char *whereto, int timeout, string &element);
+
 
 	/* set operation */
 
@@ -222,6 +873,12 @@ public:
     ///Remove member from the set stored at key.
     int srem(const char *key, const char *member);
 
+    ///Add members to the set stored at key, Return the number of members added.
+    int sadd(const char *key, const List &members, int &added);
+
+    ///Remove members from the set stored at key, Return the number of members removed.
+    int srem(const char *key, const List &members, int &removed);
+
     ///Removes and returns a random element from the set value stored at key.
     int spop(const char *key, string &value);
 
@@ -230,6 +887,7 @@ public:
 
 	///Get the number of members in a set.
 	int scard(const char *key, int &length);
+	int scard(const char *key, int64_t &length);
 
 	///Determine if a given value is a member of a set.
 	int sismember(const char *key, const char *member);
@@ -237,24 +895,42 @@ public:
 	///Get the members of the intersection of all the given sets.
 	int sinter(const Set &keys, Set &members);
 
+	///Same as above, but keep members unordered as the server returns them.
+	int sinter(const Set &keys, Array &members);
+
     ///Store the members of the intersection in destination set.
 	int sinterstore(const char *destkey, const Set &keys, int &length);
 
     ///Get the members of the union of all the given sets.
 	int sunion(const Set &keys, Set &members);
 
+	///Same as above, but keep members unordered as the server returns them.
+	int sunion(const Set &keys, Array &members);
+
     ///Store the members of the union in destination set.
 	int sunionstore(const char *destkey, const Set &keys, int &length);
 
     ///Get the members of the difference between the first set and all the successive sets.
 	int sdiff(const Set &keys, Set &members);
 
+	///Same as above, but keep members unordered as the server returns them.
+	int sdiff(const Set &keys, Array &members);
+
     ///Store the members of the difference in destination set.
 	int sdiffstore(const char *destkey, const Set &keys, int &length);
 
     ///Get all the members of the set value stored at key.
 	int smembers(const char *key, Set &members);
 
+	///Same as above, but keep members unordered as the server returns them.
+	int smembers(const char *key, Array &members);
+	int smembers(const char *key, Visitor &members);
+
+    ///Same as above, writing each member as a string to an output iterator.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	smembers(const char *key, OutputIt members);
+
     ///Get a random element from the set value stored at key.
 	int srandmember(const char *key, string &member);
 
@@ -267,6 +943,13 @@ public:
 	///Remove the member from the sorted set stored at key.
 	int zrem(const char *key, const char *member);
 
+    ///Add members with their scores to the sorted set stored at key.
+    ///Return the number of members added, not counting the updated ones.
+	int zadd(const char *key, const ScoreList &members, int &added);
+
+	///Remove members from the sorted set stored at key, Return the number removed.
+	int zrem(const char *key, const List &members, int &removed);
+
 	///Increment the score of member in the sorted set stored at key by increment.
 	int zincrby(const char *key, double increment, const char *member, double &new_score);
 
@@ -278,12 +961,59 @@ public:
 
 	///Get the specified range of elements in the sorted set stored at key.
 	int zrange(const char *key, int start, int stop, List &elements);
+	int zrange(const char *key, int start, int stop, Array &elements);
+	int zrange(const char *key, int start, int stop, Visitor &elements);
+
+	///Same as above, writing each element as a string to an output iterator.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	zrange(const char *key, int start, int stop, OutputIt elements);
+
+	///Same as above, with the scores.
+	int zrange(const char *key, int start, int stop, Scores &elements);
 
 	///Get the specified range of elements in the sorted set stored at key.
 	int zrevrange(const char *key, int start, int stop, List &elements);
+	int zrevrange(const char *key, int start, int stop, Array &elements);
+	int zrevrange(const char *key, int start, int stop, Scores &elements);
+
+	///Get the elements with a score between min and max, from the lowest score,
+	///skipping offset of them and taking count at most, all if count < 0.
+	int zrangebyscore(const char *key, double min, double max, Array &elements,
+	                  int offset = 0, int count = -1);
+	int zrangebyscore(const char *key, double min, double max, Scores &elements,
+	                  int offset = 0, int count = -1);
+
+	///Same as above, from the highest score.
+	int zrevrangebyscore(const char *key, double max, double min, Array &elements,
+	                     int offset = 0, int count = -1);
+	int zrevrangebyscore(const char *key, double max, double min, Scores &elements,
+	                     int offset = 0, int count = -1);
+
+	///Same as above with the bounds as Redis takes them, to page past a score
+	///already seen: a number, "(" and a number for an exclusive bound, or "-inf"
+	///and "+inf".
+	int zrangebyscore(const char *key, const char *min, const char *max, Array &elements,
+	                  int offset = 0, int count = -1);
+	int zrangebyscore(const char *key, const char *min, const char *max, Scores &elements,
+	                  int offset = 0, int count = -1);
+	int zrevrangebyscore(const char *key, const char *max, const char *min, Array &elements,
+	                     int offset = 0, int count = -1);
+	int zrevrangebyscore(const char *key, const char *max, const char *min, Scores &elements,
+	                     int offset = 0, int count = -1);
+
+	///Get the elements between min and max in lexicographical order, for a
+	///sorted set of equal scores; bounds are "[" or "(" and a member, or "-" and "+".
+	int zrangebylex(const char *key, const char *min, const char *max, Array &elements,
+	                int offset = 0, int count = -1);
+
+	///Same as above, in reverse order.
+	int zrevrangebylex(const char *key, const char *max, const char *min, Array &elements,
+	                   int offset = 0, int count = -1);
 
 	///Return the sorted set cardinality of the sorted set stored at key.
 	int zcard(const char *key, int &length);
+	int zcard(const char *key, int64_t &length);
 
 	///Get the score of member in the sorted set at key.
 	int zscore(const char *key, const char *member, double &score);
@@ -303,6 +1033,11 @@ public:
     ///Set field in the hash stored at key to value.
     int hset(const char *key, const char *field, const char *value);
 
+    ///Set fields in the hash stored at key to values, pairs of field and value.
+    ///Return the number of fields added, not counting the updated ones,
+    ///or SYNTAX_ERR if a field has no value.
+    int hset(const char *key, const List &pairs, int &added);
+
     ///Sets field in the hash stored at key to value, only if field does not yet exist.
     int hsetnx(const char *key, const char *field, const char *value);
 
@@ -314,15 +1049,39 @@ public:
 
     ///Get the values associated with the specified fields in the hash stored at key.
     int hmget(const char *key, const List &fields, List &values);
+    int hmget(const char *key, const List &fields, Array &values);
+    int hmget(const char *key, const List &fields, Visitor &values);
+
+    ///Same as above, but map each field to its value.
+    int hmget(const char *key, const List &fields, Hash &values);
+
+    ///Same as above, writing each value as a string to an output iterator,
+    ///an empty one for a missing field.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	hmget(const char *key, const List &fields, OutputIt values);
 
     ///Get all field names of the hash stored at key.
     int hkeys(const char *key, List &fields);
+    int hkeys(const char *key, Array &fields);
 
     ///Get all values of the hash stored at key.
     int hvals(const char *key, List &values);
+    int hvals(const char *key, Array &values);
 
     ///Returns all fields and values of the hash stored at key.
     int hgetall(const char *key, List &fileds_values);
+    int hgetall(const char *key, Array &fileds_values);
+    int hgetall(const char *key, Visitor &fileds_values);
+
+    ///Same as above, but map each field to its value.
+    int hgetall(const char *key, Hash &fileds_values);
+
+    ///Same as above, writing each std::pair<string, string> of field and value
+    ///to an output iterator, e.g. std::inserter() of a map.
+	template <class OutputIt>
+	typename EnableIf<!IsVisitor<OutputIt>::value, int>::type
+	hgetall(const char *key, OutputIt fileds_values);
 
     ///Test if field is an existing field in the hash stored at key.
     int hexists(const char *key, const char *field);
@@ -330,14 +1089,655 @@ public:
     ///Remove field from the hash stored at key.
     int hdel(const char *key, const char *field);
 
+    ///Remove fields from the hash stored at key, Return the number of fields removed.
+    int hdel(const char *key, const List &fields, int &removed);
+
     ///Return the number of fields contained in the hash stored at key.
     int hlen(const char *key, int &length);
+    int hlen(const char *key, int64_t &length);
 
     ///Increment the number stored at field in the hash stored at key by increment.
     int hincrby(const char *key, const char *field, int increment, int &new_val);
+    int hincrby(const char *key, const char *field, int64_t increment, int64_t &new_val);
+
+
+    /* transaction */
+
+    ///Watch keys, so that the next exec() fails if any of them changes.
+    int watch(const List &keys);
+
+    ///Forget the watched keys.
+    int unwatch();
+
+    ///Run the commands of tx as one transaction in one round trip.
+    ///Return RECORD_NUL if a watched key changed and nothing was run.
+    int exec(Transaction &tx);
+
+    ///Watch keys and run the transaction prepared by body, at most tries times
+    ///as long as a watched key changes in between.
+    ///Return RECORD_NUL if every try was aborted.
+    int exec(const List &keys, Optimistic &body, Transaction &tx, int tries);
+
+
+    /* stream operation */
+
+    ///Append an entry of field/value pairs to the stream stored at key.
+    ///Return the id of the entry generated by the server.
+    int xadd(const char *key, const List &fields_values, string &id);
+
+    ///Return the number of entries in the stream stored at key.
+    int xlen(const char *key, int &length);
+
+    ///Create a consumer group of the stream stored at key, starting after id,
+    ///"$" for new entries only. The stream is created if it does not exist.
+    int xgroup_create(const char *key, const char *group, const char *id = "$");
+
+    ///Read at most count entries of each stream of keys for consumer of group,
+    ///new ones if id is ">", or else its pending ones after id.
+    ///Wait up to block milliseconds for one if block >= 0, for ever if 0.
+    ///Return RECORD_NUL if there is no entry.
+    int xreadgroup(const char *group, const char *consumer, const List &keys,
+                   int count, int block, Entries &entries, const char *id = ">");
+
+    ///Acknowledge entries of the stream stored at key, batched like the
+    ///variadic operations. Return the number of entries acknowledged.
+    int xack(const char *key, const char *group, const List &ids, int &acked);
+
+    ///Acknowledge the entries of the stream stored at key among entries,
+    ///all of them if claimed by xautoclaim.
+    int xack(const char *key, const char *group, const Entries &entries, int &acked);
+
+    ///Claim at most count entries pending for longer than min_idle milliseconds
+    ///for consumer, scanning from start, "0-0" at first.
+    ///next gets the id to start the next call from, "0-0" once all scanned.
+    int xautoclaim(const char *key, const char *group, const char *consumer,
+                   int min_idle, const char *start, int count, Entries &entries, string &next);
+
+
+    /* hyperloglog operation */
+
+    ///Add elements to the HyperLogLog stored at key, in chunks as the variadic
+    ///operations. changed is 1 if an estimate was altered, else 0.
+    int pfadd(const char *key, const List &elements, int &changed);
+
+    ///Same as above for the elements[i] of each keys[i], in one round trip.
+    int pfadd(const List &keys, const std::vector<List> &elements, int &changed);
+
+    ///Return the estimated cardinality of the union of the HyperLogLogs at keys.
+    int pfcount(const char *key, int64_t &count);
+    int pfcount(const List &keys, int64_t &count);
+
+    ///Merge the HyperLogLogs stored at sources into destkey.
+    int pfmerge(const char *destkey, const List &sources);
+
+
+    /* pub/sub */
+
+    ///Post message to channel, Return the number of clients that received it.
+    ///Subscribing takes a connection of its own, see RedicSubscriber.
+    int publish(const char *channel, const char *message, int &receivers);
+
+
+    /* scripting */
+
+    ///Run script by EVALSHA, and by EVAL if the server does not know it yet,
+    ///which makes the server cache it for the next calls.
+    int eval(const Script &script, const List &keys, const List &args, Reply &reply);
+
+    ///Load script into the script cache of the server.
+    int script_load(const Script &script);
+
+
+    /* generic operation */
+
+    ///Send any command with its arguments and receive a reply of any type.
+    ///Return SERVER_ERR if the reply is an error, RECORD_NUL if it is nil.
+    int command(const List &args, Reply &reply);
 
 private:
 	RedicEntity *entity;
+	RedicCache *cache;
+};
+
+
+///Read-through cache in front of a Redic, for servers without CLIENT TRACKING.
+///Results of get, hget, hgetall and smembers, nil included, are kept for
+///ttl milliseconds in shards of LRU lists, each under its own lock.
+///set, del and hset through it drop the cached results of their key.
+///It may be called from any number of threads; calls to the server are
+///serialized, as the Redic it wraps is only used by one thread at a time.
+class RedicTtlCache
+{
+public:
+	RedicTtlCache(Redic &redic, int ttl, int max_keys, int shards = 16);
+	~RedicTtlCache();
+
+	int get(const char *key, string &value);
+	int hget(const char *key, const char *field, string &value);
+	int hgetall(const char *key, Redic::List &fields_values);
+	int smembers(const char *key, Redic::Set &members);
+
+	int set(const char *key, const char *value);
+	int del(const char *key);
+	int hset(const char *key, const char *field, const char *value);
+
+	///Drop all the cached results.
+	void clear();
+
+	///Return the number of reads served from the cache.
+	int64_t hits();
+
+	///Return the number of reads passed on to the server.
+	int64_t misses();
+
+private:
+	Redic &redic;
+	RedicTtlStore *store;
+};
+
+
+///Single-flight layer in front of a Redic for reads issued by many threads.
+///Identical reads in flight at the same time are sent once, and all their
+///callers get a copy of the same reply. Calls to the server are serialized.
+class RedicSingleFlight
+{
+public:
+	RedicSingleFlight(Redic &redic);
+	~RedicSingleFlight();
+
+	int get(const char *key, string &value);
+	int hget(const char *key, const char *field, string &value);
+	int hgetall(const char *key, Redic::List &fields_values);
+	int smembers(const char *key, Redic::Set &members);
+
+	///Coalesce a read command, such as GET, HMGET or ZRANGE, given with its arguments.
+	///Return SYNTAX_ERR without sending it if the command may have a side effect,
+	///or may block, as INCR, LPOP or BLPOP, which callers could not share.
+	int command(const Redic::List &args, Redic::Reply &reply);
+
+	///Return the number of reads called.
+	int64_t calls();
+
+	///Return the number of reads served by the reply of another call.
+	int64_t collapsed();
+
+private:
+	Redic &redic;
+	RedicFlights *flights;
+};
+
+
+///Mass insertion on a connection of its own, in the way of redis-cli --pipe.
+///Commands are encoded into a large buffer which is written whenever full,
+///while a reader thread counts the replies, so no command waits for one.
+class RedicLoader
+{
+public:
+	///Write the commands once buffer bytes of them are queued.
+	RedicLoader(int buffer = 1024*1024);
+	~RedicLoader();
+
+	///Connect to Redis server, and authenticate if password is not NULL.
+	int connect(const char *host, short port, const char *password = NULL);
+
+	///Queue a command with its arguments.
+	int add(const Redic::List &args);
+
+	///Queue a command with up to three arguments, the unused ones NULL.
+	int add(const char *cmd, const char *arg1 = NULL, const char *arg2 = NULL, const char *arg3 = NULL);
+
+	///Write the commands left and wait for all the replies.
+	///Return SERVER_ERR if any command failed, or CONNECT_ERR if the connection
+	///broke or no reply came for TIMEOUT_VAL milliseconds.
+	int finish();
+
+	///Return the number of commands queued.
+	int64_t sent();
+
+	///Return the number of replies received so far.
+	int64_t received();
+
+	///Return the number of commands which failed.
+	int64_t errors();
+
+	///Return the index of the first command which failed, or -1 if none.
+	int64_t first_error(string &message);
+
+private:
+	RedicPipe *pipe;
+	int limit;
+};
+
+
+///Subscriber of pub/sub channels on a connection of its own.
+///Messages are parsed as they arrive and handed over in batches, either by
+///a dispatch thread of the subscriber after start(), or by poll() from the
+///thread of the caller, e.g. an event loop.
+class RedicSubscriber
+{
+public:
+	struct Message
+	{
+		string pattern;
+		string channel;
+		string payload;
+	};
+
+	///Receiver of the messages; pattern is empty unless from psubscribe().
+	class Handler
+	{
+	public:
+		virtual ~Handler() {}
+
+		///Called with the messages received in a row, at most batch of them.
+		virtual void deliver(const std::vector<Message> &messages) = 0;
+
+		///Called by the dispatch thread when the connection breaks, as it ends;
+		///no message comes until connect() and subscribing again.
+		virtual void disconnected() {}
+	};
+
+	RedicSubscriber(Handler &handler, int batch = 64);
+	~RedicSubscriber();
+
+	///Connect to Redis server, and authenticate if password is not NULL.
+	int connect(const char *host, short port, const char *password = NULL);
+
+	///Subscribe to a channel or to channels matching a pattern, or leave them.
+	///The commands are only written, the server confirms in the stream.
+	int subscribe(const char *channel);
+	int psubscribe(const char *pattern);
+	int unsubscribe(const char *channel);
+	int punsubscribe(const char *pattern);
+
+	///Start the dispatch thread, which calls the handler.
+	///Return CONNECT_ERR if the connection has broken.
+	int start();
+
+	///Stop the dispatch thread.
+	void stop();
+
+	///Deliver the messages arriving within wait milliseconds, without a thread.
+	///Return the number of messages, -CONNECT_ERR if the connection has broken,
+	///by poll() or under the dispatch thread, or -SYNTAX_ERR if the dispatch
+	///thread is running, which reads the connection.
+	int poll(int wait);
+
+	///Return the number of channels and patterns subscribed, as last
+	///confirmed by the server.
+	int subscriptions();
+
+	///Return the number of messages received.
+	int64_t received();
+
+private:
+	RedicSubscription *sub;
+};
+
+
+///Worker of several list queues, popping their elements in batches.
+///Each work() blocks on all queues at once, then takes up to batch elements
+///of the queue it woke on; the queues are rotated so none starves the others.
+class RedicWorker
+{
+public:
+	///Processor of the elements of a queue, in the order pushed with rpush.
+	class Handler
+	{
+	public:
+		virtual ~Handler() {}
+
+		virtual void process(const string &queue, const Redic::List &elements) = 0;
+	};
+
+	RedicWorker(Redic &redic, Handler &handler, int batch = 64);
+	~RedicWorker();
+
+	///Add a queue to work on.
+	void add(const char *queue);
+
+	///Wait up to timeout milliseconds for elements, for ever if 0, and process them.
+	///Return the number of elements processed, or the error as a negative.
+	int work(int timeout);
+
+	///Return the number of elements processed.
+	int64_t processed();
+
+private:
+	Redic &redic;
+	RedicQueues *queues;
+};
+
+
+///Buffer of PFADD elements per key, for counting many events.
+///The elements are sent with one pipelined pfadd per flush, once max_elements
+///are buffered or the oldest of them waited max_wait milliseconds.
+///The wait is checked by add() and poll(); flush() before destruction.
+class RedicPfBatch
+{
+public:
+	RedicPfBatch(Redic &redic, int max_elements = 4096, int max_wait = 100);
+	~RedicPfBatch();
+
+	///Buffer element for the HyperLogLog stored at key, flushing when due.
+	int add(const char *key, const char *element);
+
+	///Flush if the oldest element waited max_wait milliseconds.
+	int poll();
+
+	///Send all the elements buffered.
+	int flush();
+
+	///Return the number of elements buffered.
+	int pending();
+
+	///Return the number of elements sent.
+	int64_t flushed();
+
+private:
+	Redic &redic;
+	RedicPfBuffer *buffer;
+};
+
+
+///Migration of keys from one server to another by DUMP and RESTORE, keeping
+///their type and time to live. The keys are scanned in batches, and each
+///worker, with connections of its own to both servers, pipelines DUMP and
+///PTTL of a batch on the source, then RESTORE ... REPLACE on the destination.
+class RedicMigrator
+{
+public:
+	///Move at most batch keys per pipeline, asked for by SCAN ... COUNT batch,
+	///by workers in parallel, at most rate keys per second if rate > 0.
+	RedicMigrator(int batch = 100, int workers = 4, int rate = 0);
+	~RedicMigrator();
+
+	///Set the server to migrate from, password NULL if none.
+	void source(const char *host, short port, const char *password = NULL, int db = 0);
+
+	///Set the server to migrate to, password NULL if none.
+	void destination(const char *host, short port, const char *password = NULL, int db = 0);
+
+	///Migrate the keys matching pattern, returning once all are done.
+	///Return the first connection error, or SERVER_ERR if any key failed.
+	int run(const char *pattern = "*");
+
+	///Progress, which may be read from another thread during run().
+	int64_t scanned();
+	int64_t migrated();
+
+	///Return the number of keys gone, e.g. expired, before they were dumped.
+	int64_t skipped();
+
+	///Return the number of keys which failed to migrate.
+	int64_t failed();
+
+	///Return the number of bytes of the values dumped.
+	int64_t bytes();
+
+	///Get the message of the first failure, and return its error, OK if none.
+	int first_error(string &message);
+
+private:
+	RedicMigration *migration;
+};
+
+
+///Consumer of the replication stream of a primary, as a replica would be.
+///After PSYNC, the RDB of a full resync is skipped or handed over in chunks,
+///then each command of the stream is parsed and handed over with the offset
+///it ends at. A sync() after a reconnection resumes from that offset.
+class RedicReplica
+{
+public:
+	///Receiver of the stream.
+	class Handler
+	{
+	public:
+		virtual ~Handler() {}
+
+		///Called with each command, an array of its arguments, e.g. SELECT,
+		///SET, MULTI or PING, and the replication offset just after it.
+		virtual void command(const Redic::Reply &args, int64_t offset) = 0;
+
+		///Called when the primary starts a full resync from offset, before the RDB.
+		virtual void resync(const string &replid, int64_t offset) {}
+
+		///Called with the RDB of a full resync in chunks; skipped by default.
+		virtual void snapshot(const char *data, int len) {}
+	};
+
+	///Stream through a buffer of bytes.
+	RedicReplica(Handler &handler, int buffer = 1024*1024);
+	~RedicReplica();
+
+	///Connect to the primary, and authenticate if password is not NULL.
+	int connect(const char *host, short port, const char *password = NULL);
+
+	///Set where to resume from, e.g. a position saved along with the data.
+	void resume(const char *replid, int64_t offset);
+
+	///Ask for the stream after the offset reached, or for a full resync if none.
+	///The primary replies in the stream, read by poll().
+	int sync();
+
+	///Read what arrives within wait milliseconds and hand it over, and
+	///acknowledge the offset to the primary once a second.
+	///Return the number of commands, or the error as a negative.
+	int poll(int wait);
+
+	///Return the replication id and the offset of the end of the last whole
+	///command handed over, which sync() resumes after and the acks report.
+	const string &replid();
+	int64_t offset();
+
+private:
+	RedicReplication *repl;
+};
+
+
+///Reader of RDB files, as dumped by save() or bgsave(), mapped in memory
+///rather than read. Keys and values stored as they are, e.g. in a listpack,
+///are handed over as views of the file; compressed ones and integers are
+///decoded into a buffer. Either way, they are only valid during the call.
+///Lists, sets, sorted sets and hashes may be in any of their encodings:
+///linked, ziplist, listpack, intset or quicklist. Streams and module values
+///are skipped, with their keys still handed over.
+class RedicRdb
+{
+public:
+	enum Type
+	{
+		TYPE_STRING,
+		TYPE_LIST,
+		TYPE_SET,
+		TYPE_ZSET,
+		TYPE_HASH,
+		TYPE_STREAM,
+		TYPE_MODULE,
+	};
+
+	///Key of the file with its value, valid during Handler::entry().
+	class Entry
+	{
+	public:
+		///Return the index of the file among those scanned, 0 for a single one.
+		int file() const;
+
+		///Return the index of the database of the key.
+		int db() const;
+
+		///Return the key, terminated with a '\0' only if decoded.
+		const char *key() const;
+		int key_length() const;
+
+		///Return the type of the value.
+		Type type() const;
+
+		///Return when the key expires, in milliseconds since the epoch, -1 if never.
+		int64_t expire() const;
+
+		///Get the value as the online operations do: a string as get(), a list
+		///as lrange(), a set as smembers(), a sorted set as zadd() takes it,
+		///in the order of the file, and a hash as hgetall().
+		///Return SYNTAX_ERR if the value is of another type, or is malformed.
+		int value(string &val) const;
+		int elements(Redic::List &elements) const;
+		int members(Redic::Set &members) const;
+		int members(Redic::ScoreList &members) const;
+		int fields(Redic::List &fields_values) const;
+
+		///Visit the elements of the value: a string, the elements of a list or
+		///set, each member then its score, each field then its value.
+		int visit(Redic::Visitor &visitor) const;
+
+	private:
+		friend class RedicRdbFile;
+
+		int index;
+		int dbnum;
+		int kind;
+		int64_t expiry;
+		const char *keydata;
+		int keylen;
+		string keybuf;
+		const char *start;
+		const char *finish;
+	};
+
+	///Receiver of the keys, in the order of the file.
+	class Handler
+	{
+	public:
+		virtual ~Handler() {}
+
+		///Return OK to go on, else the scan stops and returns it.
+		virtual int entry(const Entry &entry) = 0;
+	};
+
+	RedicRdb();
+	~RedicRdb();
+
+	///Map the file at path. Return RECORD_NUL if it cannot be read,
+	///or SYNTAX_ERR if it is not an RDB file.
+	int open(const char *path);
+
+	///Unmap the file, also done by open() and on destruction.
+	void unmap();
+
+	///Hand over every key of the file.
+	///Return SYNTAX_ERR if the file is malformed or has a value it cannot skip.
+	int scan(Handler &handler);
+
+	///Same as above for the files at paths, scanned by up to threads at once;
+	///the handler is then called from several threads, Entry::file() telling
+	///the files apart.
+	static int scan(const Redic::List &paths, Handler &handler, int threads = 4);
+
+private:
+	RedicRdbFile *file;
+};
+
+template <class OutputIt>
+class Redic::Inserter : public Redic::Visitor
+{
+public:
+	Inserter(OutputIt it) : out(it) {}
+
+	//a nil element, e.g. a missing key of mget, keeps its place as an empty string
+	int visit(int index, const char *data, int len)
+	{
+		*out = len < 0 ? string() : string(data, len);
+		++out;
+		return OK;
+	}
+
+private:
+	OutputIt out;
+};
+
+template <class OutputIt>
+class Redic::PairInserter : public Redic::Visitor
+{
+public:
+	PairInserter(OutputIt it) : out(it) {}
+
+	int visit(int index, const char *data, int len)
+	{
+		if (index % 2 == 0)
+		{
+			if (len < 0)
+				field.clear();
+			else
+				field.assign(data, len);
+
+			return OK;
+		}
+
+		*out = std::pair<string, string>(field, len < 0 ? string() : string(data, len));
+		++out;
+		return OK;
+	}
+
+private:
+	OutputIt out;
+	string field;
 };
 
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::keys(const char *pattern, OutputIt keys)
+{
+	Inserter<OutputIt> visitor(keys);
+	return this->keys(pattern, visitor);
+}
+
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::mget(const List &keys, OutputIt values)
+{
+	Inserter<OutputIt> visitor(values);
+	return mget(keys, visitor);
+}
+
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::lrange(const char *key, int start, int range, OutputIt elements)
+{
+	Inserter<OutputIt> visitor(elements);
+	return lrange(key, start, range, visitor);
+}
+
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::smembers(const char *key, OutputIt members)
+{
+	Inserter<OutputIt> visitor(members);
+	return smembers(key, visitor);
+}
+
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::zrange(const char *key, int start, int stop, OutputIt elements)
+{
+	Inserter<OutputIt> visitor(elements);
+	return zrange(key, start, stop, visitor);
+}
+
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::hmget(const char *key, const List &fields, OutputIt values)
+{
+	Inserter<OutputIt> visitor(values);
+	return hmget(key, fields, visitor);
+}
+
+template <class OutputIt>
+typename Redic::EnableIf<!Redic::IsVisitor<OutputIt>::value, int>::type
+Redic::hgetall(const char *key, OutputIt fileds_values)
+{
+	PairInserter<OutputIt> visitor(fileds_values);
+	return hgetall(key, visitor);
+}
+
 #endif //_REDIC_H_
@@ -21,13 +21,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <math.h>
 #include <gtest/gtest.h>
+#include <map>
+#include <vector>
 
 #ifdef WIN32
 #include <winsock2.h>
 #define sleep(n) Sleep(n)
 #else
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #define sleep(n) usleep(n)
 #endif
 
@@ -35,6 +42,8 @@
 
 typedef Redic::List List;
 typedef Redic::Set Set;
+typedef Redic::Array Array;
+typedef Redic::Reply Reply;
 
 static string serverHost;
 static string serverPort;
@@ -475,6 +484,1709 @@ TEST(RedicTest, HashTest2)
 	SUCCEED();
 }
 
+//test contiguous array result
+TEST(RedicTest, ArrayTest)
+{
+	Redic rdc;
+    Array array;
+    List list;
+    Set set;
+    int len;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+	ASSERT_EQ(Redic::OK, rdc.set("key1", "val1"));
+	ASSERT_EQ(Redic::OK, rdc.set("key2", "val2"));
+    list.push_back("key1");
+    list.push_back("key2");
+    ASSERT_EQ(Redic::OK, rdc.mget(list, array));
+    ASSERT_EQ(2, array.size());
+    ASSERT_STREQ("val1", array[0]);
+    ASSERT_EQ("val2", array.str(1));
+    ASSERT_EQ(4, array.length(1));
+
+	ASSERT_EQ(Redic::OK, rdc.rpush("keyl1", "val1", len));
+	ASSERT_EQ(Redic::OK, rdc.rpush("keyl1", "val2", len));
+	ASSERT_EQ(Redic::OK, rdc.rpush("keyl1", "val3", len));
+	ASSERT_EQ(Redic::OK, rdc.lrange("keyl1", 0, -1, array));
+    ASSERT_EQ(3, array.size());
+    ASSERT_STREQ("val3", array[2]);
+
+	ASSERT_EQ(Redic::OK, rdc.sadd("keys1", "val1"));
+	ASSERT_EQ(Redic::OK, rdc.sadd("keys1", "val2"));
+	ASSERT_EQ(Redic::OK, rdc.sadd("keys2", "val2"));
+	ASSERT_EQ(Redic::OK, rdc.smembers("keys1", array));
+    ASSERT_EQ(2, array.size());
+
+    set.insert("keys1");
+    set.insert("keys2");
+	ASSERT_EQ(Redic::OK, rdc.sinter(set, array));
+    ASSERT_EQ(1, array.size());
+    ASSERT_STREQ("val2", array[0]);
+
+    array.clear();
+    ASSERT_TRUE(array.empty());
+    array.push_back("abc", 3);
+    ASSERT_EQ("abc", array.str(0));
+
+	SUCCEED();
+}
+
+class LengthVisitor : public Redic::Visitor
+{
+public:
+    int total;
+
+    LengthVisitor() : total(0) {}
+
+    int visit(int index, const char *data, int len)
+    {
+        total += len;
+        return Redic::OK;
+    }
+};
+
+//test output iterator and visitor overloads
+TEST(RedicTest, VisitorTest)
+{
+	Redic rdc;
+    List list;
+    std::vector<string> vec;
+    std::map<string, string> map;
+    LengthVisitor visitor;
+    int len;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+	ASSERT_EQ(Redic::OK, rdc.set("key1", "val1"));
+	ASSERT_EQ(Redic::OK, rdc.set("key2", "val22"));
+    list.push_back("key1");
+    list.push_back("key2");
+    ASSERT_EQ(Redic::OK, rdc.mget(list, std::back_inserter(vec)));
+    ASSERT_EQ(2, vec.size());
+    ASSERT_EQ("val22", vec[1]);
+    ASSERT_EQ(Redic::OK, rdc.mget(list, visitor));
+    ASSERT_EQ(9, visitor.total);
+
+    string big(3000, 'x');
+	ASSERT_EQ(Redic::OK, rdc.set("key3", big.c_str()));
+    list.push_back("key3");
+    rdc.arena_reserve(64);
+    ASSERT_EQ(Redic::OK, rdc.mget(list, visitor));
+    ASSERT_EQ(3018, visitor.total);
+    ASSERT_LE(3000, rdc.arena_peak());
+    list.pop_back();
+
+    vec.clear();
+	ASSERT_EQ(Redic::OK, rdc.keys("key*", std::back_inserter(vec)));
+    ASSERT_EQ(3, vec.size());
+
+    vec.clear();
+	ASSERT_EQ(Redic::OK, rdc.rpush("keyl1", "val1", len));
+	ASSERT_EQ(Redic::OK, rdc.rpush("keyl1", "val2", len));
+	ASSERT_EQ(Redic::OK, rdc.lrange("keyl1", 0, -1, std::back_inserter(vec)));
+    ASSERT_EQ(2, vec.size());
+    ASSERT_EQ("val1", vec[0]);
+
+    ASSERT_EQ(Redic::OK, rdc.hset("keyh1", "fld1", "val1"));
+    ASSERT_EQ(Redic::OK, rdc.hset("keyh1", "fld2", "val2"));
+    ASSERT_EQ(Redic::OK, rdc.hgetall("keyh1", std::inserter(map, map.end())));
+    ASSERT_EQ(2, map.size());
+    ASSERT_EQ("val2", map["fld2"]);
+
+    //a missing key or field keeps its place, empty
+    vec.clear();
+    list.push_back("key?");
+    ASSERT_EQ(Redic::OK, rdc.mget(list, std::back_inserter(vec)));
+    ASSERT_EQ(3, vec.size());
+    ASSERT_EQ("", vec[2]);
+
+    vec.clear();
+    list.clear();
+    list.push_back("fld?");
+    list.push_back("fld1");
+    ASSERT_EQ(Redic::OK, rdc.hmget("keyh1", list, std::back_inserter(vec)));
+    ASSERT_EQ(2, vec.size());
+    ASSERT_EQ("", vec[0]);
+    ASSERT_EQ("val1", vec[1]);
+
+	SUCCEED();
+}
+
+//test hash map result
+TEST(RedicTest, HashMapTest)
+{
+	Redic rd;
+    Redic::Hash hash;
+    List list;
+    char fld[16];
+    char val[16];
+
+	ASSERT_EQ(Redic::OK, rd.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rd.auth("redic"));
+    ASSERT_EQ(Redic::OK, rd.select(2));
+    ASSERT_EQ(Redic::OK, rd.flushdb());
+
+    for (int i=0; i<200; i++)
+    {
+        sprintf(fld, "fld%d", i);
+        sprintf(val, "val%d", i);
+        ASSERT_EQ(Redic::OK, rd.hset("keyh1", fld, val));
+    }
+
+    ASSERT_EQ(Redic::OK, rd.hgetall("keyh1", hash));
+    ASSERT_EQ(200, hash.size());
+    ASSERT_STREQ("val0", hash.find("fld0"));
+    ASSERT_STREQ("val199", hash.find("fld199"));
+    ASSERT_TRUE(hash.find("fldx") == NULL);
+
+    int i = hash.index("fld42");
+    ASSERT_LE(0, i);
+    ASSERT_STREQ("fld42", hash.field(i));
+    ASSERT_EQ(5, hash.value_length(i));
+
+    list.push_back("fld7");
+    list.push_back("fld8");
+    ASSERT_EQ(Redic::OK, rd.hmget("keyh1", list, hash));
+    ASSERT_EQ(2, hash.size());
+    ASSERT_STREQ("val8", hash.find("fld8"));
+    ASSERT_TRUE(hash.find("fld0") == NULL);
+
+	SUCCEED();
+}
+
+//test generic reply and nil
+TEST(RedicTest, ReplyTest)
+{
+	Redic rdc;
+    Reply reply;
+    Array array;
+    List args;
+    string val;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+	ASSERT_EQ(Redic::OK, rdc.set("key1", ""));
+	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+    ASSERT_EQ("", val);
+	ASSERT_EQ(Redic::RECORD_NUL, rdc.get("key?", val));
+
+    args.push_back("key1");
+    args.push_back("key?");
+    ASSERT_EQ(Redic::OK, rdc.mget(args, array));
+    ASSERT_EQ(2, array.size());
+    ASSERT_FALSE(array.nil(0));
+    ASSERT_EQ(0, array.length(0));
+    ASSERT_TRUE(array.nil(1));
+
+    args.clear();
+    args.push_back("MULTI");
+	ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+    ASSERT_EQ(Reply::TYPE_STATUS, reply.type());
+
+    args.clear();
+    args.push_back("INCR");
+    args.push_back("keyn");
+	ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+    ASSERT_EQ("QUEUED", reply.str());
+
+    args.clear();
+    args.push_back("GET");
+    args.push_back("key?");
+	ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+
+    args.clear();
+    args.push_back("LPOP");
+    args.push_back("key1");
+	ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+
+    args.clear();
+    args.push_back("EXEC");
+	ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+    ASSERT_EQ(Reply::TYPE_ARRAY, reply.type());
+    ASSERT_EQ(3, reply.count());
+    ASSERT_EQ(Reply::TYPE_INTEGER, reply.type(reply.child(0, 0)));
+    ASSERT_EQ(1, reply.integer(reply.child(0, 0)));
+    ASSERT_EQ(Reply::TYPE_NIL, reply.type(reply.child(0, 1)));
+    ASSERT_EQ(Reply::TYPE_ERROR, reply.type(reply.child(0, 2)));
+    ASSERT_EQ(-1, reply.child(0, 3));
+
+    args.clear();
+    args.push_back("NOSUCHCMD");
+	ASSERT_EQ(Redic::SERVER_ERR, rdc.command(args, reply));
+    ASSERT_EQ(Reply::TYPE_ERROR, reply.type());
+
+	SUCCEED();
+}
+
+//test incremental parser, fed byte by byte
+TEST(RedicTest, ParserTest)
+{
+    Redic::Parser parser;
+    Reply reply;
+    const char *data = "*3\r\n$3\r\nfoo\r\n*2\r\n:42\r\n$-1\r\n$0\r\n\r\n+OK\r\n";
+    int len = strlen(data);
+    int pos = 0;
+
+    parser.reset(reply);
+
+    while (!parser.done())
+    {
+        ASSERT_LT(pos, len);
+        ASSERT_LE(0, parser.feed(data+pos, 1));
+        pos++;
+    }
+
+    ASSERT_EQ(Reply::TYPE_ARRAY, reply.type());
+    ASSERT_EQ(3, reply.count());
+    ASSERT_EQ("foo", reply.str(reply.child(0, 0)));
+    int sub = reply.child(0, 1);
+    ASSERT_EQ(2, reply.count(sub));
+    ASSERT_EQ(42, reply.integer(reply.child(sub, 0)));
+    ASSERT_EQ(Reply::TYPE_NIL, reply.type(reply.child(sub, 1)));
+    ASSERT_EQ(Reply::TYPE_STRING, reply.type(reply.child(0, 2)));
+    ASSERT_EQ(0, reply.length(reply.child(0, 2)));
+
+    //the next reply of a pipeline is left unconsumed
+    parser.reset();
+    ASSERT_EQ(5, parser.feed(data+pos, len-pos));
+    ASSERT_TRUE(parser.done());
+    ASSERT_EQ("OK", parser.reply().str());
+
+    parser.reset();
+    ASSERT_EQ(-1, parser.feed("?\r\n", 3));
+
+	SUCCEED();
+}
+
+class KeyPush : public Redic::PushHandler
+{
+public:
+    void push(const Reply &message)
+    {
+        keys.push_back(message.str(message.child(message.child(0, 1), 0)));
+    }
+
+    List keys;
+};
+
+TEST(RedicTest, Resp3Test)
+{
+	Redic rdc;
+	Redic other;
+    Redic::Hash hash;
+    Redic::Parser parser;
+    KeyPush handler;
+    Reply reply;
+    List list;
+    List args;
+    Set set;
+    string val;
+    double score;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(2, rdc.protocol());
+    ASSERT_EQ(Redic::OK, rdc.hello(3));
+    ASSERT_EQ(3, rdc.protocol());
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    ASSERT_EQ(Redic::OK, rdc.hset("keyh1", "fld1", "val1"));
+    ASSERT_EQ(Redic::OK, rdc.hset("keyh1", "fld2", "val2"));
+    ASSERT_EQ(Redic::OK, rdc.hgetall("keyh1", list));
+    ASSERT_EQ(4, list.size());
+    ASSERT_EQ(Redic::OK, rdc.hgetall("keyh1", hash));
+    ASSERT_STREQ("val2", hash.find("fld2"));
+
+    args.push_back("HGETALL");
+    args.push_back("keyh1");
+    ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+    ASSERT_EQ(Reply::TYPE_MAP, reply.type());
+    ASSERT_EQ(4, reply.count());
+
+    ASSERT_EQ(Redic::OK, rdc.sadd("keys1", "mem1"));
+    ASSERT_EQ(Redic::OK, rdc.smembers("keys1", set));
+    ASSERT_EQ(1, set.count("mem1"));
+
+    ASSERT_EQ(Redic::OK, rdc.zadd("keyz1", 1.5, "mem1"));
+    ASSERT_EQ(Redic::OK, rdc.zscore("keyz1", "mem1", score));
+    ASSERT_DOUBLE_EQ(1.5, score);
+	ASSERT_EQ(Redic::RECORD_NUL, rdc.get("key?", val));
+
+    //invalidation messages arrive ahead of the next reply
+    rdc.on_push(&handler);
+    args.clear();
+    args.push_back("CLIENT");
+    args.push_back("TRACKING");
+    args.push_back("ON");
+    ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+	ASSERT_EQ(Redic::OK, rdc.set("key1", "val1"));
+	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+
+	ASSERT_EQ(Redic::OK, other.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, other.auth("redic"));
+    ASSERT_EQ(Redic::OK, other.select(2));
+	ASSERT_EQ(Redic::OK, other.set("key1", "val2"));
+
+	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+    ASSERT_EQ("val2", val);
+    ASSERT_EQ(1, handler.keys.size());
+    ASSERT_EQ("key1", handler.keys.front());
+
+    //attributes are dropped, the reply is the value they annotate
+    const char *data = "|1\r\n+ttl\r\n:3\r\n%2\r\n+a\r\n,1.5\r\n=8\r\ntxt:abcd\r\n~2\r\n#t\r\n_\r\n";
+    parser.reset(reply);
+    ASSERT_EQ((int)strlen(data), parser.feed(data, strlen(data)));
+    ASSERT_TRUE(parser.done());
+    ASSERT_EQ(Reply::TYPE_MAP, reply.type());
+    ASSERT_EQ(4, reply.count());
+    ASSERT_DOUBLE_EQ(1.5, reply.real(reply.child(0, 1)));
+    ASSERT_EQ("txt:abcd", reply.str(reply.child(0, 2)));
+    int sub = reply.child(0, 3);
+    ASSERT_EQ(Reply::TYPE_SET, reply.type(sub));
+    ASSERT_EQ(1, reply.integer(reply.child(sub, 0)));
+    ASSERT_EQ(Reply::TYPE_NIL, reply.type(reply.child(sub, 1)));
+
+	SUCCEED();
+}
+
+TEST(RedicTest, CacheTest)
+{
+    string val;
+
+    //RESP2 with a redirect connection, then RESP3 with push messages
+    for (int proto=2; proto<=3; proto++)
+    {
+    	Redic rdc;
+    	Redic other;
+
+    	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+    	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+        ASSERT_EQ(Redic::OK, rdc.hello(proto));
+        ASSERT_EQ(Redic::OK, rdc.select(2));
+        ASSERT_EQ(Redic::OK, rdc.flushdb());
+        ASSERT_EQ(Redic::OK, rdc.enable_cache(1 << 20));
+
+    	ASSERT_EQ(Redic::OK, other.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+    	ASSERT_EQ(Redic::OK, other.auth("redic"));
+        ASSERT_EQ(Redic::OK, other.select(2));
+    	ASSERT_EQ(Redic::OK, other.set("key1", "val1"));
+    	ASSERT_EQ(Redic::OK, other.hset("keyh1", "fld1", "val1"));
+
+    	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+    	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+        ASSERT_EQ("val1", val);
+    	ASSERT_EQ(Redic::RECORD_NUL, rdc.get("key?", val));
+    	ASSERT_EQ(Redic::RECORD_NUL, rdc.get("key?", val));
+    	ASSERT_EQ(Redic::OK, rdc.hget("keyh1", "fld1", val));
+    	ASSERT_EQ(Redic::OK, rdc.hget("keyh1", "fld1", val));
+        ASSERT_EQ("val1", val);
+        ASSERT_EQ(3, rdc.cache_hits());
+        ASSERT_EQ(3, rdc.cache_misses());
+
+        //a write by another client invalidates the key
+    	ASSERT_EQ(Redic::OK, other.set("key1", "val2"));
+    	ASSERT_EQ(Redic::OK, other.hset("keyh1", "fld1", "val2"));
+        sleep(100*1000);
+
+    	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+        ASSERT_EQ("val2", val);
+    	ASSERT_EQ(Redic::OK, rdc.hget("keyh1", "fld1", val));
+        ASSERT_EQ("val2", val);
+        ASSERT_EQ(3, rdc.cache_hits());
+
+        rdc.disable_cache();
+        ASSERT_EQ(0, rdc.cache_hits());
+    	ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+    }
+
+	SUCCEED();
+}
+
+TEST(RedicTest, TtlCacheTest)
+{
+	Redic rdc;
+	Redic other;
+    RedicTtlCache cache(rdc, 200, 100, 4);
+    List list;
+    Set set;
+    string val;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+	ASSERT_EQ(Redic::OK, other.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, other.auth("redic"));
+    ASSERT_EQ(Redic::OK, other.select(2));
+	ASSERT_EQ(Redic::OK, other.hset("keyh1", "fld1", "val1"));
+	ASSERT_EQ(Redic::OK, other.sadd("keys1", "mem1"));
+
+	ASSERT_EQ(Redic::OK, cache.set("key1", "val1"));
+	ASSERT_EQ(Redic::OK, cache.get("key1", val));
+	ASSERT_EQ(Redic::OK, cache.get("key1", val));
+    ASSERT_EQ("val1", val);
+	ASSERT_EQ(Redic::RECORD_NUL, cache.get("key?", val));
+	ASSERT_EQ(Redic::RECORD_NUL, cache.get("key?", val));
+	ASSERT_EQ(Redic::OK, cache.hget("keyh1", "fld1", val));
+	ASSERT_EQ(Redic::OK, cache.hgetall("keyh1", list));
+	ASSERT_EQ(Redic::OK, cache.hgetall("keyh1", list));
+    ASSERT_EQ(2, list.size());
+	ASSERT_EQ(Redic::OK, cache.smembers("keys1", set));
+	ASSERT_EQ(Redic::OK, cache.smembers("keys1", set));
+    ASSERT_EQ(1, set.size());
+    ASSERT_EQ(4, cache.hits());
+    ASSERT_EQ(5, cache.misses());
+
+    //writes through the cache drop the results of their key
+	ASSERT_EQ(Redic::OK, cache.hset("keyh1", "fld1", "val2"));
+	ASSERT_EQ(Redic::OK, cache.hget("keyh1", "fld1", val));
+    ASSERT_EQ("val2", val);
+	ASSERT_EQ(Redic::OK, cache.del("key1"));
+	ASSERT_EQ(Redic::RECORD_NUL, cache.get("key1", val));
+
+    //writes of others show up once the results expire
+	ASSERT_EQ(Redic::OK, other.sadd("keys1", "mem2"));
+	ASSERT_EQ(Redic::OK, cache.smembers("keys1", set));
+    ASSERT_EQ(1, set.size());
+    sleep(300*1000);
+	ASSERT_EQ(Redic::OK, cache.smembers("keys1", set));
+    ASSERT_EQ(2, set.size());
+
+	SUCCEED();
+}
+
+class DoubleUp : public Redic::Optimistic
+{
+public:
+    DoubleUp(Redic &other) : other(other), tries(0) {}
+
+    int prepare(Redic &redic, Redic::Transaction &tx)
+    {
+        string val;
+        char buf[16];
+
+        int rc = redic.get("key1", val);
+        if (rc != Redic::OK)
+            return rc;
+
+        //a concurrent write makes the first try fail
+        if (tries++ == 0)
+            other.set("key1", "5");
+
+        sprintf(buf, "%d", atoi(val.c_str())*2);
+        tx.add("SET", "key1", buf);
+        return Redic::OK;
+    }
+
+    Redic &other;
+    int tries;
+};
+
+TEST(RedicTest, TransactionTest)
+{
+	Redic rdc;
+	Redic other;
+    Redic::Transaction tx;
+    List keys;
+    string val;
+    int64_t num;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    tx.add("SET", "key1", "1");
+    tx.add("INCR", "key1");
+    tx.add("GET", "key1");
+    tx.add("LPOP", "key1");
+    tx.add("GET", "key?");
+    ASSERT_EQ(5, tx.size());
+    ASSERT_EQ(Redic::OK, rdc.exec(tx));
+    ASSERT_EQ(5, tx.reply().count());
+    ASSERT_EQ(Redic::OK, tx.str(0, val));
+    ASSERT_EQ("OK", val);
+    ASSERT_EQ(Redic::OK, tx.integer(1, num));
+    ASSERT_EQ(2, num);
+    ASSERT_EQ(Redic::OK, tx.str(2, val));
+    ASSERT_EQ("2", val);
+    ASSERT_EQ(Redic::SERVER_ERR, tx.result(3));
+    ASSERT_EQ(Redic::RECORD_NUL, tx.result(4));
+
+    //a command failing to queue aborts the transaction
+    tx.clear();
+    tx.add("INCR", "key1");
+    tx.add("NOSUCHCMD");
+    ASSERT_EQ(Redic::SERVER_ERR, rdc.exec(tx));
+    ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+    ASSERT_EQ("2", val);
+
+	ASSERT_EQ(Redic::OK, other.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, other.auth("redic"));
+    ASSERT_EQ(Redic::OK, other.select(2));
+
+    DoubleUp body(other);
+    keys.push_back("key1");
+    ASSERT_EQ(Redic::OK, rdc.exec(keys, body, tx, 3));
+    ASSERT_EQ(2, body.tries);
+    ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+    ASSERT_EQ("10", val);
+
+    DoubleUp never(other);
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.exec(keys, never, tx, 1));
+
+	SUCCEED();
+}
+
+TEST(RedicTest, ScriptTest)
+{
+	Redic rdc;
+    Redic::Script incr("return redis.call('INCRBY', KEYS[1], ARGV[1])");
+    Reply reply;
+    List keys;
+    List args;
+
+    ASSERT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", Redic::Script("abc").sha1());
+    ASSERT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", Redic::Script("").sha1());
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    args.push_back("SCRIPT");
+    args.push_back("FLUSH");
+    ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+
+    //unknown to the server first, then run by its SHA1
+    keys.push_back("key1");
+    args.clear();
+    args.push_back("3");
+    ASSERT_EQ(Redic::OK, rdc.eval(incr, keys, args, reply));
+    ASSERT_EQ(3, reply.integer());
+    ASSERT_EQ(Redic::OK, rdc.eval(incr, keys, args, reply));
+    ASSERT_EQ(6, reply.integer());
+
+    args.clear();
+    args.push_back("SCRIPT");
+    args.push_back("EXISTS");
+    args.push_back(incr.sha1());
+    ASSERT_EQ(Redic::OK, rdc.command(args, reply));
+    ASSERT_EQ(1, reply.integer(reply.child(0, 0)));
+    ASSERT_EQ(Redic::OK, rdc.script_load(incr));
+
+	SUCCEED();
+}
+
+TEST(RedicTest, VariadicTest)
+{
+	Redic rdc;
+    Redic::ScoreList scores;
+    List members;
+    List pairs;
+    List keys;
+    char buf[16];
+    int num;
+    double score;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    //more members than one command takes
+    for (int i=0; i<3000; i++)
+    {
+        sprintf(buf, "mem%d", i);
+        members.push_back(buf);
+        scores.push_back(std::make_pair(i + 0.1, string(buf)));
+    }
+
+    ASSERT_EQ(Redic::OK, rdc.sadd("keys1", members, num));
+    ASSERT_EQ(3000, num);
+    ASSERT_EQ(Redic::OK, rdc.sadd("keys1", members, num));
+    ASSERT_EQ(0, num);
+    ASSERT_EQ(Redic::OK, rdc.srem("keys1", members, num));
+    ASSERT_EQ(3000, num);
+
+    ASSERT_EQ(Redic::OK, rdc.rpush("keyl1", members, num));
+    ASSERT_EQ(3000, num);
+    ASSERT_EQ(Redic::OK, rdc.lpush("keyl1", members, num));
+    ASSERT_EQ(6000, num);
+
+    ASSERT_EQ(Redic::OK, rdc.zadd("keyz1", scores, num));
+    ASSERT_EQ(3000, num);
+    ASSERT_EQ(Redic::OK, rdc.zscore("keyz1", "mem2999", score));
+    ASSERT_DOUBLE_EQ(2999.1, score);
+    ASSERT_EQ(Redic::OK, rdc.zrem("keyz1", members, num));
+    ASSERT_EQ(3000, num);
+
+    pairs.push_back("fld1");
+    pairs.push_back("val1");
+    pairs.push_back("fld2");
+    pairs.push_back("val2");
+    ASSERT_EQ(Redic::OK, rdc.hset("keyh1", pairs, num));
+    ASSERT_EQ(2, num);
+    pairs.push_back("fld3");
+    ASSERT_EQ(Redic::SYNTAX_ERR, rdc.hset("keyh1", pairs, num));
+    keys.push_back("fld1");
+    keys.push_back("fld?");
+    ASSERT_EQ(Redic::OK, rdc.hdel("keyh1", keys, num));
+    ASSERT_EQ(1, num);
+
+    keys.clear();
+    keys.push_back("keyl1");
+    keys.push_back("keyh1");
+    keys.push_back("key?");
+    ASSERT_EQ(Redic::OK, rdc.del(keys, num));
+    ASSERT_EQ(2, num);
+
+    //an error of one chunk is reported once all replies are read
+    members.push_back("mem0");
+    ASSERT_EQ(Redic::OK, rdc.set("key1", "val1"));
+    ASSERT_EQ(Redic::SERVER_ERR, rdc.sadd("key1", members, num));
+    ASSERT_EQ(Redic::OK, rdc.sadd("keys2", members, num));
+    ASSERT_EQ(3000, num);
+
+	SUCCEED();
+}
+
+TEST(RedicTest, MsetTest)
+{
+	Redic rdc;
+    List pairs;
+    List keys;
+    List values;
+    Array karr;
+    Array varr;
+    std::vector<int> results;
+    char buf[16];
+    string val;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    pairs.push_back("key1");
+    pairs.push_back("val1");
+    pairs.push_back("key2");
+    pairs.push_back("val2");
+    ASSERT_EQ(Redic::OK, rdc.mset(pairs));
+    keys.push_back("key1");
+    keys.push_back("key2");
+    ASSERT_EQ(Redic::OK, rdc.mget(keys, values));
+    ASSERT_EQ("val2", values.back());
+
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.msetnx(pairs));
+    pairs.clear();
+    pairs.push_back("key3");
+    pairs.push_back("val3");
+    ASSERT_EQ(Redic::OK, rdc.msetnx(pairs));
+
+    //more keys than one write takes
+    for (int i=0; i<2500; i++)
+    {
+        sprintf(buf, "keyx%d", i);
+        karr.push_back(buf, strlen(buf));
+        sprintf(buf, "valx%d", i);
+        varr.push_back(buf, strlen(buf));
+    }
+
+    ASSERT_EQ(Redic::OK, rdc.setex(karr, varr, 100, results));
+    ASSERT_EQ(2500, (int)results.size());
+    ASSERT_EQ(Redic::OK, results[2499]);
+    ASSERT_EQ(Redic::OK, rdc.get("keyx2499", val));
+    ASSERT_EQ("valx2499", val);
+
+    ASSERT_EQ(Redic::SERVER_ERR, rdc.setex(karr, varr, 0, results));
+    ASSERT_EQ(2500, (int)results.size());
+    ASSERT_EQ(Redic::SERVER_ERR, results[0]);
+    ASSERT_EQ(Redic::OK, rdc.get("key1", val));
+
+    //values straight from mget, one of them nil
+    keys.clear();
+    keys.push_back("key1");
+    keys.push_back("key?");
+    karr.clear();
+    karr.push_back("keyn1", 5);
+    karr.push_back("keyn2", 5);
+    ASSERT_EQ(Redic::OK, rdc.mget(keys, varr));
+    ASSERT_TRUE(varr.nil(1));
+    ASSERT_EQ(Redic::SYNTAX_ERR, rdc.setex(karr, varr, 100, results));
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.get("keyn1", val));
+
+	SUCCEED();
+}
+
+TEST(RedicTest, StreamTest)
+{
+	Redic rdc;
+    Redic::Entries entries;
+    List fields;
+    List keys;
+    string id;
+    string next;
+    int length;
+    int acked;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    ASSERT_EQ(Redic::OK, rdc.xgroup_create("events", "workers"));
+    ASSERT_EQ(Redic::SERVER_ERR, rdc.xgroup_create("events", "workers"));
+
+    fields.push_back("user");
+    fields.push_back("alice");
+    fields.push_back("action");
+    fields.push_back("login");
+    ASSERT_EQ(Redic::OK, rdc.xadd("events", fields, id));
+    ASSERT_FALSE(id.empty());
+    ASSERT_EQ(Redic::OK, rdc.xadd("events", fields, id));
+    ASSERT_EQ(Redic::OK, rdc.xlen("events", length));
+    ASSERT_EQ(2, length);
+
+    keys.push_back("events");
+    ASSERT_EQ(Redic::OK, rdc.xreadgroup("workers", "w1", keys, 10, 100, entries));
+    ASSERT_EQ(2, entries.size());
+    ASSERT_EQ("events", entries.stream(1));
+    ASSERT_EQ(id, entries.id(1));
+    ASSERT_EQ(2, entries.fields(0));
+    ASSERT_STREQ("action", entries.field(0, 1));
+    ASSERT_STREQ("login", entries.value(0, 1));
+    ASSERT_EQ(5, entries.value_length(0, 1));
+
+    //nothing new within the block time
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.xreadgroup("workers", "w1", keys, 10, 50, entries));
+    ASSERT_EQ(0, entries.size());
+
+    //w2 takes over what w1 left pending
+    ASSERT_EQ(Redic::OK, rdc.xautoclaim("events", "workers", "w2", 0, "0-0", 10, entries, next));
+    ASSERT_EQ(2, entries.size());
+    ASSERT_STREQ("alice", entries.value(1, 0));
+    ASSERT_EQ("0-0", next);
+
+    ASSERT_EQ(Redic::OK, rdc.xack("events", "workers", entries, acked));
+    ASSERT_EQ(2, acked);
+    ASSERT_EQ(Redic::OK, rdc.xack("events", "workers", entries, acked));
+    ASSERT_EQ(0, acked);
+
+	SUCCEED();
+}
+
+class Drain : public RedicWorker::Handler
+{
+public:
+	void process(const string &queue, const List &elements)
+	{
+		batches.push_back(queue);
+		total.insert(total.end(), elements.begin(), elements.end());
+	}
+
+	List batches;
+	List total;
+};
+
+TEST(RedicTest, BlockingPopTest)
+{
+	Redic rdc;
+    List keys;
+    string key;
+    string val;
+    int length;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    keys.push_back("jobs1");
+    keys.push_back("jobs2");
+
+    //longer than the socket timeout
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.blpop(keys, 1500, key, val));
+
+    ASSERT_EQ(Redic::OK, rdc.rpush("jobs2", "a", length));
+    ASSERT_EQ(Redic::OK, rdc.rpush("jobs2", "b", length));
+    ASSERT_EQ(Redic::OK, rdc.blpop(keys, 100, key, val));
+    ASSERT_EQ("jobs2", key);
+    ASSERT_EQ("a", val);
+    ASSERT_EQ(Redic::OK, rdc.brpop(keys, 100, key, val));
+    ASSERT_EQ("b", val);
+
+    ASSERT_EQ(Redic::OK, rdc.rpush("jobs1", "c", length));
+    ASSERT_EQ(Redic::OK, rdc.blmove("jobs1", "done", "LEFT", "RIGHT", 100, val));
+    ASSERT_EQ("c", val);
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.blmove("jobs1", "done", "LEFT", "RIGHT", 100, val));
+
+    Drain drain;
+    RedicWorker worker(rdc, drain, 3);
+    worker.add("jobs1");
+    worker.add("jobs2");
+
+    keys.clear();
+    keys.push_back("1");
+    keys.push_back("2");
+    keys.push_back("3");
+    keys.push_back("4");
+    ASSERT_EQ(Redic::OK, rdc.rpush("jobs1", keys, length));
+    ASSERT_EQ(Redic::OK, rdc.rpush("jobs2", "x", length));
+
+    ASSERT_EQ(3, worker.work(100));
+    ASSERT_EQ(1, worker.work(100));
+    ASSERT_EQ("jobs2", drain.batches.back());
+    ASSERT_EQ(1, worker.work(100));
+    ASSERT_EQ(0, worker.work(100));
+    ASSERT_EQ(5, worker.processed());
+    ASSERT_EQ("4", drain.total.back());
+
+	SUCCEED();
+}
+
+TEST(RedicTest, Int64Test)
+{
+	Redic rdc;
+    Redic::ScoreList scores;
+    int64_t big;
+    int small;
+    double score;
+    int added;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    //past 2^31 the int forms fail rather than wrap
+    ASSERT_EQ(Redic::OK, rdc.incrby("counter", (int64_t)INT_MAX, big));
+    ASSERT_EQ(Redic::OK, rdc.incr("counter", big));
+    ASSERT_EQ((int64_t)INT_MAX + 1, big);
+    ASSERT_EQ(Redic::SYNTAX_ERR, rdc.incr("counter", small));
+    ASSERT_EQ(Redic::OK, rdc.decrby("counter", (int64_t)1 << 40, big));
+    ASSERT_EQ((int64_t)INT_MAX + 2 - ((int64_t)1 << 40), big);
+    ASSERT_EQ(Redic::OK, rdc.hincrby("hash", "field", (int64_t)1 << 33, big));
+    ASSERT_EQ((int64_t)1 << 33, big);
+    ASSERT_EQ(Redic::OK, rdc.dbsize(big));
+    ASSERT_EQ(2, big);
+
+    //scores read back as the very same doubles
+    ASSERT_EQ(Redic::OK, rdc.zadd("zset", 0.1, "a"));
+    ASSERT_EQ(Redic::OK, rdc.zscore("zset", "a", score));
+    ASSERT_EQ(0.1, score);
+    ASSERT_EQ(Redic::OK, rdc.zadd("zset", 1e20, "b"));
+    ASSERT_EQ(Redic::OK, rdc.zscore("zset", "b", score));
+    ASSERT_EQ(1e20, score);
+    scores.push_back(std::make_pair(1.0/3, string("c")));
+    scores.push_back(std::make_pair(-HUGE_VAL, string("d")));
+    ASSERT_EQ(Redic::OK, rdc.zadd("zset", scores, added));
+    ASSERT_EQ(2, added);
+    ASSERT_EQ(Redic::OK, rdc.zscore("zset", "c", score));
+    ASSERT_EQ(1.0/3, score);
+    ASSERT_EQ(Redic::OK, rdc.zscore("zset", "d", score));
+    ASSERT_EQ(-HUGE_VAL, score);
+    ASSERT_EQ(Redic::OK, rdc.zincrby("zset", 0.2, "a", score));
+    ASSERT_EQ(0.1 + 0.2, score);
+    ASSERT_EQ(Redic::OK, rdc.zcard("zset", big));
+    ASSERT_EQ(4, big);
+
+	SUCCEED();
+}
+
+TEST(RedicTest, ZRangeScoresTest)
+{
+	Redic rdc;
+    Redic::ScoreList members;
+    Redic::Scores scores;
+    Redic::Array elements;
+    char buf[16];
+    int added;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    for (int i=0; i<1000; i++)
+    {
+        sprintf(buf, "player%d", i);
+        members.push_back(std::make_pair(i + 0.5, string(buf)));
+    }
+
+    ASSERT_EQ(Redic::OK, rdc.zadd("board", members, added));
+    ASSERT_EQ(1000, added);
+
+    ASSERT_EQ(Redic::OK, rdc.zrevrange("board", 0, 99, scores));
+    ASSERT_EQ(100, scores.size());
+    ASSERT_STREQ("player999", scores.member(0));
+    ASSERT_EQ(999.5, scores.score(0));
+    ASSERT_EQ(900.5, scores.score(99));
+
+    ASSERT_EQ(Redic::OK, rdc.zrangebyscore("board", 10, 20, scores));
+    ASSERT_EQ(10, scores.size());
+    ASSERT_EQ("player10", scores.str(0));
+    ASSERT_EQ(Redic::OK, rdc.zrangebyscore("board", -HUGE_VAL, HUGE_VAL, scores, 500, 3));
+    ASSERT_EQ(3, scores.size());
+    ASSERT_EQ(502.5, scores.score(2));
+    ASSERT_EQ(Redic::OK, rdc.zrevrangebyscore("board", 100, 0, elements, 0, 2));
+    ASSERT_EQ(2, elements.size());
+    ASSERT_STREQ("player99", elements[0]);
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.zrangebyscore("board", 2000, 3000, scores));
+
+    //the next page, after the last score seen
+    ASSERT_EQ(Redic::OK, rdc.zrangebyscore("board", "(502.5", "+inf", scores, 0, 2));
+    ASSERT_EQ(2, scores.size());
+    ASSERT_EQ(503.5, scores.score(0));
+    ASSERT_EQ(Redic::OK, rdc.zrevrangebyscore("board", "(99.5", "-inf", elements, 0, 1));
+    ASSERT_STREQ("player98", elements[0]);
+
+    members.clear();
+    members.push_back(std::make_pair(0.0, string("apple")));
+    members.push_back(std::make_pair(0.0, string("banana")));
+    members.push_back(std::make_pair(0.0, string("cherry")));
+    ASSERT_EQ(Redic::OK, rdc.zadd("fruits", members, added));
+    ASSERT_EQ(Redic::OK, rdc.zrangebylex("fruits", "(apple", "+", elements));
+    ASSERT_EQ(2, elements.size());
+    ASSERT_STREQ("banana", elements[0]);
+    ASSERT_EQ(Redic::OK, rdc.zrevrangebylex("fruits", "+", "-", elements, 1, 1));
+    ASSERT_EQ(1, elements.size());
+    ASSERT_STREQ("banana", elements[0]);
+
+    //a [member, score] pair per member under RESP3
+    if (rdc.hello(3) == Redic::OK)
+    {
+        ASSERT_EQ(Redic::OK, rdc.zrange("board", 0, 1, scores));
+        ASSERT_EQ(2, scores.size());
+        ASSERT_STREQ("player1", scores.member(1));
+        ASSERT_EQ(1.5, scores.score(1));
+    }
+
+	SUCCEED();
+}
+
+TEST(RedicTest, BitmapTest)
+{
+	Redic rdc;
+    Redic::Bitmap monday;
+    Redic::Bitmap tuesday;
+    List keys;
+    List ops;
+    std::vector<int64_t> results;
+    int64_t num;
+    int bit;
+    int length;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    //users 1, 7 and 100 active on monday, 7 and 64 on tuesday
+    ASSERT_EQ(Redic::OK, rdc.setbit("dau:mon", 1, 1, bit));
+    ASSERT_EQ(0, bit);
+    ASSERT_EQ(Redic::OK, rdc.setbit("dau:mon", 7, 1, bit));
+    ASSERT_EQ(Redic::OK, rdc.setbit("dau:mon", 100, 1, bit));
+    ASSERT_EQ(Redic::OK, rdc.setbit("dau:tue", 7, 1, bit));
+    ASSERT_EQ(Redic::OK, rdc.setbit("dau:tue", 64, 1, bit));
+    ASSERT_EQ(Redic::OK, rdc.setbit("dau:tue", 64, 1, bit));
+    ASSERT_EQ(1, bit);
+    ASSERT_EQ(Redic::OK, rdc.getbit("dau:mon", 100, bit));
+    ASSERT_EQ(1, bit);
+    ASSERT_EQ(Redic::OK, rdc.getbit("dau:mon", 99, bit));
+    ASSERT_EQ(0, bit);
+
+    ASSERT_EQ(Redic::OK, rdc.bitcount("dau:mon", num));
+    ASSERT_EQ(3, num);
+    ASSERT_EQ(Redic::OK, rdc.bitcount("dau:mon", 0, 0, num));
+    ASSERT_EQ(2, num);
+    ASSERT_EQ(Redic::OK, rdc.bitpos("dau:tue", 1, num));
+    ASSERT_EQ(7, num);
+
+    keys.push_back("dau:mon");
+    keys.push_back("dau:tue");
+    ASSERT_EQ(Redic::OK, rdc.bitop("OR", "dau:any", keys, length));
+    ASSERT_EQ(13, length);
+    ASSERT_EQ(Redic::OK, rdc.bitcount("dau:any", num));
+    ASSERT_EQ(4, num);
+
+    ops.push_back("INCRBY");
+    ops.push_back("u8");
+    ops.push_back("#0");
+    ops.push_back("5");
+    ops.push_back("GET");
+    ops.push_back("u8");
+    ops.push_back("0");
+    ASSERT_EQ(Redic::OK, rdc.bitfield("counters", ops, results));
+    ASSERT_EQ(2, (int)results.size());
+    ASSERT_EQ(5, results[1]);
+
+    //the same, combined locally
+    ASSERT_EQ(Redic::OK, rdc.getbits("dau:mon", monday));
+    ASSERT_EQ(Redic::OK, rdc.getbits("dau:tue", tuesday));
+    ASSERT_EQ(13, monday.size());
+    ASSERT_EQ(0, (int)((size_t)monday.data() % 8));
+    ASSERT_EQ(1, monday.bit(100));
+    ASSERT_EQ(3, monday.count());
+
+    Redic::Bitmap both = monday;
+    both &= tuesday;
+    ASSERT_EQ(1, both.count());
+    ASSERT_EQ(1, both.bit(7));
+    monday |= tuesday;
+    ASSERT_EQ(4, monday.count());
+    monday.set(200, 1);
+    ASSERT_EQ(26, monday.size());
+    ASSERT_EQ(5, monday.count());
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.getbits("dau:wed", tuesday));
+    ASSERT_TRUE(tuesday.empty());
+
+	SUCCEED();
+}
+
+TEST(RedicTest, HyperLogLogTest)
+{
+	Redic rdc;
+    List visitors;
+    List keys;
+    char buf[32];
+    int64_t count;
+    int changed;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    //more elements than one PFADD takes
+    for (int i=0; i<3000; i++)
+    {
+        sprintf(buf, "visitor%d", i);
+        visitors.push_back(buf);
+    }
+
+    ASSERT_EQ(Redic::OK, rdc.pfadd("uv:mon", visitors, changed));
+    ASSERT_EQ(1, changed);
+    ASSERT_EQ(Redic::OK, rdc.pfcount("uv:mon", count));
+    ASSERT_NEAR(3000, count, 60);
+
+    RedicPfBatch batch(rdc, 100, 10000);
+
+    for (int i=0; i<150; i++)
+    {
+        sprintf(buf, "visitor%d", i*100);
+        ASSERT_EQ(Redic::OK, batch.add(i%2 ? "uv:tue" : "uv:wed", buf));
+    }
+
+    ASSERT_EQ(50, batch.pending());
+    ASSERT_EQ(100, batch.flushed());
+    ASSERT_EQ(Redic::OK, batch.flush());
+    ASSERT_EQ(0, batch.pending());
+    ASSERT_EQ(Redic::OK, rdc.pfcount("uv:tue", count));
+    ASSERT_NEAR(75, count, 3);
+
+    keys.push_back("uv:tue");
+    keys.push_back("uv:wed");
+    ASSERT_EQ(Redic::OK, rdc.pfcount(keys, count));
+    ASSERT_NEAR(150, count, 5);
+    keys.push_back("uv:mon");
+    ASSERT_EQ(Redic::OK, rdc.pfmerge("uv:week", keys));
+    ASSERT_EQ(Redic::OK, rdc.pfcount("uv:week", count));
+    ASSERT_NEAR(3120, count, 70);
+
+    //the time threshold
+    RedicPfBatch slow(rdc, 100, 1);
+    ASSERT_EQ(Redic::OK, slow.add("uv:thu", "someone"));
+    sleep(2000);
+    ASSERT_EQ(Redic::OK, slow.poll());
+    ASSERT_EQ(0, slow.pending());
+
+	SUCCEED();
+}
+
+TEST(RedicTest, MigratorTest)
+{
+	Redic rdc;
+    List members;
+    List elements;
+    string val;
+    char buf[16];
+    int length;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(3));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+    ASSERT_EQ(Redic::OK, rdc.set("mig:str0", "stale"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+    for (int i=0; i<250; i++)
+    {
+        sprintf(buf, "mig:str%d", i);
+        ASSERT_EQ(Redic::OK, rdc.set(buf, buf));
+    }
+
+    members.push_back("a");
+    members.push_back("b");
+    ASSERT_EQ(Redic::OK, rdc.rpush("mig:list", members, length));
+    ASSERT_EQ(Redic::OK, rdc.set("other", "left behind"));
+
+    RedicMigrator migrator(20, 3, 0);
+    migrator.source(serverHost.c_str(), atoi(serverPort.c_str()), "redic", 2);
+    migrator.destination(serverHost.c_str(), atoi(serverPort.c_str()), "redic", 3);
+    ASSERT_EQ(Redic::OK, migrator.run("mig:*"));
+    ASSERT_EQ(251, migrator.migrated());
+    ASSERT_EQ(0, migrator.failed());
+    ASSERT_TRUE(migrator.bytes() > 0);
+
+    ASSERT_EQ(Redic::OK, rdc.select(3));
+    ASSERT_EQ(Redic::OK, rdc.get("mig:str0", val));
+    ASSERT_EQ("mig:str0", val);
+    ASSERT_EQ(Redic::OK, rdc.get("mig:str249", val));
+    ASSERT_EQ("mig:str249", val);
+    ASSERT_EQ(Redic::OK, rdc.lrange("mig:list", 0, -1, elements));
+    ASSERT_EQ("b", elements.back());
+    ASSERT_EQ(Redic::RECORD_NUL, rdc.get("other", val));
+
+    //at most 100 keys a second
+    RedicMigrator slow(50, 2, 100);
+    slow.source(serverHost.c_str(), atoi(serverPort.c_str()), "redic", 2);
+    slow.destination(serverHost.c_str(), atoi(serverPort.c_str()), "redic", 3);
+    time_t start = time(NULL);
+    ASSERT_EQ(Redic::OK, slow.run("mig:*"));
+    ASSERT_EQ(251, slow.migrated());
+
+    //all batches but the last, of 50 keys at most, wait their turn: 2.01 seconds
+    ASSERT_LE(2, time(NULL) - start);
+
+    RedicMigrator broken;
+    broken.source(serverHost.c_str(), atoi(serverPort.c_str()), "redic", 2);
+    broken.destination("127.0.0.1", 1, NULL, 0);
+    ASSERT_EQ(Redic::CONNECT_ERR, broken.run());
+
+	SUCCEED();
+}
+
+class Mirror : public RedicReplica::Handler
+{
+public:
+	Mirror() : resyncs(0), rdb(0), last(0) {}
+
+	void command(const Redic::Reply &args, int64_t offset)
+	{
+		string name = args.str(args.child(0, 0));
+
+		if (name == "SET")
+			values[args.str(args.child(0, 1))] = args.str(args.child(0, 2));
+
+		last = offset;
+	}
+
+	void resync(const string &replid, int64_t offset)
+	{
+		resyncs++;
+		values.clear();
+	}
+
+	void snapshot(const char *data, int len)
+	{
+		rdb += len;
+	}
+
+	std::map<string, string> values;
+	int resyncs;
+	int rdb;
+	int64_t last;
+};
+
+TEST(RedicTest, ReplicaTest)
+{
+	Redic rdc;
+    Mirror mirror;
+    RedicReplica replica(mirror, 64*1024);
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    //written before the sync, so only in the RDB
+    ASSERT_EQ(Redic::OK, rdc.set("repl:a", "1"));
+
+	ASSERT_EQ(Redic::OK, replica.connect(serverHost.c_str(), atoi(serverPort.c_str()), "redic"));
+	ASSERT_EQ(Redic::OK, replica.sync());
+
+    //up to 10 seconds, as a server with repl-diskless-sync, the default since
+    //Redis 7, waits repl-diskless-sync-delay, 5 seconds, before the RDB
+    for (int i=0; i<200 && mirror.rdb == 0; i++)
+        ASSERT_TRUE(replica.poll(50) >= 0);
+
+    ASSERT_EQ(1, mirror.resyncs);
+    ASSERT_TRUE(mirror.rdb > 0);
+    ASSERT_FALSE(replica.replid().empty());
+
+    //live writes
+    ASSERT_EQ(Redic::OK, rdc.set("repl:b", "2"));
+
+    for (int i=0; i<200 && mirror.values["repl:b"] != "2"; i++)
+        ASSERT_TRUE(replica.poll(50) >= 0);
+
+    ASSERT_EQ("2", mirror.values["repl:b"]);
+    ASSERT_EQ(mirror.last, replica.offset());
+
+    //a write missed while away comes on resuming, with no new resync
+    string replid = replica.replid();
+    int64_t offset = replica.offset();
+    RedicReplica again(mirror);
+    again.resume(replid.c_str(), offset);
+    ASSERT_EQ(Redic::OK, rdc.set("repl:c", "3"));
+	ASSERT_EQ(Redic::OK, again.connect(serverHost.c_str(), atoi(serverPort.c_str()), "redic"));
+	ASSERT_EQ(Redic::OK, again.sync());
+
+    for (int i=0; i<200 && mirror.values["repl:c"] != "3"; i++)
+        ASSERT_TRUE(again.poll(50) >= 0);
+
+    ASSERT_EQ("3", mirror.values["repl:c"]);
+    ASSERT_EQ(1, mirror.resyncs);
+    ASSERT_TRUE(again.offset() > offset);
+
+	SUCCEED();
+}
+
+class Dump : public RedicRdb::Handler, public Redic::Visitor
+{
+public:
+	Dump() { counts[0] = counts[1] = 0; }
+
+	int entry(const RedicRdb::Entry &entry)
+	{
+		//each file is scanned by one thread only
+		counts[entry.file()]++;
+
+		if (entry.file() != 0)
+			return Redic::OK;
+
+		string key(entry.key(), entry.key_length());
+		items.clear();
+
+		if (entry.visit(*this) != Redic::OK)
+			return Redic::SYNTAX_ERR;
+
+		values[key] = items;
+		types[key] = entry.type();
+		dbs[key] = entry.db();
+		expires[key] = entry.expire();
+
+		if (key == "z")
+			entry.members(scores);
+
+		if (key == "s")
+			entry.members(members);
+
+		if (key == "l")
+			return entry.value(items) == Redic::SYNTAX_ERR ? entry.elements(elements) : Redic::SYNTAX_ERR;
+
+		return Redic::OK;
+	}
+
+	int visit(int index, const char *data, int len)
+	{
+		items += index ? "," : "";
+		items.append(data, len);
+		return Redic::OK;
+	}
+
+	string items;
+	std::map<string, string> values;
+	std::map<string, int> types;
+	std::map<string, int> dbs;
+	std::map<string, int64_t> expires;
+	Redic::ScoreList scores;
+	Redic::Set members;
+	List elements;
+	int counts[2];
+};
+
+TEST(RedicTest, RdbTest)
+{
+	static const char data[] =
+		"REDIS0011"
+		"\xfa\x09redis-ver\x05" "7.2.0"
+		"\xfe\x00\xfb\x0b\x01"
+		"\xfc\x00\x68\xe5\xcf\x8b\x01\x00\x00"
+		"\x00\x03str\x05hello"
+		"\x00\x03int\xc1\x39\x30"
+		"\x00\x03neg\xc0\xf6"
+		//"abc" then 9 bytes from 3 back
+		"\x00\x03lzf\xc3\x07\x0c\x02" "abc\xe0\x00\x02"
+		"\x10\x01h\x14\x14\x00\x00\x00\x04\x00\x82" "f1\x03\x82v1\x03\x81n\x02\x07\x01\xff"
+		"\x0b\x01s\x0e\x02\x00\x00\x00\x03\x00\x00\x00\xfe\xff\x05\x00\x2c\x01"
+		"\xf9\x05"
+		"\x12\x01l\x02\x02\x0d\x0d\x00\x00\x00\x02\x00\x81" "a\x02\x81" "b\x02\xff\x01\x03" "big"
+		"\x11\x01z\x1d\x1d\x00\x00\x00\x06\x00\x82m1\x03\x01\x01\x82m2\x03\xdf\x9c\x02"
+		"\x82m3\x04\x83" "2.5\x04\xff"
+		"\x0a\x02zl\x14\x14\x00\x00\x00\x0f\x00\x00\x00\x03\x00\x00\x02xy\x04\xfe\xfb\x03\xf4\xff"
+		"\x05\x02z2\x01\x01k\x00\x00\x00\x00\x00\x00\xe0\x3f"
+		"\xfe\x01\x00\x01k\x01v"
+		"\xff\x00\x00\x00\x00\x00\x00\x00\x00";
+	string path = "redic_test.rdb";
+	string copy = "redic_test_copy.rdb";
+	RedicRdb rdb;
+	Dump dump;
+
+	FILE *file = fopen(path.c_str(), "wb");
+	ASSERT_TRUE(file != NULL);
+	fwrite(data, 1, sizeof(data) - 1, file);
+	fclose(file);
+
+	ASSERT_EQ(Redic::RECORD_NUL, rdb.open("no_such.rdb"));
+	ASSERT_EQ(Redic::OK, rdb.open(path.c_str()));
+	ASSERT_EQ(Redic::OK, rdb.scan(dump));
+	ASSERT_EQ(11, dump.counts[0]);
+
+	ASSERT_EQ("hello", dump.values["str"]);
+	ASSERT_EQ(RedicRdb::TYPE_STRING, dump.types["str"]);
+	ASSERT_EQ(1700000000000LL, dump.expires["str"]);
+	ASSERT_EQ(-1, dump.expires["int"]);
+	ASSERT_EQ("12345", dump.values["int"]);
+	ASSERT_EQ("-10", dump.values["neg"]);
+	ASSERT_EQ("abcabcabcabc", dump.values["lzf"]);
+	ASSERT_EQ("f1,v1,n,7", dump.values["h"]);
+	ASSERT_EQ(RedicRdb::TYPE_HASH, dump.types["h"]);
+	ASSERT_EQ("-2,5,300", dump.values["s"]);
+	ASSERT_EQ(3, dump.members.size());
+	ASSERT_EQ(1, dump.members.count("300"));
+	ASSERT_EQ("a,b,big", dump.values["l"]);
+	ASSERT_EQ(3, dump.elements.size());
+	ASSERT_EQ("big", dump.elements.back());
+	ASSERT_EQ("m1,1,m2,-100,m3,2.5", dump.values["z"]);
+	ASSERT_EQ(3, dump.scores.size());
+	ASSERT_EQ(1, dump.scores.front().first);
+	ASSERT_EQ(2.5, dump.scores.back().first);
+	ASSERT_EQ("m3", dump.scores.back().second);
+	ASSERT_EQ("xy,-5,3", dump.values["zl"]);
+	ASSERT_EQ(RedicRdb::TYPE_LIST, dump.types["zl"]);
+	ASSERT_EQ("k,0.5", dump.values["z2"]);
+	ASSERT_EQ(0, dump.dbs["z2"]);
+	ASSERT_EQ(1, dump.dbs["k"]);
+
+	//a file cut short
+	file = fopen(copy.c_str(), "wb");
+	ASSERT_TRUE(file != NULL);
+	fwrite(data, 1, 120, file);
+	fclose(file);
+	ASSERT_EQ(Redic::OK, rdb.open(copy.c_str()));
+	ASSERT_EQ(Redic::SYNTAX_ERR, rdb.scan(dump));
+	rdb.unmap();
+
+	file = fopen(copy.c_str(), "wb");
+	ASSERT_TRUE(file != NULL);
+	fwrite(data, 1, sizeof(data) - 1, file);
+	fclose(file);
+
+	Dump both;
+	List paths;
+	paths.push_back(path);
+	paths.push_back(copy);
+	ASSERT_EQ(Redic::OK, RedicRdb::scan(paths, both, 2));
+	ASSERT_EQ(11, both.counts[0]);
+	ASSERT_EQ(11, both.counts[1]);
+
+	//an entry of 16383 bytes, whose back length takes 3 bytes rather than 2
+	string big("REDIS0011\x14\x03" "big\x80\x00\x00\x40\x0b\x0b\x40\x00\x00\x02\x00\xf0\xfa\x3f\x00\x00", 30);
+	big.append(16378, 'x');
+	big.append("\x00\xff\xff\x05\x01\xff\xff", 7);
+
+	file = fopen(path.c_str(), "wb");
+	ASSERT_TRUE(file != NULL);
+	fwrite(big.data(), 1, big.length(), file);
+	fclose(file);
+
+	Dump wide;
+	ASSERT_EQ(Redic::OK, rdb.open(path.c_str()));
+	ASSERT_EQ(Redic::OK, rdb.scan(wide));
+	ASSERT_EQ(1, wide.counts[0]);
+	ASSERT_EQ(16378 + 2, (int)wide.values["big"].length());
+	ASSERT_EQ(",5", wide.values["big"].substr(16378));
+	rdb.unmap();
+
+	remove(path.c_str());
+	remove(copy.c_str());
+
+	SUCCEED();
+}
+
+TEST(RedicTest, LoaderTest)
+{
+	Redic rdc;
+    RedicLoader loader(64*1024);
+    char key[16];
+    char val[16];
+    string msg;
+    int num;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+	ASSERT_EQ(Redic::OK, loader.connect(serverHost.c_str(), atoi(serverPort.c_str()), "redic"));
+    ASSERT_EQ(Redic::OK, loader.add("SELECT", "2"));
+
+    for (int i=0; i<20000; i++)
+    {
+        sprintf(key, "key%d", i);
+        sprintf(val, "val%d", i);
+        ASSERT_EQ(Redic::OK, loader.add("SET", key, val));
+    }
+
+    //the failing command is told by its index
+    ASSERT_EQ(Redic::OK, loader.add("INCR", "key7"));
+    ASSERT_EQ(Redic::OK, loader.add("RPUSH", "keyl1", "val1"));
+
+    ASSERT_EQ(Redic::SERVER_ERR, loader.finish());
+    ASSERT_EQ(20003, loader.sent());
+    ASSERT_EQ(20003, loader.received());
+    ASSERT_EQ(1, loader.errors());
+    ASSERT_EQ(20001, loader.first_error(msg));
+    ASSERT_FALSE(msg.empty());
+
+    ASSERT_EQ(Redic::OK, rdc.dbsize(num));
+    ASSERT_EQ(20001, num);
+
+#ifndef WIN32
+    //a server which never replies
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(fd, (sockaddr *)&addr, sizeof(addr)));
+    ASSERT_EQ(0, listen(fd, 1));
+    ASSERT_EQ(0, getsockname(fd, (sockaddr *)&addr, &len));
+
+    RedicLoader stalled;
+	ASSERT_EQ(Redic::OK, stalled.connect("127.0.0.1", ntohs(addr.sin_port)));
+    ASSERT_EQ(Redic::OK, stalled.add("PING"));
+    ASSERT_EQ(Redic::CONNECT_ERR, stalled.finish());
+    ASSERT_EQ(0, stalled.received());
+    close(fd);
+#endif
+
+	SUCCEED();
+}
+
+class Inbox : public RedicSubscriber::Handler
+{
+public:
+    Inbox() : batches(0), disconnects(0) {}
+
+    void deliver(const std::vector<RedicSubscriber::Message> &messages)
+    {
+        batches++;
+        all.insert(all.end(), messages.begin(), messages.end());
+    }
+
+    void disconnected()
+    {
+        disconnects++;
+    }
+
+    int batches;
+    int disconnects;
+    std::vector<RedicSubscriber::Message> all;
+};
+
+TEST(RedicTest, PubSubTest)
+{
+	Redic rdc;
+    Inbox inbox;
+    RedicSubscriber sub(inbox, 16);
+    char buf[16];
+    int num;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+
+	ASSERT_EQ(Redic::OK, sub.connect(serverHost.c_str(), atoi(serverPort.c_str()), "redic"));
+	ASSERT_EQ(Redic::OK, sub.subscribe("chan1"));
+	ASSERT_EQ(Redic::OK, sub.psubscribe("pat*"));
+
+    for (int i=0; i<50 && sub.subscriptions() < 2; i++)
+        ASSERT_EQ(0, sub.poll(20));
+
+    ASSERT_EQ(2, sub.subscriptions());
+
+	ASSERT_EQ(Redic::OK, rdc.publish("chan1", "msg1", num));
+    ASSERT_EQ(1, num);
+	ASSERT_EQ(Redic::OK, rdc.publish("pattern", "msg2", num));
+	ASSERT_EQ(Redic::OK, rdc.publish("chan?", "msg3", num));
+    ASSERT_EQ(0, num);
+
+    ASSERT_EQ(2, sub.poll(100));
+    ASSERT_EQ(2, (int)inbox.all.size());
+    ASSERT_EQ("chan1", inbox.all[0].channel);
+    ASSERT_EQ("msg1", inbox.all[0].payload);
+    ASSERT_EQ("pat*", inbox.all[1].pattern);
+    ASSERT_EQ("pattern", inbox.all[1].channel);
+
+    //from the dispatch thread, in batches
+    inbox.all.clear();
+    inbox.batches = 0;
+	ASSERT_EQ(Redic::OK, sub.start());
+    ASSERT_EQ(-Redic::SYNTAX_ERR, sub.poll(0));
+
+    for (int i=0; i<100; i++)
+    {
+        sprintf(buf, "msg%d", i);
+    	ASSERT_EQ(Redic::OK, rdc.publish("chan1", buf, num));
+    }
+
+    for (int i=0; i<50 && sub.received() < 102; i++)
+        sleep(20*1000);
+
+    sub.stop();
+    ASSERT_EQ(102, sub.received());
+    ASSERT_EQ(100, (int)inbox.all.size());
+    ASSERT_EQ("msg99", inbox.all[99].payload);
+    ASSERT_LE(7, inbox.batches);
+
+#ifndef WIN32
+    //a server which drops the connection under the dispatch thread
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(fd, (sockaddr *)&addr, sizeof(addr)));
+    ASSERT_EQ(0, listen(fd, 1));
+    ASSERT_EQ(0, getsockname(fd, (sockaddr *)&addr, &len));
+
+    Inbox lost;
+    RedicSubscriber dropped(lost);
+	ASSERT_EQ(Redic::OK, dropped.connect("127.0.0.1", ntohs(addr.sin_port)));
+    int peer = accept(fd, NULL, NULL);
+    ASSERT_LE(0, peer);
+	ASSERT_EQ(Redic::OK, dropped.start());
+    ASSERT_EQ(-Redic::SYNTAX_ERR, dropped.poll(0));
+    close(peer);
+
+    for (int i=0; i<50 && dropped.poll(0) != -Redic::CONNECT_ERR; i++)
+        sleep(20*1000);
+
+    ASSERT_EQ(-Redic::CONNECT_ERR, dropped.poll(0));
+    ASSERT_EQ(1, lost.disconnects);
+    ASSERT_EQ(Redic::CONNECT_ERR, dropped.start());
+    close(fd);
+#endif
+
+	SUCCEED();
+}
+
+#ifndef WIN32
+struct Readers
+{
+    RedicSingleFlight *flight;
+    pthread_mutex_t lock;
+    pthread_cond_t go;
+    int waiting;
+};
+
+static void *ConcurrentRead(void *arg)
+{
+    Readers *readers = (Readers *)arg;
+    List args;
+    Reply reply;
+    string val;
+
+    //start all together, so that the reads overlap
+    pthread_mutex_lock(&readers->lock);
+
+    if (--readers->waiting == 0)
+        pthread_cond_broadcast(&readers->go);
+
+    while (readers->waiting > 0)
+        pthread_cond_wait(&readers->go, &readers->lock);
+
+    pthread_mutex_unlock(&readers->lock);
+
+    args.push_back("get");
+    args.push_back("key1");
+
+    for (int i=0; i<50; i++)
+    {
+        readers->flight->get("key1", val);
+        readers->flight->command(args, reply);
+    }
+
+    return NULL;
+}
+
+TEST(RedicTest, SingleFlightTest)
+{
+	Redic rdc;
+    RedicSingleFlight flight(rdc);
+    Readers readers;
+    pthread_t threads[8];
+    List args;
+    Reply reply;
+    string val;
+
+	ASSERT_EQ(Redic::OK, rdc.connect(serverHost.c_str(), atoi(serverPort.c_str())));
+	ASSERT_EQ(Redic::OK, rdc.auth("redic"));
+    ASSERT_EQ(Redic::OK, rdc.select(2));
+    ASSERT_EQ(Redic::OK, rdc.flushdb());
+
+	ASSERT_EQ(Redic::OK, rdc.set("key1", "val1"));
+	ASSERT_EQ(Redic::OK, flight.get("key1", val));
+    ASSERT_EQ("val1", val);
+	ASSERT_EQ(Redic::RECORD_NUL, flight.get("key?", val));
+    ASSERT_EQ(2, flight.calls());
+    ASSERT_EQ(0, flight.collapsed());
+
+    //writes and blocking reads are not shared, nor sent
+    args.push_back("INCR");
+    args.push_back("key1");
+    ASSERT_EQ(Redic::SYNTAX_ERR, flight.command(args, reply));
+    args.front() = "blpop";
+    ASSERT_EQ(Redic::SYNTAX_ERR, flight.command(args, reply));
+    ASSERT_EQ(2, flight.calls());
+
+    //the reads joining one in flight share its reply
+    readers.flight = &flight;
+    readers.waiting = 8;
+    pthread_mutex_init(&readers.lock, NULL);
+    pthread_cond_init(&readers.go, NULL);
+
+    for (int i=0; i<8; i++)
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, ConcurrentRead, &readers));
+
+    for (int i=0; i<8; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&readers.go);
+    pthread_mutex_destroy(&readers.lock);
+
+    ASSERT_EQ(802, flight.calls());
+    ASSERT_LE(1, flight.collapsed());
+
+	SUCCEED();
+}
+#endif
+
 #endif
 
 int main(int argc, char *argv[])